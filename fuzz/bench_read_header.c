@@ -0,0 +1,240 @@
+/* bench_read_header.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SYS_WAIT_H
+# include <sys/wait.h>
+#endif
+#ifdef HAVE_SYS_RESOURCE_H
+# include <sys/resource.h>
+#endif
+
+#include <libpbo/pbo.h>
+
+#define BENCH_NS_PER_BYTE 1000 //Far above linear, far below quadratic
+#define BENCH_MEM_PER_BYTE 16
+#define BENCH_MEM_SLACK (8 << 20)
+
+/* Headers built to be as expensive to parse as possible for their size,
+ * each with the result pbo_read_header has to come to. Run with a
+ * directory to also write them there, as seeds for fuzz_read_header. */
+enum {
+    CASE_TINY, //A million entries of one byte each
+    CASE_LONGNAMES, //Every name as long as it can be
+    CASE_OVERLONG, //A name without end
+    CASE_HUGE, //Entries claiming 4 GiB each
+    CASE_PACKED, //Compressed entries claiming 4 GiB decoded
+    CASE_EXTBOMB, //A million extension strings
+    CASE_TRUNCATED, //The first case cut in half
+    CASE_COUNT
+};
+
+static const struct {
+    const char *name;
+    pbo_error expect;
+} bench_cases[CASE_COUNT] = {
+    { "tiny", PBO_SUCCESS },
+    { "longnames", PBO_SUCCESS },
+    { "overlong", PBO_ERROR_BROKEN },
+    { "huge", PBO_ERROR_BROKEN },
+    { "packed", PBO_ERROR_BROKEN },
+    { "extbomb", PBO_SUCCESS },
+    { "truncated", PBO_ERROR_BROKEN },
+};
+
+struct bench_buf {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+};
+
+static void bench_put(struct bench_buf *b, const void *src, size_t n)
+{
+    if(b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 1 << 20;
+        while(cap < b->len + n)
+            cap *= 2;
+        unsigned char *data = realloc(b->data, cap);
+        if(!data) {
+            fprintf(stderr, "out of memory\n");
+            exit(2);
+        }
+        b->data = data;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, src, n);
+    b->len += n;
+}
+
+static void bench_put_entry(struct bench_buf *b, const char *name, uint32_t packing, uint32_t original, uint32_t size)
+{
+    uint32_t props[5] = { packing, original, 0, 0, size };
+    unsigned char raw[20];
+    for(int i = 0; i < 20; i++)
+        raw[i] = props[i / 4] >> (8 * (i % 4));
+    bench_put(b, name, strlen(name) + 1);
+    bench_put(b, raw, sizeof raw);
+}
+
+//The terminating entry, data of the given size and an empty hash
+static void bench_put_tail(struct bench_buf *b, size_t data)
+{
+    static const unsigned char zero[4096];
+    bench_put_entry(b, "", 0, 0, 0);
+    for(; data; data -= data < sizeof zero ? data : sizeof zero)
+        bench_put(b, zero, data < sizeof zero ? data : sizeof zero);
+    bench_put(b, zero, 21);
+}
+
+static void bench_build(int c, struct bench_buf *b)
+{
+    char name[PBO_MAXNAMELEN + 1];
+    switch(c) {
+    case CASE_TINY:
+    case CASE_TRUNCATED:
+        for(int i = 0; i < 1000000; i++) {
+            snprintf(name, sizeof name, "d%03d\\%07d.sqf", i % 1000, i);
+            bench_put_entry(b, name, 0, 0, 1);
+        }
+        bench_put_tail(b, 1000000);
+        if(c == CASE_TRUNCATED)
+            b->len /= 2;
+        break;
+    case CASE_LONGNAMES:
+        for(int i = 0; i < 32768; i++) {
+            memset(name, 'a' + i % 26, PBO_MAXNAMELEN - 1);
+            snprintf(name, 9, "%08d", i);
+            name[8] = '\\';
+            name[PBO_MAXNAMELEN - 1] = '\0';
+            bench_put_entry(b, name, 0, 0, 0);
+        }
+        bench_put_tail(b, 0);
+        break;
+    case CASE_OVERLONG:
+        memset(name, 'x', sizeof name);
+        for(int i = 0; i < 2048; i++)
+            bench_put(b, name, sizeof name);
+        bench_put_tail(b, 0);
+        break;
+    case CASE_HUGE:
+    case CASE_PACKED:
+        for(int i = 0; i < 1000000; i++) {
+            snprintf(name, sizeof name, "%07d", i);
+            if(c == CASE_HUGE)
+                bench_put_entry(b, name, 0, 0, UINT32_MAX);
+            else
+                bench_put_entry(b, name, PBO_PACKING_COMPRESSED, UINT32_MAX, 16);
+        }
+        bench_put_tail(b, 16);
+        break;
+    case CASE_EXTBOMB:
+        bench_put_entry(b, "", 0x56657273, 0, 0);
+        for(int i = 0; i < 1000000; i++)
+            bench_put(b, i % 2 ? "v" : "k", 2);
+        bench_put(b, "", 1);
+        bench_put_entry(b, "a.sqf", 0, 0, 1);
+        bench_put_tail(b, 1);
+        break;
+    }
+}
+
+static uint64_t bench_now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#else
+    return (uint64_t)clock() * (1000000000u / CLOCKS_PER_SEC);
+#endif
+}
+
+//Peak resident bytes so far, 0 where that can't be told
+static size_t bench_peak(void)
+{
+#ifdef HAVE_SYS_RESOURCE_H
+    struct rusage ru;
+    if(!getrusage(RUSAGE_SELF, &ru))
+        return (size_t)ru.ru_maxrss * 1024;
+#endif
+    return 0;
+}
+
+//Parses one case and reports it, 0 if it came out as expected and in bounds
+static int bench_run(int c, const struct bench_buf *b)
+{
+    pbo_io io;
+    pbo_t d = pbo_init(NULL);
+    if(!d || pbo_io_memory(&io, b->data, b->len) || pbo_set_io(d, &io))
+        return 1;
+
+    size_t peak = bench_peak();
+    uint64_t start = bench_now();
+    pbo_error ret = pbo_read_header(d);
+    uint64_t ns = bench_now() - start;
+    size_t grown = bench_peak() - peak;
+
+    pbo_dispose(d);
+    pbo_io_close(&io);
+
+    int slow = ns > (uint64_t)b->len * BENCH_NS_PER_BYTE;
+    int fat = grown > b->len * BENCH_MEM_PER_BYTE + BENCH_MEM_SLACK;
+    printf("%-10s %10zu bytes  result %d  %8.2f ms  %6.1f ns/byte  %8zu KiB peak%s%s%s\n",
+           bench_cases[c].name, b->len, (int)ret, ns / 1e6, (double)ns / b->len, grown / 1024,
+           ret != bench_cases[c].expect ? "  WRONG RESULT" : "", slow ? "  TOO SLOW" : "", fat ? "  TOO BIG" : "");
+    fflush(stdout);
+    return ret != bench_cases[c].expect || slow || fat;
+}
+
+//Each case in a child of its own, so the peaks don't add up
+static int bench_isolated(int c, const struct bench_buf *b)
+{
+#if defined(HAVE_UNISTD_H) && defined(HAVE_SYS_WAIT_H) && defined(HAVE_FORK)
+    pid_t pid = fork();
+    if(pid == 0)
+        _exit(bench_run(c, b));
+    int status;
+    if(pid > 0 && waitpid(pid, &status, 0) == pid)
+        return !WIFEXITED(status) || WEXITSTATUS(status);
+#endif
+    return bench_run(c, b);
+}
+
+int main(int argc, char **argv)
+{
+    const char *seeds = argc > 1 ? argv[1] : NULL;
+    int failed = 0;
+
+    for(int c = 0; c < CASE_COUNT; c++) {
+        struct bench_buf b = { NULL, 0, 0 };
+        bench_build(c, &b);
+
+        if(seeds) {
+            char path[4096];
+            snprintf(path, sizeof path, "%s/%s.pbo", seeds, bench_cases[c].name);
+            FILE *file = fopen(path, "wb");
+            if(!file || fwrite(b.data, 1, b.len, file) != b.len)
+                fprintf(stderr, "%s: can't write\n", path);
+            if(file)
+                fclose(file);
+        }
+
+        failed |= bench_isolated(c, &b);
+        free(b.data);
+    }
+    return failed;
+}
@@ -0,0 +1,92 @@
+/* fuzz_read_header.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <libpbo/pbo.h>
+
+#define FUZZ_MAXREAD (64 << 20) //Entries claiming more aren't loaded
+
+/* Parses data as an archive held in memory, then loads every entry the
+ * header accepted and verifies the whole. Whatever the bytes, this has to
+ * return without crashing, leaking or taking more than linear time. */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    pbo_io io;
+    pbo_t d = pbo_init(NULL);
+    if(!d || pbo_io_memory(&io, data, size)) {
+        pbo_dispose(d);
+        return 0;
+    }
+    pbo_set_io(d, &io);
+
+    if(!pbo_read_header(d)) {
+        pbo_iterator it;
+        const pbo_file_info *fi;
+        pbo_iter_begin(d, &it);
+        while((fi = pbo_iter_next(&it))) {
+            size_t sz = pbo_get_file_size(d, fi->name);
+            void *buf = sz && sz <= FUZZ_MAXREAD ? malloc(sz) : NULL;
+            if(buf)
+                pbo_read_file(d, fi->name, buf, sz);
+            free(buf);
+        }
+        pbo_verify(d);
+    }
+
+    pbo_dispose(d);
+    pbo_io_close(&io);
+    return 0;
+}
+
+#ifndef PBO_LIBFUZZER
+/* Without libFuzzer every argument is run as one input, or stdin if there
+ * are none, which is what AFL and replaying a corpus want. */
+static int fuzz_run_file(FILE *file)
+{
+    size_t len = 0, cap = 65536;
+    uint8_t *buf = malloc(cap);
+    while(buf) {
+        len += fread(buf + len, 1, cap - len, file);
+        if(len < cap)
+            break;
+        uint8_t *grown = realloc(buf, cap *= 2);
+        if(!grown)
+            free(buf);
+        buf = grown;
+    }
+    if(!buf || ferror(file)) {
+        free(buf);
+        return 1;
+    }
+    LLVMFuzzerTestOneInput(buf, len);
+    free(buf);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 2)
+        return fuzz_run_file(stdin);
+
+    int ret = 0;
+    for(int i = 1; i < argc; i++) {
+        FILE *file = fopen(argv[i], "rb");
+        if(!file || fuzz_run_file(file)) {
+            fprintf(stderr, "%s: can't read\n", argv[i]);
+            ret = 1;
+        }
+        if(file)
+            fclose(file);
+    }
+    return ret;
+}
+#endif
@@ -5,6 +5,14 @@
 #ifndef LIBpbo_pbo_H
 #define LIBpbo_pbo_H 1
 
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PBO_MAXNAMELEN 512
+#define PBO_PACKING_COMPRESSED 0x43707273 //LZSS, original_size is the decoded size
+#define PBO_PACKING_BLOCKS 0x426c6b73 //Independent LZSS blocks, the game can't load these
+
 typedef enum
 {
     PBO_SUCCESS = 0,
@@ -15,32 +23,311 @@ typedef enum
     PBO_ERROR_STATE,
 } pbo_error;
 
+typedef enum
+{
+    PBO_TIMESTAMP_NOW = 0, //Time of adding the file
+    PBO_TIMESTAMP_EPOCH, //A fixed time for every file
+    PBO_TIMESTAMP_SOURCE, //Modification time of the source, the epoch for memory
+} pbo_timestamp;
+
+typedef enum
+{
+    PBO_OP_READ_HEADER = 0,
+    PBO_OP_LOOKUP, //pbo_lookup_find and pbo_get_file_size
+    PBO_OP_READ_FILE, //pbo_read_file and pbo_write_to_file
+    PBO_OP_WRITE,
+    PBO_OP_COMMIT,
+    PBO_OP_EXTRACT,
+    PBO_OP_VERIFY,
+    PBO_OP_COUNT,
+} pbo_op;
+
 typedef void (*pbo_listcb)(const char*, void*);
+typedef void (*pbo_freecb)(void*, void*);
 
 typedef struct pbo *pbo_t;
+typedef struct pbo_cache *pbo_cache_t;
+typedef struct pbo_batch *pbo_batch_t;
+typedef struct pbo_lookup *pbo_lookup_t;
+typedef struct pbo_http *pbo_http_t;
+
+/* Backend for reading and writing archives, pbo_set_io attaches one in
+ * place of the filename. Calls return the bytes transferred, 0 on error. */
+typedef struct pbo_io_ops
+{
+    size_t (*read_at)(void *handle, void *buf, size_t size, uint64_t offset);
+    size_t (*write_at)(void *handle, const void *buf, size_t size, uint64_t offset);
+    int (*size)(void *handle, uint64_t *size);
+    int (*truncate)(void *handle, uint64_t size); //Optional, pbo_commit needs it
+    void (*close)(void *handle); //Optional
+} pbo_io_ops;
+
+typedef struct pbo_io
+{
+    const pbo_io_ops *ops;
+    void *handle;
+} pbo_io;
+
+typedef struct pbo_file_info
+{
+    const char *name; //Owned by the pbo_t, valid until it's cleared
+    uint32_t packing_method;
+    uint32_t original_size;
+    uint32_t timestamp;
+    uint32_t size;
+    size_t offset; //Of the data, from the start of the archive
+} pbo_file_info;
+
+typedef struct pbo_dir_options
+{
+    const char *prefix; //Stored as the prefix extension if set
+    const char **include; //NULL terminated globs as for pbo_query_glob, NULL takes everything
+    const char **exclude;
+    int threads; //0 for one per CPU
+} pbo_dir_options;
+
+typedef struct pbo_pack_spec
+{
+    const char *output; //Archive to write
+    const char *root; //Directory packed as by pbo_add_directory
+    const pbo_dir_options *opts; //Optional, its threads is ignored
+    pbo_error result; //Set by pbo_pack_many
+} pbo_pack_spec;
+
+typedef struct pbo_pack_options
+{
+    int threads; //0 for one per CPU
+    size_t budget; //File data held at once over all archives, 0 for no limit
+    void (*setup)(pbo_t d, size_t ind, void *user); //Optional, on the workers before specs[ind] is added
+    void *user;
+} pbo_pack_options;
+
+typedef struct pbo_block_options
+{
+    size_t min_size; //Smaller entries are stored as they are, 0 for 1 MiB
+    size_t block_size; //Decoded bytes per block, at most 1 GiB, 0 for 256 KiB
+    int threads; //0 for one per CPU
+} pbo_block_options;
+
+typedef struct pbo_trace_hooks
+{
+    void (*begin)(pbo_op op, const char *name, void *user); //Optional
+    void (*end)(pbo_op op, const char *name, pbo_error result, uint64_t ns, void *user); //Optional
+    void *user;
+} pbo_trace_hooks;
+
+typedef struct pbo_extract_options
+{
+    int timestamps; //Set mtimes from the entries' TIME_STAMP where there is one
+    int direct; //Write files of 1 MiB and up around the page cache, as pbo_set_direct_io
+} pbo_extract_options;
+
+typedef struct pbo_iterator
+{
+    const void *next;
+    size_t headersz;
+    pbo_file_info info;
+} pbo_iterator;
+
+typedef struct pbo_query
+{
+    const void *index;
+    int mode;
+    size_t pos, end;
+    size_t headersz;
+    char pattern[PBO_MAXNAMELEN];
+    char path[PBO_MAXNAMELEN];
+    pbo_file_info info;
+} pbo_query;
+
+typedef struct pbo_stat
+{
+    pbo_error error; //The rest is only meaningful on PBO_SUCCESS
+    uint32_t entries; //Files, not counting the header extension
+    uint64_t data_size; //Sum of the stored sizes
+    uint64_t original_size; //Sum of the decoded sizes
+    uint64_t header_size;
+    uint64_t file_size;
+    char prefix[PBO_MAXNAMELEN]; //Empty without a prefix extension
+    int has_sha1; //Old archives end without one
+    uint8_t sha1[20];
+} pbo_stat;
+
+typedef struct pbo_cache_stats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t entries;
+    size_t bytes;
+    size_t budget;
+} pbo_cache_stats;
 
 pbo_t pbo_init(const char *filename);
 void pbo_clear(pbo_t d);
 void pbo_dispose(pbo_t d);
 pbo_error pbo_set_filename(pbo_t d, const char *filename);
+pbo_error pbo_set_io(pbo_t d, const pbo_io *io);
+/* Archives keep their file open from pbo_read_header to pbo_clear. This caps
+ * how many stay open process wide, least recently read are closed first
+ * and reopened on demand. 0, the default, means no limit. */
+void pbo_set_max_open_files(size_t max);
+/* Traced calls run the hooks on the calling thread, name being the archive
+ * or entry, and fire the USDT probes libpbo:op_begin and libpbo:op_end
+ * where sys/sdt.h was found. Histograms keep every call's latency per op
+ * for percentiles and JSON. Calls returning sizes are traced with the
+ * status behind them, reading an empty file succeeds.
+ * Both are process wide, set them before archives are in use. */
+void pbo_set_trace_hooks(const pbo_trace_hooks *hooks);
+void pbo_set_latency_histograms(int enable);
+uint64_t pbo_latency_percentile(pbo_op op, double q);
+size_t pbo_latency_json(char *buf, size_t size);
+void pbo_latency_reset(void);
+const char *pbo_op_name(pbo_op op);
+
+/* Keeps decoded entries read by pbo_read_file within budget bytes, least
+ * recently used go first. One cache can be shared by any number of
+ * archives and threads, it lives until it's disposed and unset on all of
+ * them. */
+pbo_cache_t pbo_cache_init(size_t budget);
+void pbo_cache_dispose(pbo_cache_t c);
+pbo_error pbo_cache_get_stats(pbo_cache_t c, pbo_cache_stats *stats);
+pbo_error pbo_set_cache(pbo_t d, pbo_cache_t c);
+
+pbo_error pbo_io_fd(pbo_io *io, int fd);
+pbo_error pbo_io_memory(pbo_io *io, const void *data, size_t size);
+pbo_error pbo_io_buffer(pbo_io *io, size_t reserve);
+const void *pbo_io_buffer_data(const pbo_io *io, size_t *size);
+void pbo_io_close(pbo_io *io);
+
+/* Both settings survive pbo_clear. With a fixed or source timestamp and
+ * canonical order the same input always packs to the same bytes. */
+pbo_error pbo_set_timestamps(pbo_t d, pbo_timestamp mode, uint32_t epoch);
+pbo_error pbo_set_canonical_order(pbo_t d, int enable);
+/* pbo_write bypasses the page cache with O_DIRECT, for bulk packing whose
+ * output isn't read back soon. Falls back to buffered writes for attached
+ * io and filesystems that refuse it. Survives pbo_clear too. */
+pbo_error pbo_set_direct_io(pbo_t d, int enable);
+/* While block packing is set, pbo_write and pbo_commit cut every file of
+ * at least min_size they write from memory into blocks compressed on a
+ * pool, whenever it was added; files already in the archive stay as they
+ * are. For archives only this library reads. Reading them is transparent,
+ * big ones decode in parallel and pieces of them without the rest. Game
+ * loadable archives refuse to be written with any such entry, STATE from
+ * pbo_write and pbo_commit. Both survive pbo_clear. */
+pbo_error pbo_set_block_packing(pbo_t d, const pbo_block_options *opts);
+pbo_error pbo_set_game_loadable(pbo_t d, int enable);
+/* pbo_write and pbo_merge write next to the target and rename over it once
+ * the file is synced, so a crash leaves the old archive or the new one.
+ * Archives with a batch set are only put in place by pbo_batch_commit,
+ * which syncs all of them at once. Disposing a batch drops what it still
+ * holds. Shared and kept alive like a cache. */
+pbo_batch_t pbo_batch_init(void);
+pbo_error pbo_batch_commit(pbo_batch_t b);
+void pbo_batch_dispose(pbo_batch_t b);
+pbo_error pbo_set_batch(pbo_t d, pbo_batch_t b);
+
+/* Stores a CRC32C of every entry in the header extension, which
+ * pbo_read_file then checks for just the bytes it reads. Archives that
+ * have one keep it up to date on commit regardless. */
+pbo_error pbo_set_checksums(pbo_t d, int enable);
 
 pbo_error pbo_read_header(pbo_t d);
 pbo_error pbo_write(pbo_t d);
+pbo_error pbo_verify(pbo_t d);
+pbo_error pbo_verify_many(const char **filenames, size_t count, pbo_error *results, int threads);
+/* Entry counts, sizes, prefix and stored hash of archives straight from
+ * their headers, without a pbo_t. The many version runs on a pool. */
+pbo_error pbo_stat_file(const char *path, pbo_stat *st);
+pbo_error pbo_stat_many(const char **paths, size_t count, pbo_stat *stats, int threads);
+/* A sidecar with a name table sorted by hash, written once after packing,
+ * lets readers find entries by probing the mapped file without reading
+ * the header. The archive isn't changed. Names found stay valid until
+ * the lookup is closed. */
+pbo_error pbo_write_lookup(pbo_t d, const char *path);
+pbo_lookup_t pbo_lookup_open(const char *path, const char *archive);
+size_t pbo_lookup_count(pbo_lookup_t l);
+pbo_error pbo_lookup_find(pbo_lookup_t l, const char *name, pbo_file_info *info);
+void pbo_lookup_close(pbo_lookup_t l);
+
+/* Serves entries of archives added under a name as /<name>/<entry path>
+ * over HTTP/1.1, GET and HEAD with single byte ranges. Stored entries go
+ * from the archive to fd with sendfile, packed ones are decoded first.
+ * Accepting, threads and timeouts are the caller's, SIGPIPE should be
+ * ignored and TCP_NODELAY set, heads and bodies go out in separate writes.
+ * Archives are added before serving and stay the caller's. src/httpload
+ * measures it. */
+pbo_http_t pbo_http_init(void);
+pbo_error pbo_http_add(pbo_http_t s, const char *name, pbo_t d);
+pbo_error pbo_http_serve(pbo_http_t s, int fd);
+void pbo_http_dispose(pbo_http_t s);
 
 size_t pbo_read_file(pbo_t d, const char *filename, void *buf, size_t size);
 
 const char *pbo_read_extension(pbo_t d, int ind);
 int pbo_get_extension_count(pbo_t d);
+/* Extensions as key/value pairs, looked up in constant time. Setting an
+ * existing key replaces its value, the bulk setter replaces them all. */
+const char *pbo_get_extension(pbo_t d, const char *key);
+pbo_error pbo_set_extension(pbo_t d, const char *key, const char *value);
+pbo_error pbo_set_extensions(pbo_t d, const char **pairs, size_t count);
 
 pbo_error pbo_init_new(pbo_t d);
 pbo_error pbo_add_extension(pbo_t d, const char *e);
 pbo_error pbo_add_file_d(pbo_t d, const char *name, void *data,  size_t size);
 pbo_error pbo_add_file_f(pbo_t d, const char *name, FILE *file);
+
+/* Without copying: _own hands data over, cb(data, user) releases it, or
+ * free() if cb is NULL, right away if adding fails. _borrow uses data in place, it has to stay valid
+ * and unchanged until pbo_write or pbo_commit returns. */
+pbo_error pbo_add_file_own(pbo_t d, const char *name, void *data, size_t size, pbo_freecb cb, void *user);
+pbo_error pbo_add_file_borrow(pbo_t d, const char *name, const void *data, size_t size);
 pbo_error pbo_add_file_p(pbo_t d, const char *name, const char *path);
+pbo_error pbo_add_directory(pbo_t d, const char *root, const pbo_dir_options *opts);
+/* Packs many directories into as many archives at once, largest first,
+ * with file data held at once kept within the budget. Archives bigger
+ * than the budget run alone. setup can set timestamps, a batch, etc. */
+pbo_error pbo_pack_many(pbo_pack_spec *specs, size_t count, const pbo_pack_options *opts);
+
+/* Names given to pbo_remove_file, or added over an existing file, are
+ * matched as lookups match them, ignoring case with / and \ alike.
+ * pbo_commit rewrites the archive in place and isn't crash safe: an I/O
+ * error or crash part way through leaves the file damaged, with d still
+ * in its edit session. Where that matters build the archive with
+ * pbo_write, which only replaces the file once it's complete. */
+pbo_error pbo_edit(pbo_t d);
+pbo_error pbo_remove_file(pbo_t d, const char *filename);
+pbo_error pbo_commit(pbo_t d);
+
+/* Writes all files below dir, \ in names becoming /. Directories are made
+ * in one pass up front and the archive read through once. opts may be
+ * NULL. Archives with names like ..\x extract nothing. */
+pbo_error pbo_extract(pbo_t d, const char *dir, const pbo_extract_options *opts);
 
 pbo_error pbo_get_file_list(pbo_t d, pbo_listcb cb, void *user);
+pbo_error pbo_iter_begin(pbo_t d, pbo_iterator *it);
+const pbo_file_info *pbo_iter_next(pbo_iterator *it);
+
+/* Names are matched ignoring case, with / and \ treated alike. Directory
+ * listings yield subdirectories once, as a name ending in \ with no data.
+ * In globs * matches any run of characters, separators included. */
+pbo_error pbo_query_prefix(pbo_t d, const char *prefix, pbo_query *q);
+pbo_error pbo_query_dir(pbo_t d, const char *dir, pbo_query *q);
+pbo_error pbo_query_glob(pbo_t d, const char *pattern, pbo_query *q);
+const pbo_file_info *pbo_query_next(pbo_query *q);
+/* The buffer size pbo_read_file needs for filename, 0 if there is none.
+ * Packed entries are decoded on read, so that's their decoded size; this
+ * used to be the stored size, which is pbo_file_info's size. */
 size_t pbo_get_file_size(pbo_t d, const char *filename);
 
+pbo_error pbo_diff(pbo_t old, pbo_t cur, const char *patchfile);
+pbo_error pbo_patch(pbo_t old, const char *patchfile, const char *outfile);
+
+pbo_error pbo_merge(const char *outfile, pbo_t *inputs, size_t count);
+pbo_error pbo_split(pbo_t d, const char *outbase, size_t maxsize, unsigned int *parts);
+
+/* Checksums are checked as for pbo_read_file. Stored entries are streamed,
+ * so a mismatch is BROKEN only after their bytes went to file. */
 pbo_error pbo_write_to_file(pbo_t d, const char *filename, FILE *file);
 void pbo_dump_header(pbo_t d);
 
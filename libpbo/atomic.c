@@ -0,0 +1,348 @@
+/* atomic.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#define _GNU_SOURCE 1 //syncfs
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "pbo-private.h"
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+struct batch_item {
+    char *tmp;
+    char *path;
+};
+
+/* Archives written but not yet in place. Their data is synced together,
+ * one syncfs per filesystem where there is one, then they are renamed
+ * and each directory synced once. */
+struct pbo_batch {
+    struct batch_item *items;
+    size_t len;
+    size_t cap;
+    unsigned int refs; //The creator and every archive using it
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock;
+#endif
+};
+
+static void pbo_batch_lock(pbo_batch_t b)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&b->lock);
+#else
+    (void)b;
+#endif
+}
+
+static void pbo_batch_unlock(pbo_batch_t b)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&b->lock);
+#else
+    (void)b;
+#endif
+}
+
+//Length of the directory part of path, separator included
+static size_t pbo_atomic_dirlen(const char *path)
+{
+    size_t n = strlen(path);
+    while(n && path[n - 1] != '/' && path[n - 1] != '\\')
+        n--;
+    return n;
+}
+
+//Read only opens do for directories and files made read only alike
+static int pbo_atomic_fsync(const char *path)
+{
+#ifdef HAVE_UNISTD_H
+    int fd = open(path, O_RDONLY | O_BINARY);
+    if(fd < 0)
+        return -1;
+    int err = fsync(fd);
+    close(fd);
+    return err;
+#else
+    (void)path;
+    return 0;
+#endif
+}
+
+//Makes a rename in the directory of path durable
+static int pbo_atomic_syncdir(const char *path, size_t dirlen)
+{
+#ifdef HAVE_UNISTD_H
+    char *dir = malloc(dirlen + 2);
+    if(!dir)
+        return -1;
+    if(dirlen)
+        memcpy(dir, path, dirlen);
+    else
+        dir[dirlen++] = '.';
+    dir[dirlen] = '\0';
+    int err = pbo_atomic_fsync(dir);
+    free(dir);
+    return err;
+#else
+    (void)path, (void)dirlen;
+    return 0;
+#endif
+}
+
+static int pbo_atomic_rename(const char *tmp, const char *path)
+{
+#ifdef _WIN32
+    remove(path); //Won't rename over an existing file
+#endif
+    return rename(tmp, path);
+}
+
+/* Creates an empty file next to path to write it to, with the mode of the
+ * file it replaces. The name returned is the caller's to hand to
+ * pbo_atomic_finish or pbo_atomic_abort. */
+char *pbo_atomic_temp(const char *path)
+{
+    size_t len = strlen(path);
+    char *tmp = malloc(len + 8);
+    if(!tmp)
+        return NULL;
+    memcpy(tmp, path, len);
+
+#if defined(HAVE_MKSTEMP) && defined(HAVE_UNISTD_H)
+    memcpy(tmp + len, ".XXXXXX", 8);
+    int fd = mkstemp(tmp);
+    if(fd < 0) {
+        free(tmp);
+        return NULL;
+    }
+    struct stat st;
+    fchmod(fd, stat(path, &st) ? 0644 : st.st_mode & 07777);
+    close(fd);
+#else
+    memcpy(tmp + len, ".tmp", 5);
+    FILE *file = fopen(tmp, "wb");
+    if(!file) {
+        free(tmp);
+        return NULL;
+    }
+    fclose(file);
+#endif
+    return tmp;
+}
+
+void pbo_atomic_abort(char *tmp)
+{
+    remove(tmp);
+    free(tmp);
+}
+
+/* Puts the complete file tmp in place of path. Without a batch it's synced,
+ * renamed and its directory synced right away, with one that is left to
+ * pbo_batch_commit. Takes tmp either way. */
+pbo_error pbo_atomic_finish(char *tmp, const char *path, pbo_batch_t b)
+{
+    if(b) {
+        char *p = malloc(strlen(path) + 1);
+        if(!p) {
+            pbo_atomic_abort(tmp);
+            return PBO_ERROR_MALLOC;
+        }
+        strcpy(p, path);
+
+        pbo_batch_lock(b);
+        if(b->len == b->cap) {
+            size_t cap = b->cap ? b->cap * 2 : 16;
+            struct batch_item *items = realloc(b->items, cap * sizeof *items);
+            if(!items) {
+                pbo_batch_unlock(b);
+                free(p);
+                pbo_atomic_abort(tmp);
+                return PBO_ERROR_MALLOC;
+            }
+            b->items = items;
+            b->cap = cap;
+        }
+        b->items[b->len].tmp = tmp;
+        b->items[b->len++].path = p;
+        pbo_batch_unlock(b);
+        return PBO_SUCCESS;
+    }
+
+    if(pbo_atomic_fsync(tmp) || pbo_atomic_rename(tmp, path)) {
+        pbo_atomic_abort(tmp);
+        return PBO_ERROR_IO;
+    }
+    free(tmp);
+    return pbo_atomic_syncdir(path, pbo_atomic_dirlen(path)) ? PBO_ERROR_IO : PBO_SUCCESS;
+}
+
+pbo_batch_t pbo_batch_init(void)
+{
+    struct pbo_batch *b = malloc(sizeof *b);
+    if(!b)
+        return NULL;
+#ifdef HAVE_PTHREAD_H
+    if(pthread_mutex_init(&b->lock, NULL)) {
+        free(b);
+        return NULL;
+    }
+#endif
+    b->items = NULL;
+    b->len = 0;
+    b->cap = 0;
+    b->refs = 1;
+    return b;
+}
+
+//Syncs the data of all items, once per filesystem if it can
+static int pbo_batch_sync(const struct batch_item *items, size_t n)
+{
+    int err = 0;
+#if defined(HAVE_SYNCFS) && defined(HAVE_UNISTD_H)
+    dev_t *devs = malloc(n * sizeof *devs);
+    if(devs) {
+        size_t ndevs = 0;
+        for(size_t i = 0; i < n; i++) {
+            struct stat st;
+            int fd = open(items[i].tmp, O_RDONLY | O_BINARY);
+            if(fd < 0 || fstat(fd, &st)) {
+                err = -1;
+            } else {
+                size_t j = 0;
+                while(j < ndevs && devs[j] != st.st_dev)
+                    j++;
+                if(j == ndevs) {
+                    devs[ndevs++] = st.st_dev;
+                    err |= syncfs(fd);
+                }
+            }
+            if(fd >= 0)
+                close(fd);
+        }
+        free(devs);
+        return err;
+    }
+#endif
+    for(size_t i = 0; i < n; i++)
+        err |= pbo_atomic_fsync(items[i].tmp);
+    return err;
+}
+
+/* Puts every archive written with b since the last call in place. If their
+ * data couldn't be synced none are, otherwise only failed renames are
+ * missing. */
+pbo_error pbo_batch_commit(pbo_batch_t b)
+{
+    if(!b)
+        return PBO_ERROR_NEXIST;
+
+    //Take the list, archives written meanwhile go into the next commit
+    pbo_batch_lock(b);
+    struct batch_item *items = b->items;
+    size_t n = b->len;
+    b->items = NULL;
+    b->len = b->cap = 0;
+    pbo_batch_unlock(b);
+
+    if(!n)
+        return PBO_SUCCESS;
+
+    //Nothing may be renamed before its data is on disk
+    int err = pbo_batch_sync(items, n), synced = !err;
+    for(size_t i = 0; i < n; i++) {
+        if(!synced || pbo_atomic_rename(items[i].tmp, items[i].path)) {
+            remove(items[i].tmp);
+            err = -1;
+            free(items[i].path);
+            items[i].path = NULL;
+        }
+        free(items[i].tmp);
+    }
+
+    //Each directory once, the renames into it go together
+    for(size_t i = 0; i < n; i++) {
+        if(!items[i].path)
+            continue;
+        const char *path = items[i].path;
+        size_t dl = pbo_atomic_dirlen(path);
+        err |= pbo_atomic_syncdir(path, dl);
+        for(size_t j = i + 1; j < n; j++) {
+            if(items[j].path && pbo_atomic_dirlen(items[j].path) == dl && !memcmp(items[j].path, path, dl)) {
+                free(items[j].path);
+                items[j].path = NULL;
+            }
+        }
+        free(items[i].path);
+    }
+    free(items);
+    return err ? PBO_ERROR_IO : PBO_SUCCESS;
+}
+
+static void pbo_batch_unref(pbo_batch_t b)
+{
+    pbo_batch_lock(b);
+    int last = --b->refs == 0;
+    pbo_batch_unlock(b);
+    if(!last)
+        return;
+
+    //Never committed, the targets stay as they were
+    for(size_t i = 0; i < b->len; i++) {
+        pbo_atomic_abort(b->items[i].tmp);
+        free(b->items[i].path);
+    }
+    free(b->items);
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy(&b->lock);
+#endif
+    free(b);
+}
+
+void pbo_batch_dispose(pbo_batch_t b)
+{
+    if(b)
+        pbo_batch_unref(b);
+}
+
+pbo_error pbo_set_batch(pbo_t d, pbo_batch_t b)
+{
+    if(!d)
+        return PBO_ERROR_NEXIST;
+    if(b == d->batch)
+        return PBO_SUCCESS;
+
+    if(d->batch)
+        pbo_batch_unref(d->batch);
+
+    d->batch = b;
+    if(b) {
+        pbo_batch_lock(b);
+        b->refs++;
+        pbo_batch_unlock(b);
+    }
+    return PBO_SUCCESS;
+}
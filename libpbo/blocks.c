@@ -0,0 +1,474 @@
+/* blocks.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pbo-private.h"
+#include "pool.h"
+
+/* PBO_PACKING_BLOCKS entries cut the data into blocks of the same decoded
+ * size, the last one shorter, each an LZSS stream of its own:
+ *
+ *   uint32 block size, uint32 count, count * uint32 stored sizes, blocks
+ *
+ * all little endian. A set top bit in a stored size marks a block kept as
+ * it was because LZSS didn't make it smaller, so no block is stored bigger
+ * than the block size. The game can't load these. */
+
+#define BLOCKS_RAW 0x80000000u
+#define BLOCKS_MAXSIZE (1u << 30)
+#define BLOCKS_DEFAULT_MIN (1u << 20)
+#define BLOCKS_DEFAULT_SIZE (1u << 18)
+#define BLOCKS_WAVE (64u << 20) //Decoded bytes compressed at once when packing
+#define BLOCKS_PARALLEL (1u << 20) //Smaller entries decode on the calling thread
+
+static uint32_t pbo_blocks_u32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void pbo_blocks_put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8 & 0xFF;
+    p[2] = v >> 16 & 0xFF;
+    p[3] = v >> 24;
+}
+
+int pbo_entry_packed(const struct pbo_entry *pe)
+{
+    uint32_t m = pe->properties[PACKING_METHOD];
+    return m == PBO_PACKING_COMPRESSED || m == PBO_PACKING_BLOCKS;
+}
+
+/* Checks the count and the stored sizes read from a table against an entry
+ * of orig decoded and len stored bytes. */
+static int pbo_blocks_check(uint32_t bsize, uint32_t count, const unsigned char *sizes, size_t orig, size_t len)
+{
+    if(!bsize || bsize > BLOCKS_MAXSIZE || count != (orig + bsize - 1) / bsize)
+        return -1;
+    if((len - 8) / 4 < count)
+        return -1;
+
+    uint64_t total = 8 + 4 * (uint64_t)count;
+    for(uint32_t i = 0; i < count; i++) {
+        uint32_t s = pbo_blocks_u32(sizes + 4 * i);
+        size_t plain = i + 1 < count ? bsize : orig - (size_t)i * bsize;
+        uint32_t stored = s & ~BLOCKS_RAW;
+        if((s & BLOCKS_RAW) ? stored != plain : stored >= plain)
+            return -1;
+        total += stored;
+    }
+    return total == len ? 0 : -1;
+}
+
+struct block_job {
+    const unsigned char *src;
+    size_t srclen;
+    unsigned char *dst;
+    size_t dstlen;
+    uint32_t stored; //Packing: size with BLOCKS_RAW, decoding: 0 if it went fine
+};
+
+static void pbo_blocks_decode_worker(size_t i, void *user)
+{
+    struct block_job *j = (struct block_job *)user + i;
+    if(j->stored & BLOCKS_RAW) {
+        memcpy(j->dst, j->src, j->dstlen);
+        j->stored = 0;
+    } else
+        j->stored = pbo_lzss_decode(j->src, j->srclen, j->dst, j->dstlen) ? 1 : 0;
+}
+
+//Decodes the stored bytes of a block packed entry, big ones on a pool
+static int pbo_blocks_decode(const unsigned char *src, size_t srclen, unsigned char *dst, size_t dstlen)
+{
+    if(srclen < 8)
+        return -1;
+    uint32_t bsize = pbo_blocks_u32(src), count = pbo_blocks_u32(src + 4);
+    if(pbo_blocks_check(bsize, count, src + 8, dstlen, srclen))
+        return -1;
+    if(!count)
+        return 0;
+
+    struct block_job *jobs = malloc(count * sizeof *jobs);
+    if(!jobs)
+        return -1;
+    const unsigned char *p = src + 8 + 4 * (size_t)count;
+    for(uint32_t i = 0; i < count; i++) {
+        jobs[i].stored = pbo_blocks_u32(src + 8 + 4 * i);
+        jobs[i].src = p;
+        jobs[i].srclen = jobs[i].stored & ~BLOCKS_RAW;
+        jobs[i].dst = dst + (size_t)i * bsize;
+        jobs[i].dstlen = i + 1 < count ? bsize : dstlen - (size_t)i * bsize;
+        p += jobs[i].srclen;
+    }
+
+    pbo_pool_run(count, dstlen < BLOCKS_PARALLEL ? 1 : 0, pbo_blocks_decode_worker, jobs);
+    int err = 0;
+    for(uint32_t i = 0; i < count; i++)
+        err |= jobs[i].stored != 0;
+    free(jobs);
+    return err ? -1 : 0;
+}
+
+/* Decodes the srclen stored bytes of a packed entry into its
+ * pbo_entry_size bytes at dst, whichever the method. */
+int pbo_entry_decode(const struct pbo_entry *pe, const unsigned char *src, size_t srclen, unsigned char *dst)
+{
+    size_t dstlen = pe->properties[ORIGINAL_SIZE];
+    if(pe->properties[PACKING_METHOD] == PBO_PACKING_BLOCKS)
+        return pbo_blocks_decode(src, srclen, dst, dstlen);
+    return pbo_lzss_decode(src, srclen, dst, dstlen);
+}
+
+/* Reads the table of the block packed pe at off in io, for pieces of it to
+ * be decoded without the rest. */
+pbo_error pbo_blocks_open(struct blocks_reader *r, const pbo_io *io, uint64_t off, const struct pbo_entry *pe)
+{
+    unsigned char head[8];
+    size_t len = pe->properties[DATA_SIZE];
+    r->sizes = NULL;
+    r->offs = NULL;
+    r->buf = NULL;
+    if(len < 8 || io->ops->read_at(io->handle, head, 8, off) != 8)
+        return PBO_ERROR_BROKEN;
+
+    r->io = io;
+    r->orig = pe->properties[ORIGINAL_SIZE];
+    r->bsize = pbo_blocks_u32(head);
+    r->count = pbo_blocks_u32(head + 4);
+    if(!r->bsize || r->bsize > BLOCKS_MAXSIZE || r->count != (r->orig + r->bsize - 1) / r->bsize ||
+       (len - 8) / 4 < r->count)
+        return PBO_ERROR_BROKEN;
+
+    r->sizes = malloc(4 * (size_t)r->count + 1);
+    r->offs = malloc(((size_t)r->count + 1) * sizeof *r->offs);
+    r->buf = malloc(2 * (size_t)r->bsize);
+    if(!r->sizes || !r->offs || !r->buf) {
+        pbo_blocks_close(r);
+        return PBO_ERROR_MALLOC;
+    }
+    if(io->ops->read_at(io->handle, r->sizes, 4 * (size_t)r->count, off + 8) != 4 * (size_t)r->count ||
+       pbo_blocks_check(r->bsize, r->count, r->sizes, r->orig, len)) {
+        pbo_blocks_close(r);
+        return PBO_ERROR_BROKEN;
+    }
+
+    //Where pbo_blocks_verify carries on from
+    r->crc = pbo_crc32c(pbo_crc32c(0, head, 8), r->sizes, 4 * (size_t)r->count);
+    r->offs[0] = off + 8 + 4 * (uint64_t)r->count;
+    for(uint32_t i = 0; i < r->count; i++)
+        r->offs[i + 1] = r->offs[i] + (pbo_blocks_u32(r->sizes + 4 * i) & ~BLOCKS_RAW);
+    return PBO_SUCCESS;
+}
+
+/* Decodes len bytes from first on into dst, reading only the blocks they
+ * are in. */
+pbo_error pbo_blocks_get(struct blocks_reader *r, uint64_t first, size_t len, unsigned char *dst)
+{
+    if(first > r->orig || len > r->orig - first)
+        return PBO_ERROR_NEXIST;
+
+    while(len) {
+        uint32_t i = first / r->bsize;
+        size_t at = first - (uint64_t)i * r->bsize;
+        size_t plain = i + 1 < r->count ? r->bsize : r->orig - (size_t)i * r->bsize;
+        size_t n = plain - at < len ? plain - at : len;
+        uint32_t s = pbo_blocks_u32(r->sizes + 4 * i);
+        size_t stored = r->offs[i + 1] - r->offs[i];
+
+        //Whole blocks decode straight into dst
+        unsigned char *packed = r->buf, *out = n == plain ? dst : r->buf + r->bsize;
+        if(r->io->ops->read_at(r->io->handle, packed, stored, r->offs[i]) != stored)
+            return PBO_ERROR_IO;
+        if(s & BLOCKS_RAW)
+            memcpy(out, packed, plain);
+        else if(pbo_lzss_decode(packed, stored, out, plain))
+            return PBO_ERROR_BROKEN;
+        if(out != dst)
+            memcpy(dst, out + at, n);
+
+        dst += n;
+        first += n;
+        len -= n;
+    }
+    return PBO_SUCCESS;
+}
+
+/* Checks pe's checksum over all its stored bytes before anything is
+ * decoded, for callers that can't take back what they emitted. */
+pbo_error pbo_blocks_verify(struct blocks_reader *r, const struct pbo_entry *pe)
+{
+    if(!pe->has_crc)
+        return PBO_SUCCESS;
+
+    uint32_t crc = r->crc;
+    size_t bufsz = 2 * (size_t)r->bsize;
+    for(uint64_t off = r->offs[0]; off < r->offs[r->count];) {
+        size_t n = r->offs[r->count] - off < bufsz ? r->offs[r->count] - off : bufsz;
+        if(r->io->ops->read_at(r->io->handle, r->buf, n, off) != n)
+            return PBO_ERROR_IO;
+        crc = pbo_crc32c(crc, r->buf, n);
+        off += n;
+    }
+    return crc == pe->crc ? PBO_SUCCESS : PBO_ERROR_BROKEN;
+}
+
+void pbo_blocks_close(struct blocks_reader *r)
+{
+    free(r->sizes);
+    free(r->offs);
+    free(r->buf);
+    r->sizes = NULL;
+    r->offs = NULL;
+    r->buf = NULL;
+}
+
+static void pbo_blocks_pack_worker(size_t i, void *user)
+{
+    struct block_job *j = (struct block_job *)user + i;
+    size_t n = pbo_lzss_encode(j->src, j->srclen, j->dst, j->srclen - 1);
+    j->stored = n ? (uint32_t)n : (uint32_t)j->srclen | BLOCKS_RAW;
+}
+
+static int pbo_blocks_eligible(pbo_t d, const struct pbo_entry *pe)
+{
+    return *pe->name && pe->data && pe->properties[PACKING_METHOD] == 0 &&
+           pe->properties[DATA_SIZE] >= d->block_opts.min_size && pe->properties[DATA_SIZE];
+}
+
+static void pbo_blocks_adopt(struct pbo_entry *pe, unsigned char *buf, uint64_t total);
+
+//Swaps the data of pe for the blocks made of it, unless that's no smaller
+static pbo_error pbo_blocks_replace(struct pbo_entry *pe, const struct block_job *jobs, uint32_t count,
+                                    size_t bsize)
+{
+    uint64_t total = 8 + 4 * (uint64_t)count;
+    for(uint32_t i = 0; i < count; i++)
+        total += jobs[i].stored & ~BLOCKS_RAW;
+    if(total >= pe->properties[DATA_SIZE])
+        return PBO_SUCCESS;
+
+    unsigned char *buf = malloc(total), *p = buf + 8 + 4 * (size_t)count;
+    if(!buf)
+        return PBO_ERROR_MALLOC;
+    pbo_blocks_put32(buf, bsize);
+    pbo_blocks_put32(buf + 4, count);
+    for(uint32_t i = 0; i < count; i++) {
+        size_t s = jobs[i].stored & ~BLOCKS_RAW;
+        pbo_blocks_put32(buf + 8 + 4 * i, jobs[i].stored);
+        memcpy(p, jobs[i].stored & BLOCKS_RAW ? jobs[i].src : jobs[i].dst, s);
+        p += s;
+    }
+
+    pbo_blocks_adopt(pe, buf, total);
+    return PBO_SUCCESS;
+}
+
+//Makes the total bytes of blocks at buf the data of pe
+static void pbo_blocks_adopt(struct pbo_entry *pe, unsigned char *buf, uint64_t total)
+{
+    uint32_t orig = pe->properties[DATA_SIZE];
+    pbo_release_data(pe);
+    pe->data = buf;
+    pe->properties[PACKING_METHOD] = PBO_PACKING_BLOCKS;
+    pe->properties[ORIGINAL_SIZE] = orig;
+    pe->properties[DATA_SIZE] = total;
+    pe->has_crc = 0;
+}
+
+/* Entries bigger than a wave are packed a wave of their blocks at a time,
+ * each appended to the result as it's done, so only the result grows
+ * with the entry and no copy of it is made. */
+static pbo_error pbo_blocks_pack_big(pbo_t d, struct pbo_entry *pe)
+{
+    size_t bsize = d->block_opts.block_size, sz = pe->properties[DATA_SIZE];
+    uint32_t count = (sz + bsize - 1) / bsize;
+    size_t per = BLOCKS_WAVE / bsize ? BLOCKS_WAVE / bsize : 1;
+    size_t head = 8 + 4 * (size_t)count, cap = head + sz / 4, total = head;
+
+    struct block_job *jobs = malloc(per * sizeof *jobs);
+    unsigned char *out = malloc(per * bsize), *buf = malloc(cap);
+    pbo_error ret = PBO_ERROR_MALLOC;
+    if(!jobs || !out || !buf)
+        goto cleanup;
+    pbo_blocks_put32(buf, bsize);
+    pbo_blocks_put32(buf + 4, count);
+
+    ret = PBO_SUCCESS;
+    for(uint32_t first = 0; first < count && total < sz && !ret; first += per) {
+        size_t n = count - first < per ? count - first : per;
+        for(size_t k = 0; k < n; k++) {
+            size_t at = (first + k) * bsize;
+            jobs[k].src = pe->data + at;
+            jobs[k].srclen = sz - at < bsize ? sz - at : bsize;
+            jobs[k].dst = out + k * bsize;
+        }
+        pbo_pool_run(n, d->block_opts.threads, pbo_blocks_pack_worker, jobs);
+
+        for(size_t k = 0; k < n; k++) {
+            size_t stored = jobs[k].stored & ~BLOCKS_RAW;
+            if(total + stored >= sz) {
+                total = sz; //No smaller than the entry, stays as it is
+                break;
+            }
+            if(total + stored > cap) {
+                size_t want = cap * 2 > total + stored ? cap * 2 : total + stored;
+                unsigned char *grown = realloc(buf, want < sz ? want : sz);
+                if(!grown) {
+                    ret = PBO_ERROR_MALLOC;
+                    break;
+                }
+                buf = grown;
+                cap = want < sz ? want : sz;
+            }
+            pbo_blocks_put32(buf + 8 + 4 * (first + k), jobs[k].stored);
+            memcpy(buf + total, jobs[k].stored & BLOCKS_RAW ? jobs[k].src : jobs[k].dst, stored);
+            total += stored;
+        }
+    }
+
+    //Unless that's no smaller, as with waves
+    if(!ret && total < sz) {
+        unsigned char *fit = realloc(buf, total);
+        pbo_blocks_adopt(pe, fit ? fit : buf, total);
+        buf = NULL;
+    }
+
+cleanup:
+    free(jobs);
+    free(out);
+    free(buf);
+    return ret;
+}
+
+//Entries that fit in a wave share it with others
+static int pbo_blocks_small(pbo_t d, const struct pbo_entry *pe)
+{
+    return pbo_blocks_eligible(d, pe) && pe->properties[DATA_SIZE] <= BLOCKS_WAVE;
+}
+
+/* Block packs every eligible entry of d as it's written. Small ones go a
+ * wave at a time with the blocks of all of them on the pool together, big
+ * ones a wave of their blocks at a time, so what is compressed at once
+ * stays within BLOCKS_WAVE. */
+pbo_error pbo_blocks_pack(pbo_t d)
+{
+    if(!d->block_packing)
+        return PBO_SUCCESS;
+
+    for(struct list_entry *e = d->root; e; e = e->next) {
+        if(!pbo_blocks_eligible(d, e->data) || pbo_blocks_small(d, e->data))
+            continue;
+        pbo_error ret = pbo_blocks_pack_big(d, e->data);
+        if(ret)
+            return ret;
+    }
+
+    size_t bsize = d->block_opts.block_size;
+    struct list_entry *e = d->root;
+    while(e) {
+        //Gather a wave
+        struct list_entry *start = e;
+        size_t count = 0, bytes = 0;
+        for(; e; e = e->next) {
+            if(!pbo_blocks_small(d, e->data))
+                continue;
+            size_t sz = e->data->properties[DATA_SIZE];
+            if(bytes && bytes + sz > BLOCKS_WAVE)
+                break;
+            count += (sz + bsize - 1) / bsize;
+            bytes += sz;
+        }
+        if(!count)
+            break;
+
+        struct block_job *jobs = malloc(count * sizeof *jobs);
+        unsigned char *out = malloc(bytes);
+        if(!jobs || !out) {
+            free(jobs);
+            free(out);
+            return PBO_ERROR_MALLOC;
+        }
+
+        size_t k = 0, o = 0;
+        for(struct list_entry *w = start; w != e; w = w->next) {
+            if(!pbo_blocks_small(d, w->data))
+                continue;
+            size_t sz = w->data->properties[DATA_SIZE];
+            for(size_t at = 0; at < sz; at += bsize, k++) {
+                jobs[k].src = w->data->data + at;
+                jobs[k].srclen = sz - at < bsize ? sz - at : bsize;
+                jobs[k].dst = out + o;
+                o += jobs[k].srclen;
+            }
+        }
+        pbo_pool_run(count, d->block_opts.threads, pbo_blocks_pack_worker, jobs);
+
+        pbo_error ret = PBO_SUCCESS;
+        k = 0;
+        for(struct list_entry *w = start; w != e && !ret; w = w->next) {
+            if(!pbo_blocks_small(d, w->data))
+                continue;
+            size_t sz = w->data->properties[DATA_SIZE];
+            uint32_t n = (sz + bsize - 1) / bsize;
+            ret = pbo_blocks_replace(w->data, jobs + k, n, bsize);
+            k += n;
+        }
+        free(jobs);
+        free(out);
+        if(ret)
+            return ret;
+    }
+    return PBO_SUCCESS;
+}
+
+/* Refuses writing what the game couldn't load, when asked to. Existing
+ * entries count as well as ones about to be block packed. */
+pbo_error pbo_blocks_refuse(pbo_t d)
+{
+    if(!d->loadable)
+        return PBO_SUCCESS;
+    for(struct list_entry *e = d->root; e; e = e->next)
+        if(e->data->properties[PACKING_METHOD] == PBO_PACKING_BLOCKS ||
+           (d->block_packing && pbo_blocks_eligible(d, e->data)))
+            return PBO_ERROR_STATE;
+    return PBO_SUCCESS;
+}
+
+pbo_error pbo_set_block_packing(pbo_t d, const pbo_block_options *opts)
+{
+    if(!d)
+        return PBO_ERROR_NEXIST;
+    if(opts && opts->block_size > BLOCKS_MAXSIZE)
+        return PBO_ERROR_STATE;
+
+    d->block_packing = opts != NULL;
+    if(opts) {
+        d->block_opts = *opts;
+        if(!d->block_opts.min_size)
+            d->block_opts.min_size = BLOCKS_DEFAULT_MIN;
+        if(!d->block_opts.block_size)
+            d->block_opts.block_size = BLOCKS_DEFAULT_SIZE;
+    }
+    return PBO_SUCCESS;
+}
+
+pbo_error pbo_set_game_loadable(pbo_t d, int enable)
+{
+    if(!d)
+        return PBO_ERROR_NEXIST;
+
+    d->loadable = !!enable;
+    return PBO_SUCCESS;
+}
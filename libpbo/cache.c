@@ -0,0 +1,305 @@
+/* cache.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "pbo-private.h"
+
+#define CACHE_MINBUCKETS 64
+
+struct cache_entry {
+    pbo_t d;
+    const struct pbo_entry *pe;
+    size_t size;
+    struct cache_entry *chain; //Bucket
+    struct cache_entry *prev; //LRU, most recently used first
+    struct cache_entry *next;
+    unsigned char data[];
+};
+
+/* Decoded entries keyed by archive and entry. Entries are dropped as soon
+ * as their archive is cleared or edited, so keys are never stale. Copies
+ * in and out happen under the lock, which keeps hits simple and safe. */
+struct pbo_cache {
+    size_t budget;
+    size_t bytes;
+    size_t count;
+    size_t nbuckets;
+    struct cache_entry **buckets;
+    struct cache_entry *head;
+    struct cache_entry *tail;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    unsigned int refs; //The creator and every archive using it
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock;
+#endif
+};
+
+static void pbo_cache_lock(pbo_cache_t c)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&c->lock);
+#else
+    (void)c;
+#endif
+}
+
+static void pbo_cache_unlock(pbo_cache_t c)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&c->lock);
+#else
+    (void)c;
+#endif
+}
+
+static size_t pbo_cache_hash(const pbo_t d, const struct pbo_entry *pe, size_t nbuckets)
+{
+    uint64_t h = (uint64_t)(uintptr_t)d * 0x9E3779B97F4A7C15ULL ^ (uint64_t)(uintptr_t)pe;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return h & (nbuckets - 1);
+}
+
+static void pbo_cache_unlink(pbo_cache_t c, struct cache_entry *ce)
+{
+    if(ce->prev)
+        ce->prev->next = ce->next;
+    else
+        c->head = ce->next;
+    if(ce->next)
+        ce->next->prev = ce->prev;
+    else
+        c->tail = ce->prev;
+}
+
+static void pbo_cache_push(pbo_cache_t c, struct cache_entry *ce)
+{
+    ce->prev = NULL;
+    ce->next = c->head;
+    if(c->head)
+        c->head->prev = ce;
+    else
+        c->tail = ce;
+    c->head = ce;
+}
+
+static void pbo_cache_remove(pbo_cache_t c, struct cache_entry *ce)
+{
+    struct cache_entry **pp = &c->buckets[pbo_cache_hash(ce->d, ce->pe, c->nbuckets)];
+    while(*pp != ce)
+        pp = &(*pp)->chain;
+    *pp = ce->chain;
+
+    pbo_cache_unlink(c, ce);
+    c->bytes -= ce->size;
+    c->count--;
+    free(ce);
+}
+
+static struct cache_entry *pbo_cache_find(pbo_cache_t c, pbo_t d, const struct pbo_entry *pe)
+{
+    struct cache_entry *ce = c->buckets[pbo_cache_hash(d, pe, c->nbuckets)];
+    while(ce && (ce->d != d || ce->pe != pe))
+        ce = ce->chain;
+    return ce;
+}
+
+//Doubles the table once it gets crowded, failing to is harmless
+static void pbo_cache_grow(pbo_cache_t c)
+{
+    if(c->count < c->nbuckets)
+        return;
+
+    size_t n = c->nbuckets * 2;
+    struct cache_entry **b = calloc(n, sizeof *b);
+    if(!b)
+        return;
+
+    for(struct cache_entry *ce = c->head; ce; ce = ce->next) {
+        size_t i = pbo_cache_hash(ce->d, ce->pe, n);
+        ce->chain = b[i];
+        b[i] = ce;
+    }
+    free(c->buckets);
+    c->buckets = b;
+    c->nbuckets = n;
+}
+
+pbo_cache_t pbo_cache_init(size_t budget)
+{
+    struct pbo_cache *c = malloc(sizeof *c);
+    if(!c)
+        return NULL;
+
+    c->buckets = calloc(CACHE_MINBUCKETS, sizeof *c->buckets);
+    if(!c->buckets) {
+        free(c);
+        return NULL;
+    }
+#ifdef HAVE_PTHREAD_H
+    if(pthread_mutex_init(&c->lock, NULL)) {
+        free(c->buckets);
+        free(c);
+        return NULL;
+    }
+#endif
+
+    c->budget = budget;
+    c->bytes = 0;
+    c->count = 0;
+    c->nbuckets = CACHE_MINBUCKETS;
+    c->head = NULL;
+    c->tail = NULL;
+    c->hits = 0;
+    c->misses = 0;
+    c->evictions = 0;
+    c->refs = 1;
+    return c;
+}
+
+static void pbo_cache_unref(pbo_cache_t c)
+{
+    pbo_cache_lock(c);
+    int last = --c->refs == 0;
+    pbo_cache_unlock(c);
+    if(!last)
+        return;
+
+    while(c->head)
+        pbo_cache_remove(c, c->head);
+    free(c->buckets);
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy(&c->lock);
+#endif
+    free(c);
+}
+
+void pbo_cache_dispose(pbo_cache_t c)
+{
+    if(c)
+        pbo_cache_unref(c);
+}
+
+pbo_error pbo_cache_get_stats(pbo_cache_t c, pbo_cache_stats *stats)
+{
+    if(!c || !stats)
+        return PBO_ERROR_NEXIST;
+
+    pbo_cache_lock(c);
+    stats->hits = c->hits;
+    stats->misses = c->misses;
+    stats->evictions = c->evictions;
+    stats->entries = c->count;
+    stats->bytes = c->bytes;
+    stats->budget = c->budget;
+    pbo_cache_unlock(c);
+    return PBO_SUCCESS;
+}
+
+pbo_error pbo_set_cache(pbo_t d, pbo_cache_t c)
+{
+    if(!d)
+        return PBO_ERROR_NEXIST;
+    if(c == d->cache)
+        return PBO_SUCCESS;
+
+    pbo_cache_forget(d);
+    if(d->cache)
+        pbo_cache_unref(d->cache);
+
+    d->cache = c;
+    if(c) {
+        pbo_cache_lock(c);
+        c->refs++;
+        pbo_cache_unlock(c);
+    }
+    return PBO_SUCCESS;
+}
+
+//Drops everything cached for d, its entries are about to change
+void pbo_cache_forget(pbo_t d)
+{
+    pbo_cache_t c = d->cache;
+    if(!c)
+        return;
+
+    pbo_cache_lock(c);
+    for(struct cache_entry *ce = c->head, *next; ce; ce = next) {
+        next = ce->next;
+        if(ce->d == d)
+            pbo_cache_remove(c, ce);
+    }
+    pbo_cache_unlock(c);
+}
+
+//Copies a cached entry of d into dst, returns -1 on a miss
+int pbo_cache_get(pbo_t d, const struct pbo_entry *pe, void *dst)
+{
+    pbo_cache_t c = d->cache;
+    pbo_cache_lock(c);
+    struct cache_entry *ce = pbo_cache_find(c, d, pe);
+    if(ce) {
+        c->hits++;
+        if(c->head != ce) {
+            pbo_cache_unlink(c, ce);
+            pbo_cache_push(c, ce);
+        }
+        memcpy(dst, ce->data, ce->size);
+    } else
+        c->misses++;
+    pbo_cache_unlock(c);
+    return ce ? 0 : -1;
+}
+
+void pbo_cache_put(pbo_t d, const struct pbo_entry *pe, const void *src, size_t size)
+{
+    pbo_cache_t c = d->cache;
+    if(size > c->budget)
+        return; //Would only flush everything else
+
+    //Copy outside the lock, most of the work of a miss
+    struct cache_entry *ce = malloc(sizeof *ce + size);
+    if(!ce)
+        return;
+    ce->d = d;
+    ce->pe = pe;
+    ce->size = size;
+    memcpy(ce->data, src, size);
+
+    pbo_cache_lock(c);
+    if(pbo_cache_find(c, d, pe)) {
+        pbo_cache_unlock(c); //A concurrent reader was first
+        free(ce);
+        return;
+    }
+
+    while(c->tail && c->bytes + size > c->budget) {
+        pbo_cache_remove(c, c->tail);
+        c->evictions++;
+    }
+
+    pbo_cache_grow(c);
+    size_t i = pbo_cache_hash(d, pe, c->nbuckets);
+    ce->chain = c->buckets[i];
+    c->buckets[i] = ce;
+    pbo_cache_push(c, ce);
+    c->bytes += size;
+    c->count++;
+    pbo_cache_unlock(c);
+}
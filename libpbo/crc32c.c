@@ -0,0 +1,273 @@
+/* crc32c.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "pbo-private.h"
+
+#define CRC32C_POLY 0x82F63B78u //Castagnoli, reflected
+
+#if defined(__GNUC__) && defined(__x86_64__)
+# define CRC32C_HW 1
+# include <nmmintrin.h>
+#endif
+
+/* Slicing by 8: table[k][b] is the CRC of byte b followed by k zero bytes,
+ * so eight input bytes are folded in with eight lookups. */
+static uint32_t crc32c_table[8][256];
+
+static void pbo_crc32c_init(void)
+{
+    for(uint32_t b = 0; b < 256; b++) {
+        uint32_t c = b;
+        for(int i = 0; i < 8; i++)
+            c = c & 1 ? c >> 1 ^ CRC32C_POLY : c >> 1;
+        crc32c_table[0][b] = c;
+    }
+    for(uint32_t b = 0; b < 256; b++)
+        for(int k = 1; k < 8; k++)
+            crc32c_table[k][b] = crc32c_table[k - 1][b] >> 8 ^ crc32c_table[0][crc32c_table[k - 1][b] & 0xFF];
+}
+
+static uint32_t pbo_crc32c_sw(uint32_t crc, const unsigned char *p, size_t n)
+{
+    for(; n && ((uintptr_t)p & 7); n--)
+        crc = crc >> 8 ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+
+    for(; n >= 8; n -= 8, p += 8) {
+        uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][lo >> 8 & 0xFF] ^
+              crc32c_table[5][lo >> 16 & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][hi >> 8 & 0xFF] ^
+              crc32c_table[1][hi >> 16 & 0xFF] ^ crc32c_table[0][hi >> 24];
+    }
+
+    while(n--)
+        crc = crc >> 8 ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+    return crc;
+}
+
+#ifdef CRC32C_HW
+//The SSE4.2 instruction computes exactly this polynomial
+__attribute__((target("sse4.2")))
+static uint32_t pbo_crc32c_hw(uint32_t crc, const unsigned char *p, size_t n)
+{
+    for(; n && ((uintptr_t)p & 7); n--)
+        crc = _mm_crc32_u8(crc, *p++);
+
+    uint64_t c = crc;
+    for(; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    crc = (uint32_t)c;
+
+    while(n--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+static uint32_t (*crc32c_impl)(uint32_t, const unsigned char *, size_t);
+
+static void pbo_crc32c_pick(void)
+{
+#ifdef CRC32C_HW
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.2")) {
+        crc32c_impl = pbo_crc32c_hw;
+        return;
+    }
+#endif
+    pbo_crc32c_init();
+    crc32c_impl = pbo_crc32c_sw;
+}
+
+/* CRC32C of n bytes at p, continuing from crc, 0 to start. Uses the CPU's
+ * instruction where there is one. */
+uint32_t pbo_crc32c(uint32_t crc, const void *p, size_t n)
+{
+#ifdef HAVE_PTHREAD_H
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, pbo_crc32c_pick);
+#else
+    if(!crc32c_impl)
+        pbo_crc32c_pick();
+#endif
+    return ~crc32c_impl(~crc, p, n);
+}
+
+//Whether pe is a file rather than the extension or the terminator
+static int pbo_checksum_counts(const struct pbo_entry *pe)
+{
+    return *pe->name != '\0';
+}
+
+/* Picks up the table pbo_checksum_store left in the extension. Tables that
+ * don't match the entries are ignored, as if there were none. */
+void pbo_checksum_load(pbo_t d)
+{
+    char key[32];
+    size_t n = 0;
+    for(struct list_entry *e = d->root; e; e = e->next)
+        n += pbo_checksum_counts(e->data);
+
+    //Check it all before taking any of it
+    size_t chunks = (n + CHECKSUM_PER_KEY - 1) / CHECKSUM_PER_KEY;
+    for(size_t k = 0; k <= chunks; k++) {
+        sprintf(key, CHECKSUM_KEY "%zu", k);
+        const char *v = pbo_get_extension(d, key);
+        if(k == chunks) {
+            if(v)
+                return; //More than there are entries
+            break;
+        }
+        size_t want = n - k * CHECKSUM_PER_KEY;
+        if(want > CHECKSUM_PER_KEY)
+            want = CHECKSUM_PER_KEY;
+        if(!v || strlen(v) != want * 8 || strspn(v, "0123456789abcdef") != want * 8)
+            return;
+    }
+    if(!n)
+        return;
+
+    size_t i = 0;
+    const char *v = NULL;
+    for(struct list_entry *e = d->root; e; e = e->next) {
+        if(!pbo_checksum_counts(e->data))
+            continue;
+        if(i % CHECKSUM_PER_KEY == 0) {
+            sprintf(key, CHECKSUM_KEY "%zu", i / CHECKSUM_PER_KEY);
+            v = pbo_get_extension(d, key);
+        }
+        uint32_t c = 0;
+        for(int j = 0; j < 8; j++, v++)
+            c = c << 4 | (*v <= '9' ? *v - '0' : *v - 'a' + 10);
+        e->data->crc = c;
+        e->data->has_crc = 1;
+        i++;
+    }
+}
+
+//Checksums the stored data of an entry still in the file
+static pbo_error pbo_checksum_file(pbo_t d, struct pbo_entry *pe)
+{
+    pbo_io io;
+    if(pbo_io_begin(d, IO_READ, &io))
+        return PBO_ERROR_IO;
+
+    pbo_error ret = PBO_SUCCESS;
+    unsigned char *buf = malloc(IOBUFSZ);
+    uint64_t off = d->headersz + pe->file_offset;
+    uint32_t crc = 0;
+    if(!buf)
+        ret = PBO_ERROR_MALLOC;
+    for(size_t left = pe->properties[DATA_SIZE]; buf && left;) {
+        size_t c = left < IOBUFSZ ? left : IOBUFSZ;
+        if(io.ops->read_at(io.handle, buf, c, off) != c) {
+            ret = PBO_ERROR_IO;
+            break;
+        }
+        crc = pbo_crc32c(crc, buf, c);
+        off += c;
+        left -= c;
+    }
+    free(buf);
+    pbo_io_end(d, &io);
+
+    if(!ret) {
+        pe->crc = crc;
+        pe->has_crc = 1;
+    }
+    return ret;
+}
+
+/* Puts a checksum of every entry's stored bytes into the extension, as 8
+ * hex digits each in header order, CHECKSUM_PER_KEY to a key. Loaders
+ * skip keys they don't know. Done when asked for and for archives that
+ * had a table already, which would go stale otherwise. */
+pbo_error pbo_checksum_store(pbo_t d)
+{
+    if(!d->checksums && !pbo_get_extension(d, CHECKSUM_KEY "0"))
+        return PBO_SUCCESS;
+
+    size_t n = 0;
+    for(struct list_entry *e = d->root; e; e = e->next) {
+        struct pbo_entry *pe = e->data;
+        if(!pbo_checksum_counts(pe))
+            continue;
+        n++;
+        if(pe->data) {
+            pe->crc = pbo_crc32c(0, pe->data, pe->properties[DATA_SIZE]);
+            pe->has_crc = 1;
+        } else if(!pe->has_crc) {
+            pbo_error ret = pbo_checksum_file(d, pe);
+            if(ret)
+                return ret;
+        }
+    }
+
+    size_t chunks = (n + CHECKSUM_PER_KEY - 1) / CHECKSUM_PER_KEY;
+    const char **strs = malloc((2 * chunks + 1) * sizeof *strs);
+    char *keys = malloc(chunks * 32 + 1);
+    char *hex = malloc(n * 8 + chunks + 1);
+    pbo_error ret = PBO_ERROR_MALLOC;
+    if(!strs || !keys || !hex)
+        goto cleanup;
+
+    size_t i = 0;
+    char *h = hex;
+    for(struct list_entry *e = d->root; e; e = e->next) {
+        if(!pbo_checksum_counts(e->data))
+            continue;
+        if(i % CHECKSUM_PER_KEY == 0) {
+            size_t k = i / CHECKSUM_PER_KEY;
+            if(k)
+                *h++ = '\0';
+            sprintf(keys + 32 * k, CHECKSUM_KEY "%zu", k);
+            strs[2 * k] = keys + 32 * k;
+            strs[2 * k + 1] = h;
+        }
+        sprintf(h, "%08x", (unsigned int)e->data->crc);
+        h += 8;
+        i++;
+    }
+    *h = '\0';
+
+    //Have the extension entry made first if there isn't one
+    if(chunks && !pbo_get_extension(d, CHECKSUM_KEY "0") && (ret = pbo_set_extension(d, strs[0], strs[1])))
+        goto cleanup;
+    ret = PBO_SUCCESS;
+    if(d->root && *d->root->data->name == '\0')
+        ret = pbo_ext_replace_prefixed(d->root->data->ext, CHECKSUM_KEY, strs, 2 * chunks);
+
+cleanup:
+    free(strs);
+    free(keys);
+    free(hex);
+    return ret;
+}
+
+pbo_error pbo_set_checksums(pbo_t d, int enable)
+{
+    if(!d)
+        return PBO_ERROR_NEXIST;
+
+    d->checksums = !!enable;
+    return PBO_SUCCESS;
+}
@@ -0,0 +1,396 @@
+/* delta.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "sha.h"
+#include "pbo-private.h"
+
+/* Patch layout, integers little endian:
+ *   "PBOPATCH" u32 version
+ *   old trailing SHA1, new trailing SHA1
+ *   u32 header size, the new header
+ *   ops: 'C' u64 old offset, u64 length - copy from the old archive
+ *        'D' u64 length, bytes - literal data
+ *        'E' - end, the hash follows the data block
+ */
+#define PATCH_MAGIC "PBOPATCH"
+#define PATCH_VERSION 1
+#define PATCH_MINCOPY 64 //Shorter matches cost more as an op than as data
+
+enum {
+    OP_COPY = 'C',
+    OP_DATA = 'D',
+    OP_END = 'E',
+};
+
+struct patch_writer {
+    FILE *out;
+    const pbo_io *src; //The new archive, literal data comes from here
+    uint64_t copyoff;
+    uint64_t copylen; //Pending copy, merged with adjacent ones
+    int err;
+};
+
+static void pbo_patch_put_u32(FILE *f, uint32_t v)
+{
+    unsigned char b[4];
+    for(int i = 0; i < 4; i++)
+        b[i] = v >> (8 * i);
+    fwrite(b, 1, 4, f);
+}
+
+static void pbo_patch_put_u64(FILE *f, uint64_t v)
+{
+    unsigned char b[8];
+    for(int i = 0; i < 8; i++)
+        b[i] = v >> (8 * i);
+    fwrite(b, 1, 8, f);
+}
+
+static int pbo_patch_get_u32(FILE *f, uint32_t *v)
+{
+    unsigned char b[4];
+    if(fread(b, 1, 4, f) != 4)
+        return -1;
+    *v = 0;
+    for(int i = 0; i < 4; i++)
+        *v |= (uint32_t)b[i] << (8 * i);
+    return 0;
+}
+
+static int pbo_patch_get_u64(FILE *f, uint64_t *v)
+{
+    unsigned char b[8];
+    if(fread(b, 1, 8, f) != 8)
+        return -1;
+    *v = 0;
+    for(int i = 0; i < 8; i++)
+        *v |= (uint64_t)b[i] << (8 * i);
+    return 0;
+}
+
+static int pbo_patch_trailer(const pbo_io *io, uint8_t sha[SHA1HashSize])
+{
+    uint64_t sz;
+    if(io->ops->size(io->handle, &sz) || sz < SHA1HashSize)
+        return -1;
+    return io->ops->read_at(io->handle, sha, SHA1HashSize, sz - SHA1HashSize) == SHA1HashSize ? 0 : -1;
+}
+
+static void pbo_patch_flush(struct patch_writer *w)
+{
+    if(!w->copylen)
+        return;
+    fputc(OP_COPY, w->out);
+    pbo_patch_put_u64(w->out, w->copyoff);
+    pbo_patch_put_u64(w->out, w->copylen);
+    w->copylen = 0;
+}
+
+static void pbo_patch_copy(struct patch_writer *w, uint64_t off, uint64_t len)
+{
+    if(!len)
+        return;
+    if(w->copylen && w->copyoff + w->copylen == off) {
+        w->copylen += len;
+        return;
+    }
+    pbo_patch_flush(w);
+    w->copyoff = off;
+    w->copylen = len;
+}
+
+static void pbo_patch_data(struct patch_writer *w, uint64_t off, uint64_t len)
+{
+    if(!len)
+        return;
+    pbo_patch_flush(w);
+    fputc(OP_DATA, w->out);
+    pbo_patch_put_u64(w->out, len);
+
+    unsigned char buf[IOBUFSZ];
+    while(len) {
+        size_t n = len < sizeof buf ? len : sizeof buf;
+        if(w->src->ops->read_at(w->src->handle, buf, n, off) != n || fwrite(buf, 1, n, w->out) != n) {
+            w->err = 1;
+            return;
+        }
+        off += n;
+        len -= n;
+    }
+}
+
+//Length of the common run of a and b, from the front or from the back
+static size_t pbo_patch_common(const pbo_io *a, size_t aoff, const pbo_io *b, size_t boff, size_t len, int backwards)
+{
+    unsigned char x[IOBUFSZ / 2], y[IOBUFSZ / 2];
+    size_t same = 0;
+
+    while(same < len) {
+        size_t n = len - same < sizeof x ? len - same : sizeof x;
+        size_t pos = backwards ? len - same - n : same;
+
+        if(a->ops->read_at(a->handle, x, n, aoff + pos) != n ||
+           b->ops->read_at(b->handle, y, n, boff + pos) != n)
+            break;
+
+        size_t i = 0;
+        if(backwards)
+            while(i < n && x[n - 1 - i] == y[n - 1 - i])
+                i++;
+        else
+            while(i < n && x[i] == y[i])
+                i++;
+        same += i;
+        if(i < n)
+            break;
+    }
+    return same;
+}
+
+/* Entries found in the old archive under the same name become copies of
+ * their common head and tail, only what changed in between is shipped. */
+pbo_error pbo_diff(pbo_t old, pbo_t cur, const char *patchfile)
+{
+    if(!old || !cur || !patchfile)
+        return PBO_ERROR_NEXIST;
+    if(old->state != EXISTING || cur->state != EXISTING)
+        return PBO_ERROR_STATE;
+
+    pbo_error ret = PBO_ERROR_IO;
+    pbo_io oio, nio;
+    FILE *out = NULL;
+    if(pbo_io_begin(old, IO_READ, &oio))
+        return PBO_ERROR_IO;
+    if(pbo_io_begin(cur, IO_READ, &nio)) {
+        pbo_io_end(old, &oio);
+        return PBO_ERROR_IO;
+    }
+    const pbo_io *of = &oio, *nf = &nio;
+
+    out = fopen(patchfile, "wb");
+    if(!out)
+        goto cleanup;
+
+    uint8_t oldsha[SHA1HashSize], newsha[SHA1HashSize];
+    if(pbo_patch_trailer(of, oldsha) || pbo_patch_trailer(nf, newsha))
+        goto cleanup;
+
+    //Both archives are compared front to back, then not needed again
+    uint64_t oldsz = 0, newsz = 0;
+    of->ops->size(of->handle, &oldsz);
+    nf->ops->size(nf->handle, &newsz);
+    pbo_io_advise(of, 0, oldsz, ADVISE_SEQUENTIAL);
+    pbo_io_advise(nf, 0, newsz, ADVISE_SEQUENTIAL);
+
+    fwrite(PATCH_MAGIC, 1, 8, out);
+    pbo_patch_put_u32(out, PATCH_VERSION);
+    fwrite(oldsha, 1, SHA1HashSize, out);
+    fwrite(newsha, 1, SHA1HashSize, out);
+
+    //The header is small and changes anyway, ship it whole
+    pbo_patch_put_u32(out, cur->headersz);
+    unsigned char buf[IOBUFSZ];
+    for(size_t pos = 0; pos < cur->headersz;) {
+        size_t n = cur->headersz - pos < sizeof buf ? cur->headersz - pos : sizeof buf;
+        if(nf->ops->read_at(nf->handle, buf, n, pos) != n || fwrite(buf, 1, n, out) != n)
+            goto cleanup;
+        pos += n;
+    }
+
+    struct patch_writer w = { out, nf, 0, 0, 0 };
+    for(struct list_entry *e = cur->root; e && !w.err; e = e->next) {
+        struct pbo_entry *ne = e->data;
+        size_t nsz = ne->properties[DATA_SIZE];
+        size_t noff = cur->headersz + ne->file_offset;
+        if(*ne->name == '\0' || !nsz)
+            continue;
+
+        struct list_entry *oe = pbo_index_find(old, ne->name);
+        if(!oe) {
+            pbo_patch_data(&w, noff, nsz);
+            continue;
+        }
+
+        size_t osz = oe->data->properties[DATA_SIZE];
+        size_t ooff = old->headersz + oe->data->file_offset;
+        size_t min = osz < nsz ? osz : nsz;
+
+        size_t head = pbo_patch_common(of, ooff, nf, noff, min, 0);
+        if(head == nsz && osz == nsz) {
+            pbo_patch_copy(&w, ooff, nsz);
+            continue;
+        }
+        size_t tail = pbo_patch_common(of, ooff + osz - (min - head), nf, noff + nsz - (min - head), min - head, 1);
+
+        if(head < PATCH_MINCOPY)
+            head = 0;
+        if(tail < PATCH_MINCOPY)
+            tail = 0;
+
+        pbo_patch_copy(&w, ooff, head);
+        pbo_patch_data(&w, noff + head, nsz - head - tail);
+        pbo_patch_copy(&w, ooff + osz - tail, tail);
+    }
+    pbo_patch_flush(&w);
+    fputc(OP_END, out);
+    pbo_io_advise(of, 0, oldsz, ADVISE_DONTNEED);
+    pbo_io_advise(nf, 0, newsz, ADVISE_DONTNEED);
+
+    if(!w.err && !ferror(out))
+        ret = PBO_SUCCESS;
+
+cleanup:
+    pbo_io_end(old, &oio);
+    pbo_io_end(cur, &nio);
+    if(out && fclose(out))
+        ret = PBO_ERROR_IO;
+    return ret;
+}
+
+static int pbo_patch_copy_io(const pbo_io *src, uint64_t off, FILE *dst, uint64_t len, SHA1Context *ctx)
+{
+    unsigned char buf[IOBUFSZ];
+    pbo_io_advise(src, off, len, ADVISE_WILLNEED);
+    while(len) {
+        size_t n = len < sizeof buf ? len : sizeof buf;
+        if(src->ops->read_at(src->handle, buf, n, off) != n || fwrite(buf, 1, n, dst) != n)
+            return -1;
+        pbo_io_advise(src, off, n, ADVISE_DONTNEED);
+        SHA1Input(ctx, buf, n);
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int pbo_patch_stream(FILE *src, FILE *dst, uint64_t len, SHA1Context *ctx)
+{
+    unsigned char buf[IOBUFSZ];
+    while(len) {
+        size_t n = len < sizeof buf ? len : sizeof buf;
+        if(fread(buf, 1, n, src) != n || fwrite(buf, 1, n, dst) != n)
+            return -1;
+        SHA1Input(ctx, buf, n);
+        len -= n;
+    }
+    return 0;
+}
+
+//Whether a and b name the same file, however they are spelled
+static int pbo_patch_same_file(const char *a, const char *b)
+{
+    if(!strcmp(a, b))
+        return 1;
+#ifndef _WIN32
+    struct stat sa, sb;
+    if(!stat(a, &sa) && !stat(b, &sb))
+        return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#endif
+    return 0;
+}
+
+/* Rebuilds the new archive from old and a patch by pbo_diff, in one pass
+ * over the patch. Fails if old isn't the archive the patch was made
+ * against or the result doesn't hash to what the new archive had, and
+ * refuses to write over old itself. Like pbo_write the result replaces
+ * outfile only once complete, with old's batch if it has one. */
+pbo_error pbo_patch(pbo_t old, const char *patchfile, const char *outfile)
+{
+    if(!old || !patchfile || !outfile)
+        return PBO_ERROR_NEXIST;
+    if(old->state != EXISTING && old->state != CLEAR)
+        return PBO_ERROR_STATE;
+    //Copies read from old while the output is written
+    if(old->filename && pbo_patch_same_file(old->filename, outfile))
+        return PBO_ERROR_STATE;
+
+    pbo_error ret = PBO_ERROR_IO;
+    pbo_io oio;
+    if(pbo_io_begin(old, IO_READ, &oio))
+        return PBO_ERROR_IO;
+    const pbo_io *of = &oio;
+    FILE *pf = fopen(patchfile, "rb");
+    FILE *out = NULL;
+    char *tmp = NULL;
+    if(!pf)
+        goto cleanup;
+
+    char magic[8];
+    uint32_t version, hsz;
+    uint8_t oldsha[SHA1HashSize], newsha[SHA1HashSize], sha[SHA1HashSize];
+    if(fread(magic, 1, 8, pf) != 8 || memcmp(magic, PATCH_MAGIC, 8) ||
+       pbo_patch_get_u32(pf, &version) || version != PATCH_VERSION ||
+       fread(oldsha, 1, SHA1HashSize, pf) != SHA1HashSize ||
+       fread(newsha, 1, SHA1HashSize, pf) != SHA1HashSize ||
+       pbo_patch_get_u32(pf, &hsz)) {
+        ret = PBO_ERROR_BROKEN;
+        goto cleanup;
+    }
+
+    if(pbo_patch_trailer(of, sha))
+        goto cleanup;
+    if(memcmp(sha, oldsha, SHA1HashSize)) {
+        ret = PBO_ERROR_STATE; //Made against a different archive
+        goto cleanup;
+    }
+
+    //Written next to outfile and renamed over it once it checks out
+    if(!(tmp = pbo_atomic_temp(outfile)) || !(out = fopen(tmp, "wb")))
+        goto cleanup;
+
+    SHA1Context ctx;
+    SHA1Reset(&ctx);
+    if(pbo_patch_stream(pf, out, hsz, &ctx))
+        goto broken;
+
+    for(;;) {
+        int op = fgetc(pf);
+        uint64_t off, len;
+        if(op == OP_END)
+            break;
+        else if(op == OP_COPY) {
+            if(pbo_patch_get_u64(pf, &off) || pbo_patch_get_u64(pf, &len) ||
+               pbo_patch_copy_io(of, off, out, len, &ctx))
+                goto broken;
+        } else if(op == OP_DATA) {
+            if(pbo_patch_get_u64(pf, &len) || pbo_patch_stream(pf, out, len, &ctx))
+                goto broken;
+        } else
+            goto broken;
+    }
+
+    SHA1Result(&ctx, sha);
+    fputc('\0', out);
+    fwrite(sha, 1, SHA1HashSize, out);
+    if(memcmp(sha, newsha, SHA1HashSize))
+        goto broken;
+
+    ret = PBO_SUCCESS;
+    goto cleanup;
+
+broken:
+    ret = PBO_ERROR_BROKEN;
+cleanup:
+    pbo_io_end(old, &oio);
+    if(pf)
+        fclose(pf);
+    if(out && fclose(out) && !ret)
+        ret = PBO_ERROR_IO;
+    if(tmp && ret)
+        pbo_atomic_abort(tmp);
+    else if(tmp)
+        ret = pbo_atomic_finish(tmp, outfile, old->batch);
+    return ret;
+}
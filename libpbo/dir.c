@@ -0,0 +1,299 @@
+/* dir.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_DIRENT_H
+# include <dirent.h>
+#endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+#include "pool.h"
+#include "pbo-private.h"
+
+#define PATH_BUFSZ 4096
+
+struct dir_item {
+    char *path;
+    char *name; //As stored in the pbo
+    char *key; //Normalised, for matching and ordering
+    unsigned char *data;
+    size_t size;
+    time_t mtime;
+    pbo_error err;
+};
+
+struct dir_walk {
+    const pbo_dir_options *opts;
+    struct dir_item *items;
+    size_t len;
+    size_t cap;
+    size_t rootlen;
+};
+
+//Globs are normalised like the keys, so case and separators don't matter
+static int pbo_dir_matches(const char **globs, const char *key)
+{
+    char pattern[MAXNAMELEN];
+    for(; *globs; globs++) {
+        pbo_util_normalize(pattern, *globs, sizeof pattern);
+        if(pbo_util_glob(pattern, key))
+            return 1;
+    }
+    return 0;
+}
+
+static pbo_error pbo_dir_push(struct dir_walk *w, const char *path)
+{
+    const char *rel = path + w->rootlen;
+    while(*rel == '/')
+        rel++;
+
+    size_t len = strlen(rel);
+    if(len >= MAXNAMELEN)
+        return PBO_ERROR_BROKEN; //Wouldn't fit a pbo header
+
+    char key[MAXNAMELEN];
+    pbo_util_normalize(key, rel, sizeof key);
+    if(w->opts && w->opts->include && !pbo_dir_matches(w->opts->include, key))
+        return PBO_SUCCESS;
+    if(w->opts && w->opts->exclude && pbo_dir_matches(w->opts->exclude, key))
+        return PBO_SUCCESS;
+
+    if(w->len == w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : 64;
+        struct dir_item *new = realloc(w->items, cap * sizeof *new);
+        if(!new)
+            return PBO_ERROR_MALLOC;
+        w->items = new;
+        w->cap = cap;
+    }
+
+    struct dir_item *it = &w->items[w->len];
+    it->path = malloc(strlen(path) + 1 + 2 * (len + 1));
+    if(!it->path)
+        return PBO_ERROR_MALLOC;
+    strcpy(it->path, path);
+    it->name = it->path + strlen(path) + 1;
+    it->key = it->name + len + 1;
+
+    for(size_t i = 0; i <= len; i++)
+        it->name[i] = rel[i] == '/' ? '\\' : rel[i];
+    strcpy(it->key, key);
+
+    it->data = NULL;
+    it->size = 0;
+    it->mtime = (time_t)-1;
+    it->err = PBO_SUCCESS;
+    w->len++;
+    return PBO_SUCCESS;
+}
+
+#ifdef HAVE_DIRENT_H
+/* Only the directory structure is walked here, with d_type saving a stat
+ * per entry where the filesystem provides it. Files are opened and read by
+ * the workers afterwards. */
+static pbo_error pbo_dir_walk(struct dir_walk *w, char *path, size_t len)
+{
+    DIR *dir = opendir(path);
+    if(!dir)
+        return PBO_ERROR_IO;
+
+    pbo_error ret = PBO_SUCCESS;
+    struct dirent *de;
+    while(!ret && (de = readdir(dir))) {
+        if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+
+        size_t nlen = strlen(de->d_name);
+        if(len + 1 + nlen >= PATH_BUFSZ) {
+            ret = PBO_ERROR_BROKEN;
+            break;
+        }
+        path[len] = '/';
+        memcpy(path + len + 1, de->d_name, nlen + 1);
+
+        int isdir = 0, isreg = 0;
+#ifdef _DIRENT_HAVE_D_TYPE
+        isdir = de->d_type == DT_DIR;
+        isreg = de->d_type == DT_REG;
+        if(de->d_type == DT_UNKNOWN || de->d_type == DT_LNK)
+#endif
+        {
+            struct stat st;
+            if(!stat(path, &st)) {
+                isdir = S_ISDIR(st.st_mode);
+                isreg = S_ISREG(st.st_mode);
+            }
+        }
+
+        if(isdir)
+            ret = pbo_dir_walk(w, path, len + 1 + nlen);
+        else if(isreg)
+            ret = pbo_dir_push(w, path);
+        path[len] = '\0';
+    }
+    closedir(dir);
+    return ret;
+}
+#endif
+
+static void pbo_dir_ingest(size_t i, void *user)
+{
+    struct dir_walk *w = user;
+    struct dir_item *it = &w->items[i];
+
+    FILE *file = fopen(it->path, "rb");
+    if(!file) {
+        it->err = PBO_ERROR_IO;
+        return;
+    }
+
+    struct stat st;
+    if(fstat(fileno(file), &st)) {
+        it->err = PBO_ERROR_IO;
+        goto done;
+    }
+
+    it->size = st.st_size;
+    it->mtime = st.st_mtime;
+    it->data = malloc(it->size ? it->size : 1);
+    if(!it->data) {
+        it->err = PBO_ERROR_MALLOC;
+        goto done;
+    }
+#if defined(HAVE_POSIX_FADVISE) && defined(HAVE_FCNTL_H)
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    if(fread(it->data, 1, it->size, file) != it->size)
+        it->err = PBO_ERROR_IO;
+#if defined(HAVE_POSIX_FADVISE) && defined(HAVE_FCNTL_H)
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_DONTNEED); //Read once, in memory now
+#endif
+
+done:
+    fclose(file);
+}
+
+static int pbo_dir_cmp(const void *a, const void *b)
+{
+    const struct dir_item *x = a, *y = b;
+    int r = strcmp(x->key, y->key);
+    return r ? r : strcmp(x->name, y->name);
+}
+
+/* Lists the files under root that opts lets through, their sizes summed
+ * into bytes if it's set, which costs a stat each. Nothing is read yet. */
+pbo_error pbo_dir_scan(const char *root, const pbo_dir_options *opts, struct dir_walk **out, uint64_t *bytes)
+{
+    *out = NULL;
+#ifndef HAVE_DIRENT_H
+    (void)root, (void)opts, (void)bytes;
+    return PBO_ERROR_IO;
+#else
+    char path[PATH_BUFSZ];
+    size_t len = strlen(root);
+    while(len > 1 && root[len - 1] == '/')
+        len--;
+    if(len >= sizeof path)
+        return PBO_ERROR_NEXIST;
+    memcpy(path, root, len);
+    path[len] = '\0';
+
+    struct dir_walk *w = malloc(sizeof *w);
+    if(!w)
+        return PBO_ERROR_MALLOC;
+    w->opts = opts;
+    w->items = NULL;
+    w->len = w->cap = 0;
+    w->rootlen = len;
+
+    pbo_error ret = pbo_dir_walk(w, path, len);
+    if(!ret && bytes) {
+        *bytes = 0;
+        for(size_t i = 0; i < w->len; i++) {
+            struct stat st;
+            if(!stat(w->items[i].path, &st))
+                *bytes += st.st_size;
+        }
+    }
+    if(ret) {
+        pbo_dir_free(w);
+        return ret;
+    }
+    *out = w;
+    return PBO_SUCCESS;
+#endif
+}
+
+void pbo_dir_free(struct dir_walk *w)
+{
+    if(!w)
+        return;
+    for(size_t i = 0; i < w->len; i++) {
+        free(w->items[i].data); //Only left over on failure
+        free(w->items[i].path);
+    }
+    free(w->items);
+    free(w);
+}
+
+/* Reads the files w lists on threads threads and adds them to d. If any
+ * can't be read or memory runs out, d is left as it was. */
+pbo_error pbo_dir_add(pbo_t d, struct dir_walk *w, int threads)
+{
+    //Reading the files is where the time goes, spread it over the pool
+    pbo_pool_run(w->len, threads, pbo_dir_ingest, w);
+    for(size_t i = 0; i < w->len; i++)
+        if(w->items[i].err)
+            return w->items[i].err;
+
+    //Same tree, same order, whatever order the filesystem listed it in
+    if(w->len)
+        qsort(w->items, w->len, sizeof *w->items, pbo_dir_cmp);
+
+    //Staged in an archive of their own, d only changes once nothing can fail
+    pbo_t staged = pbo_init(NULL);
+    pbo_error ret = staged ? pbo_init_new(staged) : PBO_ERROR_MALLOC;
+    for(size_t i = 0; i < w->len && !ret; i++) {
+        struct dir_item *it = &w->items[i];
+        ret = pbo_add_entry(staged, it->name, it->data, it->size, pbo_timestamp_for(d, it->mtime), NULL, NULL);
+        if(!ret)
+            it->data = NULL;
+    }
+
+    if(!ret && w->opts && w->opts->prefix)
+        ret = pbo_set_extension(d, "prefix", w->opts->prefix);
+    if(!ret)
+        pbo_take_entries(d, staged);
+    pbo_dispose(staged);
+    return ret;
+}
+
+pbo_error pbo_add_directory(pbo_t d, const char *root, const pbo_dir_options *opts)
+{
+    if(!d || !root)
+        return PBO_ERROR_NEXIST;
+    if(d->state != NEW && d->state != EDIT)
+        return PBO_ERROR_STATE;
+
+    struct dir_walk *w;
+    pbo_error ret = pbo_dir_scan(root, opts, &w, NULL);
+    if(!ret)
+        ret = pbo_dir_add(d, w, opts ? opts->threads : 0);
+    pbo_dir_free(w);
+    return ret;
+}
@@ -0,0 +1,233 @@
+/* direct.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#define _GNU_SOURCE 1 //O_DIRECT
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "pbo-private.h"
+
+#define DIRECT_ALIGN 4096
+#define DIRECT_CHUNK (1 << 20)
+#define DIRECT_SLOTS 4
+
+/* Output written around the page cache. The stream is cut into aligned
+ * chunks which a thread writes while the next ones are filled, the last
+ * one is padded to the alignment and the file truncated back after. */
+struct direct_writer {
+    int fd;
+    unsigned char *bufs[DIRECT_SLOTS];
+    size_t lens[DIRECT_SLOTS];
+    size_t fill; //Of the slot being filled
+    uint64_t size; //Bytes taken so far
+    size_t head; //Chunks handed over
+    size_t tail; //Chunks written
+    int done;
+    int err;
+    int threaded;
+#ifdef HAVE_PTHREAD_H
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+};
+
+#if defined(O_DIRECT) && defined(HAVE_UNISTD_H) && defined(HAVE_POSIX_MEMALIGN)
+static int pbo_direct_chunk(struct direct_writer *w, size_t slot, uint64_t off)
+{
+    size_t len = w->lens[slot];
+    for(size_t done = 0; done < len;) {
+        ssize_t n = pwrite(w->fd, w->bufs[slot] + done, len - done, off + done);
+        if(n <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+#ifdef HAVE_PTHREAD_H
+static void *pbo_direct_run(void *arg)
+{
+    struct direct_writer *w = arg;
+
+    pthread_mutex_lock(&w->lock);
+    for(;;) {
+        while(w->tail == w->head && !w->done)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if(w->tail == w->head)
+            break;
+
+        size_t t = w->tail;
+        pthread_mutex_unlock(&w->lock);
+
+        //Every chunk but the last is full, so its offset follows from its number
+        int err = pbo_direct_chunk(w, t % DIRECT_SLOTS, (uint64_t)t * DIRECT_CHUNK);
+
+        pthread_mutex_lock(&w->lock);
+        w->err |= err;
+        w->tail++;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+#endif
+
+//Hands the slot being filled over and waits for the next one to be free
+static void pbo_direct_submit(struct direct_writer *w, size_t len)
+{
+    size_t slot = w->head % DIRECT_SLOTS;
+    w->lens[slot] = len;
+
+#ifdef HAVE_PTHREAD_H
+    if(w->threaded) {
+        pthread_mutex_lock(&w->lock);
+        w->head++;
+        pthread_cond_broadcast(&w->cond);
+        while(w->head - w->tail == DIRECT_SLOTS)
+            pthread_cond_wait(&w->cond, &w->lock);
+        pthread_mutex_unlock(&w->lock);
+        w->fill = 0;
+        return;
+    }
+#endif
+    w->err |= pbo_direct_chunk(w, slot, (uint64_t)w->head * DIRECT_CHUNK);
+    w->head++;
+    w->fill = 0;
+}
+
+struct direct_writer *pbo_direct_open(const char *path)
+{
+    struct direct_writer *w = calloc(1, sizeof *w);
+    if(!w)
+        return NULL;
+
+    for(int i = 0; i < DIRECT_SLOTS; i++)
+        if(posix_memalign((void **)&w->bufs[i], DIRECT_ALIGN, DIRECT_CHUNK))
+            goto cleanup;
+
+    //Filesystems without O_DIRECT refuse it here, the caller falls back
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if(w->fd < 0)
+        goto cleanup;
+
+#ifdef HAVE_PTHREAD_H
+    if(!pthread_mutex_init(&w->lock, NULL)) {
+        if(!pthread_cond_init(&w->cond, NULL)) {
+            if(!pthread_create(&w->thread, NULL, pbo_direct_run, w))
+                w->threaded = 1;
+            else
+                pthread_cond_destroy(&w->cond);
+        }
+        if(!w->threaded)
+            pthread_mutex_destroy(&w->lock);
+    }
+#endif
+    return w;
+
+cleanup:
+    for(int i = 0; i < DIRECT_SLOTS; i++)
+        free(w->bufs[i]);
+    free(w);
+    return NULL;
+}
+
+//Reserves what's about to be written where the filesystem can
+void pbo_direct_reserve(struct direct_writer *w, uint64_t size)
+{
+#ifdef HAVE_POSIX_FALLOCATE
+    if(size)
+        posix_fallocate(w->fd, 0, size);
+#else
+    (void)w, (void)size;
+#endif
+}
+
+void pbo_direct_write(struct direct_writer *w, const void *p, size_t n)
+{
+    const unsigned char *src = p;
+    w->size += n;
+    while(n) {
+        size_t c = DIRECT_CHUNK - w->fill;
+        if(c > n)
+            c = n;
+        memcpy(w->bufs[w->head % DIRECT_SLOTS] + w->fill, src, c);
+        w->fill += c;
+        src += c;
+        n -= c;
+        if(w->fill == DIRECT_CHUNK)
+            pbo_direct_submit(w, DIRECT_CHUNK);
+    }
+}
+
+int pbo_direct_close(struct direct_writer *w)
+{
+    //The tail goes out padded to the alignment, then gets cut off again
+    if(w->fill) {
+        size_t len = (w->fill + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+        memset(w->bufs[w->head % DIRECT_SLOTS] + w->fill, 0, len - w->fill);
+        pbo_direct_submit(w, len);
+    }
+
+#ifdef HAVE_PTHREAD_H
+    if(w->threaded) {
+        pthread_mutex_lock(&w->lock);
+        w->done = 1;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+
+        pthread_join(w->thread, NULL);
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+    }
+#endif
+
+    int err = w->err || ftruncate(w->fd, w->size);
+    err |= close(w->fd);
+    for(int i = 0; i < DIRECT_SLOTS; i++)
+        free(w->bufs[i]);
+    free(w);
+    return err ? -1 : 0;
+}
+#else
+struct direct_writer *pbo_direct_open(const char *path)
+{
+    (void)path;
+    return NULL; //Always buffered
+}
+
+void pbo_direct_reserve(struct direct_writer *w, uint64_t size)
+{
+    (void)w, (void)size;
+}
+
+void pbo_direct_write(struct direct_writer *w, const void *p, size_t n)
+{
+    (void)w, (void)p, (void)n;
+}
+
+int pbo_direct_close(struct direct_writer *w)
+{
+    (void)w;
+    return -1;
+}
+#endif
@@ -0,0 +1,269 @@
+/* ext.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pbo-private.h"
+
+#define EXT_NOKEY ((uint32_t)-1)
+
+static uint32_t pbo_ext_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while(*s)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+/* Replaces the contents of he with the n strings in strs, which may point
+ * into the old block. Entries, key table and strings all go into one
+ * allocation. Keys are the strings at even positions that have a value
+ * after them, the first of equal keys wins. */
+static pbo_error pbo_ext_build(struct header_extension *he, const char **strs, size_t n)
+{
+    size_t bytes = 0;
+    for(size_t i = 0; i < n; i++)
+        bytes += strlen(strs[i]) + 1;
+
+    size_t nslots = 8;
+    while(nslots < n)
+        nslots *= 2; //At most half full, n counts values too
+
+    char *block = malloc(n * sizeof(char *) + nslots * sizeof(uint32_t) + bytes);
+    if(!block)
+        return PBO_ERROR_MALLOC;
+
+    char **entries = (char **)block;
+    uint32_t *slots = (uint32_t *)(entries + n);
+    char *p = (char *)(slots + nslots);
+    for(size_t i = 0; i < n; i++) {
+        size_t l = strlen(strs[i]) + 1;
+        entries[i] = memcpy(p, strs[i], l);
+        p += l;
+    }
+    for(size_t i = 0; i < nslots; i++)
+        slots[i] = EXT_NOKEY;
+
+    for(size_t i = 0; i + 1 < n; i += 2) {
+        if(*entries[i] == '\0')
+            break; //Closing string
+        size_t s = pbo_ext_hash(entries[i]) & (nslots - 1);
+        while(slots[s] != EXT_NOKEY && strcmp(entries[slots[s]], entries[i]))
+            s = (s + 1) & (nslots - 1);
+        if(slots[s] == EXT_NOKEY)
+            slots[s] = i;
+    }
+
+    free(he->block);
+    he->block = block;
+    he->entries = entries;
+    he->slots = slots;
+    he->nslots = nslots;
+    he->len = n;
+    return PBO_SUCCESS;
+}
+
+struct header_extension *pbo_ext_new(void)
+{
+    return calloc(1, sizeof(struct header_extension));
+}
+
+void pbo_ext_free(struct header_extension *he)
+{
+    if(!he)
+        return;
+    free(he->block);
+    free(he);
+}
+
+//Index of key in entries, -1 if it's not there
+static ptrdiff_t pbo_ext_find(const struct header_extension *he, const char *key)
+{
+    if(!he->nslots || !*key)
+        return -1;
+
+    size_t s = pbo_ext_hash(key) & (he->nslots - 1);
+    for(; he->slots[s] != EXT_NOKEY; s = (s + 1) & (he->nslots - 1))
+        if(!strcmp(he->entries[he->slots[s]], key))
+            return he->slots[s];
+    return -1;
+}
+
+//Splices count strings in at pos, replacing drop strings there
+static pbo_error pbo_ext_splice(struct header_extension *he, size_t pos, size_t drop, const char **strs, size_t count)
+{
+    size_t n = he->len - drop + count;
+    const char **tmp = malloc((n ? n : 1) * sizeof *tmp);
+    if(!tmp)
+        return PBO_ERROR_MALLOC;
+
+    size_t k = 0;
+    for(size_t i = 0; i < pos; i++)
+        tmp[k++] = he->entries[i];
+    for(size_t i = 0; i < count; i++)
+        tmp[k++] = strs[i];
+    for(size_t i = pos + drop; i < he->len; i++)
+        tmp[k++] = he->entries[i];
+
+    pbo_error ret = pbo_ext_build(he, tmp, n);
+    free(tmp);
+    return ret;
+}
+
+pbo_error pbo_ext_add(struct header_extension *he, const char *e)
+{
+    return pbo_ext_splice(he, he->len, 0, &e, 1);
+}
+
+/* Drops the pairs whose key starts with prefix and appends the count strings
+ * in strs, ahead of a closing string or a key still missing its value. */
+pbo_error pbo_ext_replace_prefixed(struct header_extension *he, const char *prefix, const char **strs, size_t count)
+{
+    size_t plen = strlen(prefix);
+    const char **tmp = malloc((he->len + count + 1) * sizeof *tmp);
+    if(!tmp)
+        return PBO_ERROR_MALLOC;
+
+    size_t k = 0, i = 0;
+    for(; i + 1 < he->len && *he->entries[i]; i += 2) {
+        if(strncmp(he->entries[i], prefix, plen)) {
+            tmp[k++] = he->entries[i];
+            tmp[k++] = he->entries[i + 1];
+        }
+    }
+    for(size_t j = 0; j < count; j++)
+        tmp[k++] = strs[j];
+    for(; i < he->len; i++)
+        tmp[k++] = he->entries[i];
+
+    pbo_error ret = pbo_ext_build(he, tmp, k);
+    free(tmp);
+    return ret;
+}
+
+//Drops the closing empty string for editing, nothing to reallocate
+void pbo_ext_unfinalize(struct header_extension *he)
+{
+    if(he->len && *he->entries[he->len - 1] == '\0')
+        he->len--;
+}
+
+/* Reads the strings following the extension entry up to and including the
+ * closing empty one. Each is bounded like a name. */
+pbo_error pbo_ext_parse(struct header_extension *he, struct io_reader *r)
+{
+    size_t cap = 256, used = 0, n = 0;
+    char *buf = malloc(cap);
+    const char **strs = NULL;
+    pbo_error ret = PBO_ERROR_MALLOC;
+    if(!buf)
+        return ret;
+
+    for(;;) {
+        size_t start = used;
+        int c;
+        do {
+            c = pbo_reader_getc(r);
+            if(c == EOF || used - start >= MAXNAMELEN) {
+                ret = PBO_ERROR_BROKEN;
+                goto cleanup;
+            }
+            if(used == cap) {
+                char *nb = realloc(buf, cap *= 2);
+                if(!nb)
+                    goto cleanup;
+                buf = nb;
+            }
+            buf[used++] = c;
+        } while(c);
+
+        n++;
+        if(used - start == 1)
+            break;
+    }
+
+    //Strings were appended into one buffer, point at them now it stopped moving
+    strs = malloc(n * sizeof *strs);
+    if(!strs)
+        goto cleanup;
+    for(size_t i = 0, off = 0; i < n; i++) {
+        strs[i] = buf + off;
+        off += strlen(buf + off) + 1;
+    }
+    ret = pbo_ext_build(he, strs, n);
+
+cleanup:
+    free(strs);
+    free(buf);
+    return ret;
+}
+
+static struct header_extension *pbo_ext_of(pbo_t d)
+{
+    if(!d || !d->root || *d->root->data->name != '\0')
+        return NULL;
+    return d->root->data->ext;
+}
+
+const char *pbo_get_extension(pbo_t d, const char *key)
+{
+    struct header_extension *he = pbo_ext_of(d);
+    if(!he || !key)
+        return NULL;
+
+    ptrdiff_t i = pbo_ext_find(he, key);
+    return i < 0 ? NULL : he->entries[i + 1];
+}
+
+pbo_error pbo_set_extension(pbo_t d, const char *key, const char *value)
+{
+    if(!d || !key || !value)
+        return PBO_ERROR_NEXIST;
+    if(d->state != NEW && d->state != EDIT)
+        return PBO_ERROR_STATE;
+    if(!*key)
+        return PBO_ERROR_STATE; //Would end the extension
+
+    struct header_extension *he = pbo_ext_of(d);
+    ptrdiff_t i = he ? pbo_ext_find(he, key) : -1;
+    if(i >= 0)
+        return pbo_ext_splice(he, i + 1, 1, &value, 1);
+
+    pbo_error ret = pbo_add_extension(d, key);
+    if(!ret && (ret = pbo_add_extension(d, value)))
+        pbo_ext_of(d)->len--; //A key without value has no slot, dropping it is enough
+    return ret;
+}
+
+/* Replaces all extensions with count key/value pairs, pairs[2 * i] being
+ * a key and pairs[2 * i + 1] its value, in one go. */
+pbo_error pbo_set_extensions(pbo_t d, const char **pairs, size_t count)
+{
+    if(!d || (!pairs && count))
+        return PBO_ERROR_NEXIST;
+    if(d->state != NEW && d->state != EDIT)
+        return PBO_ERROR_STATE;
+    for(size_t i = 0; i < 2 * count; i++)
+        if(!pairs[i] || (i % 2 == 0 && !*pairs[i]))
+            return PBO_ERROR_STATE;
+
+    struct header_extension *he = pbo_ext_of(d);
+    if(!he) {
+        if(!count)
+            return PBO_SUCCESS;
+        pbo_error ret = pbo_add_extension(d, pairs[0]); //Creates the entry
+        if(ret)
+            return ret;
+        he = pbo_ext_of(d);
+    }
+    return pbo_ext_build(he, pairs, 2 * count);
+}
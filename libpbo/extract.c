@@ -0,0 +1,364 @@
+/* extract.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_DIRECT_H
+# include <direct.h>
+#endif
+
+#include "pbo-private.h"
+
+#define EXTRACT_ALIGN 4096
+#define EXTRACT_DIRECT_MIN (1 << 20) //Smaller files aren't worth a writer thread
+
+struct extract_item {
+    const struct pbo_entry *pe;
+    char *path; //Output directory, then the name with / separators
+    size_t dirlen; //Up to the last separator
+};
+
+/* The data block is read a window at a time, so runs of small entries
+ * cost one read between them rather than one each. */
+struct extract_window {
+    const pbo_io *io;
+    unsigned char *buf;
+    size_t cap;
+    uint64_t start;
+    size_t len;
+    uint64_t end; //Of the data block
+};
+
+static void pbo_extract_mkdir(const char *path)
+{
+#ifdef HAVE_DIRECT_H
+    mkdir(path);
+#else
+    mkdir(path, 0755);
+#endif
+}
+
+/* Turns an entry name into a relative path with / separators, dropping
+ * empty components. Names that would leave the output directory, or
+ * name a directory, are refused with 0. */
+static size_t pbo_extract_map(char *dst, const char *name)
+{
+    size_t len = 0;
+    while(*name) {
+        const char *c = name;
+        while(*name && *name != '\\' && *name != '/')
+            name++;
+        size_t n = name - c;
+        if(*name)
+            name++;
+        if(!n)
+            continue;
+        if((n == 1 && c[0] == '.') || (n == 2 && c[0] == '.' && c[1] == '.') || memchr(c, ':', n))
+            return 0;
+
+        if(len)
+            dst[len++] = '/';
+        memcpy(dst + len, c, n);
+        len += n;
+    }
+    dst[len] = '\0';
+    return len;
+}
+
+static int pbo_extract_cmp(const void *a, const void *b)
+{
+    return strcmp((*(const struct extract_item **)a)->path, (*(const struct extract_item **)b)->path);
+}
+
+/* Sorted, all paths below a directory are next to each other, so only the
+ * components past what a path shares with the one before need creating
+ * and every directory is made exactly once. */
+static void pbo_extract_dirs(struct extract_item **v, size_t n)
+{
+    const char *prev = "";
+    size_t prevlen = 0;
+    for(size_t i = 0; i < n; i++) {
+        char *p = v[i]->path;
+        size_t len = v[i]->dirlen;
+
+        size_t j = 0;
+        while(j < len && j < prevlen && p[j] == prev[j])
+            j++;
+        //Shared up to a separator in both, or "a-b" before "a/" would pass for "a"
+        size_t common = j;
+        if(!((j == len || p[j] == '/') && (j == prevlen || prev[j] == '/')))
+            for(common = j ? j - 1 : 0; common && p[common] != '/';)
+                common--;
+
+        for(j = common + 1; j <= len; j++) {
+            if(j != len && p[j] != '/')
+                continue;
+            p[j] = '\0';
+            pbo_extract_mkdir(p);
+            p[j] = '/';
+        }
+        prev = p;
+        prevlen = len;
+    }
+}
+
+static const unsigned char *pbo_extract_get(struct extract_window *w, uint64_t off, size_t len)
+{
+    if(off >= w->start && off + len <= w->start + w->len)
+        return w->buf + (off - w->start);
+    if(len > w->cap || off + len > w->end)
+        return NULL;
+
+    if(w->len)
+        pbo_io_advise(w->io, w->start, w->len, ADVISE_DONTNEED);
+    size_t want = w->end - off < w->cap ? w->end - off : w->cap;
+    w->start = off;
+    w->len = w->io->ops->read_at(w->io->handle, w->buf, want, off);
+    return w->len >= len ? w->buf : NULL;
+}
+
+/* Output of one file, through an io or around the page cache in aligned
+ * chunks. Written front to back either way. */
+struct extract_out {
+    pbo_io io;
+    struct direct_writer *direct;
+    uint64_t pos;
+};
+
+static int pbo_extract_put(struct extract_out *o, const void *p, size_t n)
+{
+    if(o->direct)
+        pbo_direct_write(o->direct, p, n);
+    else if(o->io.ops->write_at(o->io.handle, p, n, o->pos) != n)
+        return -1;
+    o->pos += n;
+    return 0;
+}
+
+static void pbo_extract_stamp(const pbo_io *io, const struct pbo_entry *pe)
+{
+#if defined(HAVE_FUTIMENS) && defined(HAVE_FCNTL_H)
+    if(pbo_io_fileno(io) < 0)
+        return;
+    struct timespec ts[2];
+    ts[0].tv_sec = 0;
+    ts[0].tv_nsec = UTIME_OMIT;
+    ts[1].tv_sec = pe->properties[TIME_STAMP];
+    ts[1].tv_nsec = 0;
+    futimens(pbo_io_fileno(io), ts);
+#else
+    (void)io, (void)pe;
+#endif
+}
+
+//Block packed entries are decoded a block at a time straight into the output
+static pbo_error pbo_extract_blocks(const struct extract_window *w, uint64_t off, const struct pbo_entry *pe,
+                                    struct extract_out *out)
+{
+    struct blocks_reader r;
+    unsigned char *buf = NULL;
+    pbo_error ret = pbo_blocks_open(&r, w->io, off, pe);
+    if(!ret)
+        ret = pbo_blocks_verify(&r, pe);
+    if(!ret && !(buf = malloc(r.bsize)))
+        ret = PBO_ERROR_MALLOC;
+    for(size_t at = 0; !ret && at < r.orig; at += r.bsize) {
+        size_t n = r.orig - at < r.bsize ? r.orig - at : r.bsize;
+        ret = pbo_blocks_get(&r, at, n, buf);
+        if(!ret && pbo_extract_put(out, buf, n))
+            ret = PBO_ERROR_IO;
+    }
+    free(buf);
+    pbo_blocks_close(&r);
+    return ret;
+}
+
+static pbo_error pbo_extract_entry(pbo_t d, struct extract_window *w, const struct extract_item *it,
+                                   const pbo_extract_options *opts)
+{
+    const struct pbo_entry *pe = it->pe;
+    uint64_t off = d->headersz + pe->file_offset;
+    size_t sz = pe->properties[DATA_SIZE];
+    int packed = pbo_entry_packed(pe);
+    size_t outsz = packed ? pe->properties[ORIGINAL_SIZE] : sz;
+    int stamp = opts && opts->timestamps && pe->properties[TIME_STAMP];
+
+    //Big files go around the page cache where asked and the filesystem lets them
+    struct extract_out out = { { NULL, NULL }, NULL, 0 };
+    if(opts && opts->direct && outsz >= EXTRACT_DIRECT_MIN)
+        out.direct = pbo_direct_open(it->path);
+    if(!out.direct && pbo_io_open_path(&out.io, it->path, IO_CREATE))
+        return PBO_ERROR_IO;
+
+    //Sized up front, the filesystem can lay it out in one go
+    if(out.direct)
+        pbo_direct_reserve(out.direct, outsz);
+#if defined(HAVE_POSIX_FALLOCATE) && defined(HAVE_FCNTL_H)
+    else if(pbo_io_fileno(&out.io) >= 0 && outsz)
+        posix_fallocate(pbo_io_fileno(&out.io), 0, outsz);
+#endif
+
+    pbo_error ret = PBO_SUCCESS;
+    if(pe->properties[PACKING_METHOD] == PBO_PACKING_BLOCKS) {
+        ret = pbo_extract_blocks(w, off, pe, &out);
+    } else if(packed) {
+        //LZSS is decoded whole, the window holds most entries anyway
+        const unsigned char *src = pbo_extract_get(w, off, sz);
+        unsigned char *heap = NULL, *dst = malloc(outsz ? outsz : 1);
+        if(!src && dst && (heap = malloc(sz ? sz : 1)) && w->io->ops->read_at(w->io->handle, heap, sz, off) == sz)
+            src = heap;
+        if(!dst || (!src && !heap))
+            ret = PBO_ERROR_MALLOC;
+        else if(!src)
+            ret = PBO_ERROR_IO;
+        else if((pe->has_crc && pbo_crc32c(0, src, sz) != pe->crc) || pbo_entry_decode(pe, src, sz, dst))
+            ret = PBO_ERROR_BROKEN;
+        else if(pbo_extract_put(&out, dst, outsz))
+            ret = PBO_ERROR_IO;
+        free(heap);
+        free(dst);
+    } else {
+        uint32_t crc = 0;
+        for(size_t done = 0; done < sz && !ret;) {
+            size_t c = sz - done < w->cap ? sz - done : w->cap;
+            const unsigned char *src = pbo_extract_get(w, off + done, c);
+            if(!src)
+                ret = PBO_ERROR_IO;
+            else if(pbo_extract_put(&out, src, c))
+                ret = PBO_ERROR_IO;
+            else if(pe->has_crc)
+                crc = pbo_crc32c(crc, src, c);
+            done += c;
+        }
+        if(!ret && pe->has_crc && crc != pe->crc)
+            ret = PBO_ERROR_BROKEN;
+    }
+
+    if(out.direct) {
+        //Closing cuts the padding off, which sets the mtime, so stamp after
+        if(pbo_direct_close(out.direct) && !ret)
+            ret = PBO_ERROR_IO;
+        if(!ret && stamp && !pbo_io_open_path(&out.io, it->path, IO_UPDATE)) {
+            pbo_extract_stamp(&out.io, pe);
+            pbo_io_close(&out.io);
+        }
+    } else {
+        if(!ret && stamp)
+            pbo_extract_stamp(&out.io, pe);
+        pbo_io_close(&out.io);
+    }
+    if(ret)
+        remove(it->path);
+    return ret;
+}
+
+/* Writes every file of d below dir, creating the directories they need.
+ * Names reaching outside dir fail the whole call before anything is
+ * written. Later entries of the same name overwrite earlier ones. */
+static pbo_error pbo_extract_untraced(pbo_t d, const char *dir, const pbo_extract_options *opts)
+{
+    if(!d || !dir)
+        return PBO_ERROR_NEXIST;
+    if(d->state != EXISTING)
+        return PBO_ERROR_STATE;
+
+    size_t dlen = strlen(dir);
+    while(dlen > 1 && (dir[dlen - 1] == '/' || dir[dlen - 1] == '\\'))
+        dlen--;
+
+    size_t n = 0, pathsz = 0;
+    for(struct list_entry *e = d->root; e; e = e->next) {
+        if(*e->data->name == '\0')
+            continue;
+        n++;
+        pathsz += dlen + 1 + strlen(e->data->name) + 1;
+    }
+
+    struct extract_item *items = malloc((n ? n : 1) * sizeof *items);
+    struct extract_item **sorted = malloc((n ? n : 1) * sizeof *sorted);
+    char *paths = malloc(pathsz ? pathsz : 1);
+    struct extract_window w = { NULL, NULL, 0, 0, 0, 0 };
+    pbo_io io = { NULL, NULL };
+    pbo_error ret = PBO_ERROR_MALLOC;
+    if(!items || !sorted || !paths)
+        goto cleanup;
+
+    ret = PBO_ERROR_BROKEN;
+    char *p = paths;
+    size_t i = 0;
+    for(struct list_entry *e = d->root; e; e = e->next) {
+        if(*e->data->name == '\0')
+            continue;
+        memcpy(p, dir, dlen);
+        p[dlen] = '/';
+        size_t len = pbo_extract_map(p + dlen + 1, e->data->name);
+        if(!len)
+            goto cleanup; //Unsafe or empty name
+
+        struct extract_item *it = &items[i];
+        it->pe = e->data;
+        it->path = p;
+        it->dirlen = strrchr(p, '/') - p;
+        sorted[i++] = it;
+        p += dlen + 1 + len + 1;
+    }
+
+    qsort(sorted, n, sizeof *sorted, pbo_extract_cmp);
+    pbo_extract_dirs(sorted, n);
+
+    ret = PBO_ERROR_IO;
+    if(pbo_io_begin(d, IO_READ, &io))
+        goto cleanup;
+    if(io.ops->size(io.handle, &w.end))
+        goto cleanup;
+
+    ret = PBO_ERROR_MALLOC;
+    w.io = &io;
+    w.cap = STREAMBUFSZ;
+#ifdef HAVE_POSIX_MEMALIGN
+    if(posix_memalign((void **)&w.buf, EXTRACT_ALIGN, w.cap))
+        w.buf = NULL;
+#else
+    w.buf = malloc(w.cap);
+#endif
+    if(!w.buf)
+        goto cleanup;
+
+    //Entries are in data order, so this is one pass over the file
+    pbo_io_advise(&io, d->headersz, w.end - d->headersz, ADVISE_SEQUENTIAL);
+    ret = PBO_SUCCESS;
+    for(i = 0; i < n && !ret; i++)
+        ret = pbo_extract_entry(d, &w, &items[i], opts);
+
+cleanup:
+    if(io.ops)
+        pbo_io_end(d, &io);
+    free(w.buf);
+    free(items);
+    free(sorted);
+    free(paths);
+    return ret;
+}
+
+pbo_error pbo_extract(pbo_t d, const char *dir, const pbo_extract_options *opts)
+{
+    struct pbo_span s;
+    pbo_trace_begin(&s, PBO_OP_EXTRACT, d ? d->filename : NULL);
+    return pbo_trace_end(&s, pbo_extract_untraced(d, dir, opts));
+}
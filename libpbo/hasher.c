@@ -0,0 +1,171 @@
+/* hasher.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "hasher.h"
+#include "pbo-private.h"
+
+#ifdef HAVE_PTHREAD_H
+static void *pbo_hasher_run(void *arg)
+{
+    struct pbo_hasher *h = arg;
+
+    pthread_mutex_lock(&h->lock);
+    for(;;) {
+        while(h->tail == h->head && !h->done)
+            pthread_cond_wait(&h->cond, &h->lock);
+        if(h->tail == h->head)
+            break;
+
+        size_t i = h->tail % HASHER_SLOTS;
+        pthread_mutex_unlock(&h->lock);
+
+        //Only this thread touches ctx until the join
+        SHA1Input(&h->ctx, h->slots[i].p, h->slots[i].n);
+
+        pthread_mutex_lock(&h->lock);
+        h->tail++;
+        pthread_cond_broadcast(&h->cond);
+    }
+    pthread_mutex_unlock(&h->lock);
+    return NULL;
+}
+#endif
+
+void pbo_hasher_start(struct pbo_hasher *h, const SHA1Context *ctx, int threaded)
+{
+    h->ctx = *ctx;
+    h->head = 0;
+    h->tail = 0;
+    h->done = 0;
+    h->threaded = 0;
+
+#ifdef HAVE_PTHREAD_H
+    if(!threaded)
+        return;
+    if(pthread_mutex_init(&h->lock, NULL))
+        return;
+    if(pthread_cond_init(&h->cond, NULL)) {
+        pthread_mutex_destroy(&h->lock);
+        return;
+    }
+    if(pthread_create(&h->thread, NULL, pbo_hasher_run, h)) {
+        pthread_cond_destroy(&h->cond);
+        pthread_mutex_destroy(&h->lock);
+        return; //Fall back to hashing inline
+    }
+    h->threaded = 1;
+#else
+    (void)threaded;
+#endif
+}
+
+size_t pbo_hasher_reserve(struct pbo_hasher *h)
+{
+#ifdef HAVE_PTHREAD_H
+    if(h->threaded) {
+        pthread_mutex_lock(&h->lock);
+        while(h->head - h->tail == HASHER_SLOTS)
+            pthread_cond_wait(&h->cond, &h->lock);
+        pthread_mutex_unlock(&h->lock);
+    }
+#endif
+    return h->head % HASHER_SLOTS;
+}
+
+void pbo_hasher_input(struct pbo_hasher *h, const void *p, size_t n)
+{
+    if(!n)
+        return;
+
+    if(!h->threaded) {
+        SHA1Input(&h->ctx, p, n);
+        h->head++;
+        return;
+    }
+
+#ifdef HAVE_PTHREAD_H
+    size_t i = pbo_hasher_reserve(h);
+    pthread_mutex_lock(&h->lock);
+    h->slots[i].p = p;
+    h->slots[i].n = n;
+    h->head++;
+    pthread_cond_broadcast(&h->cond);
+    pthread_mutex_unlock(&h->lock);
+#endif
+}
+
+void pbo_hasher_result(struct pbo_hasher *h, uint8_t sha[SHA1HashSize])
+{
+#ifdef HAVE_PTHREAD_H
+    if(h->threaded) {
+        pthread_mutex_lock(&h->lock);
+        h->done = 1;
+        pthread_cond_broadcast(&h->cond);
+        pthread_mutex_unlock(&h->lock);
+
+        pthread_join(h->thread, NULL);
+        pthread_cond_destroy(&h->cond);
+        pthread_mutex_destroy(&h->lock);
+        h->threaded = 0;
+    }
+#endif
+    SHA1Result(&h->ctx, sha);
+}
+
+/* Hashes len bytes of io starting at off on top of ctx. Reads go straight
+ * into a ring of aligned buffers while the previous ones are being hashed,
+ * and the range is dropped from the page cache as it's read. */
+int pbo_hasher_io(const pbo_io *io, uint64_t off, size_t len, const SHA1Context *ctx, uint8_t sha[SHA1HashSize])
+{
+    unsigned char *bufs[HASHER_SLOTS] = { NULL };
+    int threaded = len > HASHER_CHUNK;
+    int nbufs = threaded ? HASHER_SLOTS : 1;
+    size_t bufsz = len < HASHER_CHUNK ? len : HASHER_CHUNK;
+    int ret = -1;
+
+    for(int i = 0; i < nbufs; i++) {
+#ifdef HAVE_POSIX_MEMALIGN
+        if(posix_memalign((void **)&bufs[i], 4096, bufsz ? bufsz : 1))
+            bufs[i] = NULL;
+#else
+        bufs[i] = malloc(bufsz ? bufsz : 1);
+#endif
+        if(!bufs[i])
+            goto cleanup;
+    }
+
+    pbo_io_advise(io, off, len, ADVISE_SEQUENTIAL);
+
+    struct pbo_hasher h;
+    pbo_hasher_start(&h, ctx, threaded);
+
+    size_t left = len;
+    while(left) {
+        size_t n = left < bufsz ? left : bufsz;
+        unsigned char *buf = bufs[pbo_hasher_reserve(&h) % nbufs];
+        if(io->ops->read_at(io->handle, buf, n, off) != n)
+            break;
+        pbo_io_advise(io, off, n, ADVISE_DONTNEED); //It's in buf now
+        pbo_hasher_input(&h, buf, n);
+        off += n;
+        left -= n;
+    }
+    pbo_hasher_result(&h, sha);
+    if(!left)
+        ret = 0;
+
+cleanup:
+    for(int i = 0; i < nbufs; i++)
+        free(bufs[i]);
+    return ret;
+}
@@ -0,0 +1,51 @@
+/* hasher.h - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBpbo_hasher_H
+#define LIBpbo_hasher_H 1
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "sha.h"
+
+#include <libpbo/pbo.h>
+
+#define HASHER_SLOTS 4
+#define HASHER_CHUNK (1 << 20)
+
+/* SHA1 on a dedicated thread. The producer hands over borrowed pointers
+ * which have to stay valid until the slot they went into is free again,
+ * pbo_hasher_reserve() tells which slot that is. Without pthreads or for
+ * small inputs everything is hashed inline. */
+struct pbo_hasher {
+    SHA1Context ctx;
+    struct {
+        const uint8_t *p;
+        size_t n;
+    } slots[HASHER_SLOTS];
+    size_t head; //Slots handed over
+    size_t tail; //Slots hashed
+    int done;
+    int threaded;
+#ifdef HAVE_PTHREAD_H
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+};
+
+void pbo_hasher_start(struct pbo_hasher *h, const SHA1Context *ctx, int threaded);
+size_t pbo_hasher_reserve(struct pbo_hasher *h);
+void pbo_hasher_input(struct pbo_hasher *h, const void *p, size_t n);
+void pbo_hasher_result(struct pbo_hasher *h, uint8_t sha[SHA1HashSize]);
+
+int pbo_hasher_io(const pbo_io *io, uint64_t off, size_t len, const SHA1Context *ctx, uint8_t sha[SHA1HashSize]);
+
+#endif /* LIBpbo_hasher_H */
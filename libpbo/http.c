@@ -0,0 +1,499 @@
+/* http.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+# include <sys/types.h>
+#endif
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+# include <sys/sendfile.h>
+#endif
+
+#include "pbo-private.h"
+
+#define HTTP_MAXHEAD 8192 //Request line and headers
+
+struct http_archive {
+    char *name;
+    pbo_t d;
+};
+
+struct pbo_http {
+    struct http_archive *archives; //Sorted by name
+    size_t len;
+    size_t cap;
+};
+
+struct http_conn {
+    int fd;
+    size_t len; //Received, the current request first
+    char buf[HTTP_MAXHEAD];
+};
+
+struct http_request {
+    int head;
+    int close;
+    const char *range; //Value of the Range header, NULL without one
+    char path[HTTP_MAXHEAD]; //Decoded
+};
+
+pbo_http_t pbo_http_init(void)
+{
+    return calloc(1, sizeof(struct pbo_http));
+}
+
+void pbo_http_dispose(pbo_http_t s)
+{
+    if(!s)
+        return;
+    for(size_t i = 0; i < s->len; i++)
+        free(s->archives[i].name);
+    free(s->archives);
+    free(s);
+}
+
+static int pbo_http_cmp(const void *a, const void *b)
+{
+    return strcmp(((const struct http_archive *)a)->name, ((const struct http_archive *)b)->name);
+}
+
+/* Makes d reachable as /name/... from now on. d has to be read already and
+ * outlive s. Adding a name again replaces the archive. */
+pbo_error pbo_http_add(pbo_http_t s, const char *name, pbo_t d)
+{
+    if(!s || !name || !d)
+        return PBO_ERROR_NEXIST;
+    if(d->state != EXISTING)
+        return PBO_ERROR_STATE;
+    if(!*name || strchr(name, '/'))
+        return PBO_ERROR_STATE; //Couldn't be asked for
+
+    struct http_archive key = { (char *)name, d };
+    struct http_archive *a = s->len ? bsearch(&key, s->archives, s->len, sizeof key, pbo_http_cmp) : NULL;
+    if(a) {
+        a->d = d;
+        return PBO_SUCCESS;
+    }
+
+    if(s->len == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 8;
+        a = realloc(s->archives, cap * sizeof *a);
+        if(!a)
+            return PBO_ERROR_MALLOC;
+        s->archives = a;
+        s->cap = cap;
+    }
+    if(!(key.name = malloc(strlen(name) + 1)))
+        return PBO_ERROR_MALLOC;
+    strcpy(key.name, name);
+
+    size_t i = s->len;
+    while(i && strcmp(s->archives[i - 1].name, name) > 0) {
+        s->archives[i] = s->archives[i - 1];
+        i--;
+    }
+    s->archives[i] = key;
+    s->len++;
+    return PBO_SUCCESS;
+}
+
+static int pbo_http_write(int fd, const void *p, size_t n)
+{
+#ifdef HAVE_UNISTD_H
+    const char *c = p;
+    while(n) {
+        ssize_t w = write(fd, c, n);
+        if(w < 0 && errno == EINTR)
+            continue;
+        if(w <= 0)
+            return -1;
+        c += w;
+        n -= w;
+    }
+    return 0;
+#else
+    (void)fd, (void)p, (void)n;
+    return -1;
+#endif
+}
+
+//Through user space, for archives that aren't files or without sendfile
+static int pbo_http_copy(const pbo_io *io, int fd, uint64_t off, size_t len)
+{
+    unsigned char *buf = malloc(IOBUFSZ);
+    int err = !buf;
+    while(!err && len) {
+        size_t c = len < IOBUFSZ ? len : IOBUFSZ;
+        err = io->ops->read_at(io->handle, buf, c, off) != c || pbo_http_write(fd, buf, c);
+        off += c;
+        len -= c;
+    }
+    free(buf);
+    return err ? -1 : 0;
+}
+
+//Straight from the archive's page cache to the socket where possible
+static int pbo_http_sendfile(const pbo_io *io, int fd, uint64_t off, size_t len)
+{
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+    int in = pbo_io_fileno(io);
+    if(in >= 0) {
+        off_t o = off;
+        while(len) {
+            ssize_t n = sendfile(fd, in, &o, len);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n < 0 && (errno == EINVAL || errno == ENOSYS) && (uint64_t)o == off)
+                break; //Not for this pair of files, nothing sent yet
+            if(n <= 0)
+                return -1;
+            len -= n;
+        }
+        if(!len)
+            return 0;
+    }
+#endif
+    return pbo_http_copy(io, fd, off, len);
+}
+
+/* Reads until a whole request head is in the buffer and returns its length
+ * with the blank line. 0 if the client is done, -1 on errors and heads
+ * that don't fit. */
+static ptrdiff_t pbo_http_recv(struct http_conn *c)
+{
+    size_t scan = 0;
+    for(;;) {
+        for(; scan < c->len; scan++) {
+            if(c->buf[scan] != '\n')
+                continue;
+            if(scan + 1 < c->len && c->buf[scan + 1] == '\n')
+                return scan + 2;
+            if(scan + 2 < c->len && c->buf[scan + 1] == '\r' && c->buf[scan + 2] == '\n')
+                return scan + 3;
+        }
+        scan = c->len > 2 ? c->len - 2 : 0;
+        if(c->len == sizeof c->buf)
+            return -1;
+
+#ifdef HAVE_UNISTD_H
+        ssize_t n = read(c->fd, c->buf + c->len, sizeof c->buf - c->len);
+        if(n < 0 && errno == EINTR)
+            continue;
+#else
+        int n = -1;
+#endif
+        if(n < 0)
+            return -1;
+        if(n == 0)
+            return c->len ? -1 : 0;
+        c->len += n;
+    }
+}
+
+static int pbo_http_lower(int c)
+{
+    return c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c;
+}
+
+//The value of line if it's the header name, with leading blanks skipped
+static const char *pbo_http_header(const char *line, const char *name)
+{
+    for(; *name; line++, name++)
+        if(pbo_http_lower((unsigned char)*line) != *name)
+            return NULL;
+    if(*line++ != ':')
+        return NULL;
+    while(*line == ' ' || *line == '\t')
+        line++;
+    return line;
+}
+
+static int pbo_http_hex(int c)
+{
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    c = pbo_http_lower(c);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+/* Splits the head in c->buf, of len bytes, into r. Lines are terminated
+ * in place. Returns the status to refuse it with, 0 if it's fine. */
+static int pbo_http_parse(struct http_conn *c, size_t len, struct http_request *r)
+{
+    r->head = 0;
+    r->close = 0;
+    r->range = NULL;
+    int ifrange = 0;
+
+    char *line = c->buf, *end = c->buf + len;
+    for(char *p = line; p < end; p++)
+        if(*p == '\r' || *p == '\n')
+            *p = '\0';
+
+    char *fields = line + strlen(line) + 1;
+    char *target = strchr(line, ' ');
+    char *version = target ? strchr(target + 1, ' ') : NULL;
+    if(!version)
+        return 400;
+    *target++ = '\0';
+    *version++ = '\0';
+    if(strncmp(version, "HTTP/1.", 7))
+        return 400;
+    r->close = strcmp(version, "HTTP/1.1") != 0; //1.0 clients get one each
+
+    for(line = fields; line < end; line += strlen(line) + 1) {
+        const char *v;
+        if((v = pbo_http_header(line, "range")))
+            r->range = v;
+        else if(pbo_http_header(line, "if-range"))
+            ifrange = 1;
+        else if((v = pbo_http_header(line, "connection"))) {
+            for(; *v; v++) {
+                size_t k = 0;
+                while(k < 5 && pbo_http_lower((unsigned char)v[k]) == "close"[k])
+                    k++;
+                r->close |= k == 5;
+            }
+        } else if((v = pbo_http_header(line, "content-length"))) {
+            if(strcmp(v, "0"))
+                r->close = 1; //Not reading bodies, nothing after one makes sense
+        } else if(pbo_http_header(line, "transfer-encoding"))
+            r->close = 1;
+    }
+    if(ifrange)
+        r->range = NULL; //No validators to compare, the whole entry is always right
+
+    //Percent decoding, the query is of no interest
+    if(*target != '/')
+        return 400;
+    char *o = r->path;
+    for(const char *p = target; *p && *p != '?' && *p != '#'; p++) {
+        int ch = (unsigned char)*p;
+        if(ch == '%') {
+            int hi = pbo_http_hex((unsigned char)p[1]), lo = hi < 0 ? -1 : pbo_http_hex((unsigned char)p[2]);
+            if(lo < 0 || (hi == 0 && lo == 0))
+                return 400;
+            ch = hi << 4 | lo;
+            p += 2;
+        }
+        *o++ = ch;
+    }
+    *o = '\0';
+
+    if(!strcmp(line = c->buf, "HEAD"))
+        r->head = 1;
+    else if(strcmp(line, "GET"))
+        return 405;
+    return 0;
+}
+
+static int pbo_http_number(const char **p, uint64_t *out)
+{
+    const char *s = *p;
+    uint64_t v = 0;
+    for(; *s >= '0' && *s <= '9'; s++) {
+        if(v > (UINT64_MAX - 9) / 10)
+            return -1;
+        v = v * 10 + (*s - '0');
+    }
+    if(s == *p)
+        return -1;
+    *p = s;
+    *out = v;
+    return 0;
+}
+
+/* Picks [*first, *last] of size bytes out of a Range value. Returns 1 for a
+ * range, 0 to send everything, as for anything but a single byte range,
+ * and -1 if it can't be satisfied. */
+static int pbo_http_range(const char *v, uint64_t size, uint64_t *first, uint64_t *last)
+{
+    if(!v || strncmp(v, "bytes=", 6) || strchr(v, ','))
+        return 0;
+    v += 6;
+
+    uint64_t a, b;
+    if(*v == '-') {
+        v++;
+        if(pbo_http_number(&v, &b) || *v)
+            return 0;
+        if(!b || !size)
+            return -1;
+        *first = b < size ? size - b : 0;
+        *last = size - 1;
+        return 1;
+    }
+    if(pbo_http_number(&v, &a) || *v++ != '-')
+        return 0;
+    if(!*v)
+        b = UINT64_MAX;
+    else if(pbo_http_number(&v, &b) || *v || b < a)
+        return 0;
+    if(a >= size)
+        return -1;
+    *first = a;
+    *last = b < size ? b : size - 1;
+    return 1;
+}
+
+static int pbo_http_status(int fd, int code, int close)
+{
+    const char *reason = code == 400 ? "Bad Request" : code == 404 ? "Not Found" :
+                         code == 405 ? "Method Not Allowed" : code == 431 ? "Request Header Fields Too Large" :
+                         "Internal Server Error";
+    char head[256];
+    int n = snprintf(head, sizeof head, "HTTP/1.1 %d %s\r\nContent-Length: 0\r\n%s%s\r\n", code, reason,
+                     code == 405 ? "Allow: GET, HEAD\r\n" : "", close ? "Connection: close\r\n" : "");
+    return pbo_http_write(fd, head, n);
+}
+
+//Answers the request in r, returns -1 if the connection is no good after it
+static int pbo_http_answer(pbo_http_t s, int fd, struct http_request *r)
+{
+    //First component is the archive, the rest the entry
+    char *name = r->path + 1, *entry = strchr(name, '/');
+    if(!entry)
+        return pbo_http_status(fd, 404, r->close);
+    *entry++ = '\0';
+
+    struct http_archive key = { name, NULL };
+    const struct http_archive *a = s->len ? bsearch(&key, s->archives, s->len, sizeof key, pbo_http_cmp) : NULL;
+    struct list_entry *le = a ? pbo_index_find(a->d, entry) : NULL;
+    if(!le || !*le->data->name)
+        return pbo_http_status(fd, 404, r->close);
+
+    pbo_t d = a->d;
+    const struct pbo_entry *pe = le->data;
+    uint64_t size = pbo_entry_size(pe), first = 0, last = size ? size - 1 : 0;
+    int ranged = pbo_http_range(r->range, size, &first, &last);
+
+    char head[512];
+    int n;
+    if(ranged < 0) {
+        n = snprintf(head, sizeof head, "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%llu\r\n"
+                     "Content-Length: 0\r\n%s\r\n", (unsigned long long)size, r->close ? "Connection: close\r\n" : "");
+        return pbo_http_write(fd, head, n);
+    }
+    uint64_t len = size ? last - first + 1 : 0;
+
+    //LZSS entries are decoded whole before committing to a status, block
+    //packed ones only have their table read and decode the blocks asked for
+    unsigned char *data = NULL;
+    pbo_io io;
+    struct blocks_reader br;
+    int blocks = !r->head && len && pe->properties[PACKING_METHOD] == PBO_PACKING_BLOCKS;
+    if(blocks) {
+        if(pbo_io_begin(d, IO_READ, &io))
+            return pbo_http_status(fd, 500, r->close);
+        if(pbo_blocks_open(&br, &io, d->headersz + pe->file_offset, pe) || !(data = malloc(br.bsize))) {
+            pbo_blocks_close(&br);
+            pbo_io_end(d, &io);
+            return pbo_http_status(fd, 500, r->close);
+        }
+    } else if(!r->head && len && pbo_entry_packed(pe)) {
+        if(!(data = malloc(size)) || pbo_load_entry(d, pe, data)) {
+            free(data);
+            return pbo_http_status(fd, 500, r->close);
+        }
+    }
+
+    n = snprintf(head, sizeof head, "HTTP/1.1 %s\r\nContent-Type: application/octet-stream\r\n"
+                 "Accept-Ranges: bytes\r\nContent-Length: %llu\r\n", ranged ? "206 Partial Content" : "200 OK",
+                 (unsigned long long)len);
+    if(ranged)
+        n += snprintf(head + n, sizeof head - n, "Content-Range: bytes %llu-%llu/%llu\r\n",
+                      (unsigned long long)first, (unsigned long long)last, (unsigned long long)size);
+    n += snprintf(head + n, sizeof head - n, "%s\r\n", r->close ? "Connection: close\r\n" : "");
+
+    int err = pbo_http_write(fd, head, n);
+    if(blocks) {
+        for(uint64_t at = first; !err && at <= last;) {
+            size_t c = last - at + 1 < br.bsize ? last - at + 1 : br.bsize;
+            err = pbo_blocks_get(&br, at, c, data) || pbo_http_write(fd, data, c);
+            at += c;
+        }
+        pbo_blocks_close(&br);
+        pbo_io_end(d, &io);
+    } else if(!err && !r->head && len) {
+        if(data) {
+            err = pbo_http_write(fd, data + first, len);
+        } else {
+            //Stored bytes go out as they are, unchecked, that's the point
+            err = pbo_io_begin(d, IO_READ, &io) ? -1 : 0;
+            if(!err) {
+                err = pbo_http_sendfile(&io, fd, d->headersz + pe->file_offset + first, len);
+                pbo_io_end(d, &io);
+            }
+        }
+    }
+    free(data);
+    return err;
+}
+
+/* Answers requests on the connected fd until the client closes it or asks
+ * to, pipelined ones included. Safe to call on many connections at once.
+ * PBO_ERROR_BROKEN if it gave up on a malformed request, PBO_ERROR_IO if
+ * the connection failed. */
+pbo_error pbo_http_serve(pbo_http_t s, int fd)
+{
+    if(!s)
+        return PBO_ERROR_NEXIST;
+
+    struct http_conn *c = malloc(sizeof *c);
+    struct http_request *r = malloc(sizeof *r);
+    pbo_error ret = PBO_ERROR_MALLOC;
+    if(!c || !r)
+        goto cleanup;
+    c->fd = fd;
+    c->len = 0;
+
+    for(;;) {
+        ptrdiff_t len = pbo_http_recv(c);
+        if(len == 0) {
+            ret = PBO_SUCCESS;
+            break;
+        }
+        if(len < 0) {
+            //A full buffer is a head too long, anything else a dead connection
+            ret = c->len == sizeof c->buf && !pbo_http_status(fd, 431, 1) ? PBO_ERROR_BROKEN : PBO_ERROR_IO;
+            break;
+        }
+
+        int status = pbo_http_parse(c, len, r);
+        if(status) {
+            r->close |= status == 400;
+            if(pbo_http_status(fd, status, r->close)) {
+                ret = PBO_ERROR_IO;
+                break;
+            }
+        } else if(pbo_http_answer(s, fd, r)) {
+            ret = PBO_ERROR_IO;
+            break;
+        }
+        if(r->close) {
+            ret = status == 400 ? PBO_ERROR_BROKEN : PBO_SUCCESS;
+            break;
+        }
+
+        //Pipelined requests that came along with this one
+        c->len -= len;
+        memmove(c->buf, c->buf + len, c->len);
+    }
+
+cleanup:
+    free(c);
+    free(r);
+    return ret;
+}
@@ -0,0 +1,363 @@
+/* index.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pbo-private.h"
+
+enum {
+    QUERY_PREFIX = 0,
+    QUERY_DIR,
+    QUERY_GLOB,
+    QUERY_GLOB_SUFFIX,
+};
+
+static size_t pbo_index_lower(const struct name_index *idx, size_t lo, size_t hi, const char *p, size_t len);
+static size_t pbo_index_upper(const struct name_index *idx, size_t lo, size_t hi, const char *p, size_t len);
+static size_t pbo_index_rbound(const struct name_index *idx, const char *t, size_t len, int upper);
+
+static int pbo_index_cmp(const void *a, const void *b)
+{
+    const struct index_entry *x = a, *y = b;
+    int r = strcmp(x->key, y->key);
+    if(r)
+        return r;
+    return x->ord < y->ord ? -1 : x->ord > y->ord;
+}
+
+//Compares from the end so equal suffixes end up next to each other
+static int pbo_index_rcmp(const void *a, const void *b)
+{
+    const struct index_entry *x = *(const struct index_entry **)a;
+    const struct index_entry *y = *(const struct index_entry **)b;
+
+    size_t i = x->keylen, j = y->keylen;
+    while(i && j) {
+        unsigned char c1 = x->key[--i], c2 = y->key[--j];
+        if(c1 != c2)
+            return c1 < c2 ? -1 : 1;
+    }
+    if(i != j)
+        return i ? 1 : -1;
+    return x->ord < y->ord ? -1 : x->ord > y->ord;
+}
+
+pbo_error pbo_index_build(pbo_t d)
+{
+    pbo_index_free(d);
+
+    size_t n = 0, keysz = 0;
+    for(struct list_entry *e = d->root; e; e = e->next) {
+        if(*e->data->name == '\0')
+            continue;
+        n++;
+        keysz += strlen(e->data->name) + 1;
+    }
+
+    struct name_index *idx = malloc(sizeof *idx);
+    if(!idx)
+        return PBO_ERROR_MALLOC;
+
+    idx->len = n;
+    idx->byname = malloc((n ? n : 1) * sizeof *idx->byname);
+    idx->bysuffix = malloc((n ? n : 1) * sizeof *idx->bysuffix);
+    idx->keys = malloc(keysz ? keysz : 1);
+    if(!idx->byname || !idx->bysuffix || !idx->keys) {
+        free(idx->byname);
+        free(idx->bysuffix);
+        free(idx->keys);
+        free(idx);
+        return PBO_ERROR_MALLOC;
+    }
+
+    char *k = idx->keys;
+    size_t i = 0;
+    for(struct list_entry *e = d->root; e; e = e->next) {
+        if(*e->data->name == '\0')
+            continue;
+        struct index_entry *ie = &idx->byname[i];
+        ie->key = k;
+        ie->keylen = pbo_util_normalize(k, e->data->name, keysz - (k - idx->keys));
+        ie->ord = i++;
+        ie->le = e;
+        k += ie->keylen + 1;
+    }
+    qsort(idx->byname, n, sizeof *idx->byname, pbo_index_cmp);
+
+    for(i = 0; i < n; i++)
+        idx->bysuffix[i] = &idx->byname[i];
+    qsort(idx->bysuffix, n, sizeof *idx->bysuffix, pbo_index_rcmp);
+
+    d->index = idx;
+    return PBO_SUCCESS;
+}
+
+void pbo_index_free(pbo_t d)
+{
+    if(!d->index)
+        return;
+
+    free(d->index->byname);
+    free(d->index->bysuffix);
+    free(d->index->keys);
+    free(d->index);
+    d->index = NULL;
+}
+
+/* Without an index, as in edit sessions, the list is scanned. Names are
+ * matched alike either way, so they resolve the same in every state. */
+struct list_entry *pbo_index_find(pbo_t d, const char *name)
+{
+    if(!d->index) {
+        for(struct list_entry *e = d->root; e; e = e->next)
+            if(*e->data->name && pbo_util_name_eq(e->data->name, name))
+                return e;
+        return NULL;
+    }
+
+    char key[MAXNAMELEN + 1];
+    size_t len = pbo_util_normalize(key, name, sizeof key);
+    if(len == MAXNAMELEN)
+        return NULL; //Longer than any name in the header
+
+    const struct name_index *idx = d->index;
+    size_t i = pbo_index_lower(idx, 0, idx->len, key, len + 1);
+    if(i < idx->len && !strcmp(idx->byname[i].key, key))
+        return idx->byname[i].le;
+    return NULL;
+}
+
+static pbo_error pbo_query_init(pbo_t d, pbo_query *q, int mode, const char *pattern)
+{
+    if(!d || !q || !pattern)
+        return PBO_ERROR_NEXIST;
+    if(d->state != EXISTING || !d->index)
+        return PBO_ERROR_STATE;
+
+    //Leave room for the separator appended to directories
+    size_t len = pbo_util_normalize(q->pattern, pattern, sizeof q->pattern - 1);
+    if(len == sizeof q->pattern - 2)
+        return PBO_ERROR_NEXIST;
+
+    //Directories are always looked up with the trailing separator
+    if(mode == QUERY_DIR && len && q->pattern[len - 1] != '\\') {
+        q->pattern[len++] = '\\';
+        q->pattern[len] = '\0';
+    }
+
+    q->index = d->index;
+    q->mode = mode;
+    q->headersz = d->headersz;
+    q->pos = 0;
+    q->end = d->index->len;
+    return PBO_SUCCESS;
+}
+
+pbo_error pbo_query_prefix(pbo_t d, const char *prefix, pbo_query *q)
+{
+    pbo_error ret = pbo_query_init(d, q, QUERY_PREFIX, prefix);
+    if(ret)
+        return ret;
+
+    size_t len = strlen(q->pattern);
+    q->pos = pbo_index_lower(d->index, 0, d->index->len, q->pattern, len);
+    q->end = pbo_index_upper(d->index, q->pos, d->index->len, q->pattern, len);
+    return PBO_SUCCESS;
+}
+
+pbo_error pbo_query_dir(pbo_t d, const char *dir, pbo_query *q)
+{
+    pbo_error ret = pbo_query_init(d, q, QUERY_DIR, dir);
+    if(ret)
+        return ret;
+
+    size_t len = strlen(q->pattern);
+    q->pos = pbo_index_lower(d->index, 0, d->index->len, q->pattern, len);
+    q->end = pbo_index_upper(d->index, q->pos, d->index->len, q->pattern, len);
+    return PBO_SUCCESS;
+}
+
+/* Only names sharing the literal head or tail of the pattern are looked
+ * at, whichever is longer narrows the range more. */
+pbo_error pbo_query_glob(pbo_t d, const char *pattern, pbo_query *q)
+{
+    pbo_error ret = pbo_query_init(d, q, QUERY_GLOB, pattern);
+    if(ret)
+        return ret;
+
+    const char *p = q->pattern;
+    size_t len = strlen(p);
+    size_t head = strcspn(p, "*?");
+    size_t tail = 0;
+    while(tail < len - head && p[len - tail - 1] != '*' && p[len - tail - 1] != '?')
+        tail++;
+
+    const struct name_index *idx = d->index;
+    if(head >= tail) {
+        q->pos = pbo_index_lower(idx, 0, idx->len, p, head);
+        q->end = pbo_index_upper(idx, q->pos, idx->len, p, head);
+        return PBO_SUCCESS;
+    }
+
+    const char *t = p + len - tail;
+    q->mode = QUERY_GLOB_SUFFIX;
+    q->pos = pbo_index_rbound(idx, t, tail, 0);
+    q->end = pbo_index_rbound(idx, t, tail, 1);
+    return PBO_SUCCESS;
+}
+
+const pbo_file_info *pbo_query_next(pbo_query *q)
+{
+    if(!q || !q->index)
+        return NULL;
+
+    const struct name_index *idx = q->index;
+    while(q->pos < q->end) {
+        const struct index_entry *ie = q->mode == QUERY_GLOB_SUFFIX ? idx->bysuffix[q->pos] : &idx->byname[q->pos];
+
+        if(q->mode == QUERY_DIR) {
+            size_t plen = strlen(q->pattern);
+            const char *sep = strchr(ie->key + plen, '\\');
+            if(sep) {
+                //Report the subdirectory once and skip everything below it
+                size_t len = sep - ie->key + 1;
+                memcpy(q->path, ie->key, len);
+                q->path[len] = '\0';
+                q->pos = pbo_index_upper(idx, q->pos, q->end, q->path, len);
+
+                q->info.name = q->path;
+                q->info.packing_method = 0;
+                q->info.original_size = 0;
+                q->info.timestamp = 0;
+                q->info.size = 0;
+                q->info.offset = 0;
+                return &q->info;
+            }
+        }
+
+        q->pos++;
+        if((q->mode == QUERY_GLOB || q->mode == QUERY_GLOB_SUFFIX) && !pbo_util_glob(q->pattern, ie->key))
+            continue;
+
+        pbo_fill_info(ie->le->data, q->headersz, &q->info);
+        return &q->info;
+    }
+    return NULL;
+}
+
+static char pbo_util_fold(char c)
+{
+    if(c == '/')
+        return '\\';
+    if(c >= 'A' && c <= 'Z')
+        return c + ('a' - 'A');
+    return c;
+}
+
+size_t pbo_util_normalize(char *dst, const char *src, size_t dstsz)
+{
+    while(*src == '\\' || *src == '/')
+        src++;
+
+    size_t i = 0;
+    for(; src[i] && i < dstsz - 1; i++)
+        dst[i] = pbo_util_fold(src[i]);
+    dst[i] = '\0';
+    return i;
+}
+
+//Whether a and b name the same file, as pbo_util_normalize sees them
+int pbo_util_name_eq(const char *a, const char *b)
+{
+    while(*a == '\\' || *a == '/')
+        a++;
+    while(*b == '\\' || *b == '/')
+        b++;
+    for(; *a || *b; a++, b++)
+        if(pbo_util_fold(*a) != pbo_util_fold(*b))
+            return 0;
+    return 1;
+}
+
+//First key that doesn't sort before the first len bytes of p
+static size_t pbo_index_lower(const struct name_index *idx, size_t lo, size_t hi, const char *p, size_t len)
+{
+    while(lo < hi) {
+        size_t m = lo + (hi - lo) / 2;
+        if(strncmp(idx->byname[m].key, p, len) < 0)
+            lo = m + 1;
+        else
+            hi = m;
+    }
+    return lo;
+}
+
+//First key that sorts after everything starting with the first len bytes of p
+static size_t pbo_index_upper(const struct name_index *idx, size_t lo, size_t hi, const char *p, size_t len)
+{
+    while(lo < hi) {
+        size_t m = lo + (hi - lo) / 2;
+        if(strncmp(idx->byname[m].key, p, len) <= 0)
+            lo = m + 1;
+        else
+            hi = m;
+    }
+    return lo;
+}
+
+//Same as above on the suffix order, for keys ending in the len bytes at t
+static size_t pbo_index_rbound(const struct name_index *idx, const char *t, size_t len, int upper)
+{
+    size_t lo = 0, hi = idx->len;
+    while(lo < hi) {
+        size_t m = lo + (hi - lo) / 2;
+        const struct index_entry *ie = idx->bysuffix[m];
+
+        size_t i = ie->keylen, j = len;
+        int r = 0;
+        while(i && j && !r) {
+            unsigned char c1 = ie->key[--i], c2 = t[--j];
+            r = c1 < c2 ? -1 : c1 > c2;
+        }
+        if(!r && j)
+            r = -1; //Key is shorter than the tail
+
+        if(r < 0 || (upper && !r))
+            lo = m + 1;
+        else
+            hi = m;
+    }
+    return lo;
+}
+
+int pbo_util_glob(const char *p, const char *s)
+{
+    const char *star = NULL, *back = NULL;
+
+    while(*s) {
+        if(*p == '*') {
+            star = p++;
+            back = s;
+        } else if(*p == '?' || *p == *s) {
+            p++;
+            s++;
+        } else if(star) {
+            p = star + 1;
+            s = ++back;
+        } else {
+            return 0;
+        }
+    }
+    while(*p == '*')
+        p++;
+    return !*p;
+}
@@ -0,0 +1,631 @@
+/* io.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#include "pbo-private.h"
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+#ifdef HAVE_UNISTD_H
+static size_t pbo_io_fd_read_at(void *handle, void *buf, size_t size, uint64_t offset)
+{
+    struct io_fd *h = handle;
+    size_t done = 0;
+    while(done < size) {
+        ssize_t n = pread(h->fd, (char *)buf + done, size - done, offset + done);
+        if(n <= 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+static size_t pbo_io_fd_write_at(void *handle, const void *buf, size_t size, uint64_t offset)
+{
+    struct io_fd *h = handle;
+    size_t done = 0;
+    while(done < size) {
+        ssize_t n = pwrite(h->fd, (const char *)buf + done, size - done, offset + done);
+        if(n <= 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+static int pbo_io_fd_size(void *handle, uint64_t *size)
+{
+    struct io_fd *h = handle;
+    struct stat st;
+    if(fstat(h->fd, &st))
+        return -1;
+    *size = st.st_size;
+    return 0;
+}
+
+static int pbo_io_fd_truncate(void *handle, uint64_t size)
+{
+    struct io_fd *h = handle;
+    return ftruncate(h->fd, size);
+}
+
+static void pbo_io_fd_close(void *handle)
+{
+    struct io_fd *h = handle;
+    if(h->owned)
+        close(h->fd);
+    if(h->heap)
+        free(h);
+}
+
+static const pbo_io_ops pbo_io_fd_ops = {
+    pbo_io_fd_read_at,
+    pbo_io_fd_write_at,
+    pbo_io_fd_size,
+    pbo_io_fd_truncate,
+    pbo_io_fd_close,
+};
+#endif
+
+pbo_error pbo_io_fd(pbo_io *io, int fd)
+{
+    if(!io || fd < 0)
+        return PBO_ERROR_NEXIST;
+
+#ifdef HAVE_UNISTD_H
+    struct io_fd *h = malloc(sizeof *h);
+    if(!h)
+        return PBO_ERROR_MALLOC;
+
+    h->fd = fd;
+    h->owned = 0;
+    h->heap = 1;
+    io->ops = &pbo_io_fd_ops;
+    io->handle = h;
+    return PBO_SUCCESS;
+#else
+    return PBO_ERROR_IO;
+#endif
+}
+
+/* Plain memory. A view over caller data is read only, a buffer grows as
+ * it is written and belongs to the io. */
+struct io_mem {
+    unsigned char *data;
+    size_t size;
+    size_t cap;
+    int writable;
+};
+
+static size_t pbo_io_mem_read_at(void *handle, void *buf, size_t size, uint64_t offset)
+{
+    struct io_mem *h = handle;
+    if(offset >= h->size)
+        return 0;
+    if(size > h->size - offset)
+        size = h->size - offset;
+    memcpy(buf, h->data + offset, size);
+    return size;
+}
+
+static int pbo_io_mem_reserve(struct io_mem *h, size_t size)
+{
+    if(size <= h->cap)
+        return 0;
+
+    size_t cap = h->cap ? h->cap : 4096;
+    while(cap < size)
+        cap *= 2;
+    unsigned char *new = realloc(h->data, cap);
+    if(!new)
+        return -1;
+    h->data = new;
+    h->cap = cap;
+    return 0;
+}
+
+static size_t pbo_io_mem_write_at(void *handle, const void *buf, size_t size, uint64_t offset)
+{
+    struct io_mem *h = handle;
+    if(!h->writable || pbo_io_mem_reserve(h, offset + size))
+        return 0;
+
+    if(offset > h->size)
+        memset(h->data + h->size, 0, offset - h->size);
+    memcpy(h->data + offset, buf, size);
+    if(offset + size > h->size)
+        h->size = offset + size;
+    return size;
+}
+
+static int pbo_io_mem_size(void *handle, uint64_t *size)
+{
+    struct io_mem *h = handle;
+    *size = h->size;
+    return 0;
+}
+
+static int pbo_io_mem_truncate(void *handle, uint64_t size)
+{
+    struct io_mem *h = handle;
+    if(!h->writable || pbo_io_mem_reserve(h, size))
+        return -1;
+    if(size > h->size)
+        memset(h->data + h->size, 0, size - h->size);
+    h->size = size;
+    return 0;
+}
+
+static void pbo_io_mem_close(void *handle)
+{
+    struct io_mem *h = handle;
+    if(h->writable)
+        free(h->data);
+    free(h);
+}
+
+static const pbo_io_ops pbo_io_mem_ops = {
+    pbo_io_mem_read_at,
+    pbo_io_mem_write_at,
+    pbo_io_mem_size,
+    pbo_io_mem_truncate,
+    pbo_io_mem_close,
+};
+
+pbo_error pbo_io_memory(pbo_io *io, const void *data, size_t size)
+{
+    if(!io || (!data && size))
+        return PBO_ERROR_NEXIST;
+
+    struct io_mem *h = malloc(sizeof *h);
+    if(!h)
+        return PBO_ERROR_MALLOC;
+
+    h->data = (unsigned char *)data; //Never written, writable is 0
+    h->size = size;
+    h->cap = size;
+    h->writable = 0;
+    io->ops = &pbo_io_mem_ops;
+    io->handle = h;
+    return PBO_SUCCESS;
+}
+
+pbo_error pbo_io_buffer(pbo_io *io, size_t reserve)
+{
+    if(!io)
+        return PBO_ERROR_NEXIST;
+
+    struct io_mem *h = malloc(sizeof *h);
+    if(!h)
+        return PBO_ERROR_MALLOC;
+
+    h->data = NULL;
+    h->size = 0;
+    h->cap = 0;
+    h->writable = 1;
+    if(pbo_io_mem_reserve(h, reserve)) {
+        free(h);
+        return PBO_ERROR_MALLOC;
+    }
+    io->ops = &pbo_io_mem_ops;
+    io->handle = h;
+    return PBO_SUCCESS;
+}
+
+const void *pbo_io_buffer_data(const pbo_io *io, size_t *size)
+{
+    if(!io || io->ops != &pbo_io_mem_ops)
+        return NULL;
+
+    const struct io_mem *h = io->handle;
+    if(size)
+        *size = h->size;
+    return h->data;
+}
+
+void pbo_io_close(pbo_io *io)
+{
+    if(!io || !io->ops)
+        return;
+    if(io->ops->close)
+        io->ops->close(io->handle);
+    io->ops = NULL;
+    io->handle = NULL;
+}
+
+#ifndef HAVE_UNISTD_H
+/* stdio stand-in for the fd backend where there's no pread */
+static size_t pbo_io_stdio_read_at(void *handle, void *buf, size_t size, uint64_t offset)
+{
+    if(fseek(handle, offset, SEEK_SET))
+        return 0;
+    return fread(buf, 1, size, handle);
+}
+
+static size_t pbo_io_stdio_write_at(void *handle, const void *buf, size_t size, uint64_t offset)
+{
+    if(fseek(handle, offset, SEEK_SET))
+        return 0;
+    return fwrite(buf, 1, size, handle);
+}
+
+static int pbo_io_stdio_size(void *handle, uint64_t *size)
+{
+    if(fseek(handle, 0, SEEK_END))
+        return -1;
+    *size = ftell(handle);
+    return 0;
+}
+
+static void pbo_io_stdio_close(void *handle)
+{
+    fclose(handle);
+}
+
+static const pbo_io_ops pbo_io_stdio_ops = {
+    pbo_io_stdio_read_at,
+    pbo_io_stdio_write_at,
+    pbo_io_stdio_size,
+    NULL,
+    pbo_io_stdio_close,
+};
+#endif
+
+pbo_error pbo_io_open_path(pbo_io *io, const char *path, int mode)
+{
+#ifdef HAVE_UNISTD_H
+    int flags = O_BINARY;
+    if(mode == IO_READ)
+        flags |= O_RDONLY;
+    else if(mode == IO_CREATE)
+        flags |= O_WRONLY | O_CREAT | O_TRUNC;
+    else
+        flags |= O_RDWR;
+
+    int fd = open(path, flags, 0644);
+    if(fd < 0)
+        return PBO_ERROR_IO;
+
+    pbo_error ret = pbo_io_fd(io, fd);
+    if(ret) {
+        close(fd);
+        return ret;
+    }
+    ((struct io_fd *)io->handle)->owned = 1;
+    return PBO_SUCCESS;
+#else
+    FILE *file = fopen(path, mode == IO_READ ? "rb" : mode == IO_CREATE ? "wb" : "r+b");
+    if(!file)
+        return PBO_ERROR_IO;
+    io->ops = &pbo_io_stdio_ops;
+    io->handle = file;
+    return PBO_SUCCESS;
+#endif
+}
+
+/* Opens path for reading with the handle in h, for callers that want to
+ * stay off the heap. pbo_io_close still closes it. */
+pbo_error pbo_io_open_into(pbo_io *io, struct io_fd *h, const char *path)
+{
+#ifdef HAVE_UNISTD_H
+    h->fd = open(path, O_RDONLY | O_BINARY);
+    if(h->fd < 0)
+        return PBO_ERROR_IO;
+    h->owned = 1;
+    h->heap = 0;
+    io->ops = &pbo_io_fd_ops;
+    io->handle = h;
+    return PBO_SUCCESS;
+#else
+    (void)h;
+    return pbo_io_open_path(io, path, IO_READ);
+#endif
+}
+
+int pbo_io_fileno(const pbo_io *io)
+{
+#ifdef HAVE_UNISTD_H
+    if(io && io->ops == &pbo_io_fd_ops)
+        return ((const struct io_fd *)io->handle)->fd;
+#else
+    (void)io;
+#endif
+    return -1;
+}
+
+/* Tells the kernel what a pass over [off, off + len) is going to do, files
+ * by fadvise and memory views by madvise. Memory is never dropped, it
+ * belongs to the caller. Backends it can't see through are left alone. */
+void pbo_io_advise(const pbo_io *io, uint64_t off, uint64_t len, int advice)
+{
+    if(!len)
+        return;
+
+#if defined(HAVE_POSIX_FADVISE) && defined(HAVE_FCNTL_H)
+    int fd = pbo_io_fileno(io);
+    if(fd >= 0) {
+        posix_fadvise(fd, off, len, advice == ADVISE_SEQUENTIAL ? POSIX_FADV_SEQUENTIAL :
+                                    advice == ADVISE_WILLNEED ? POSIX_FADV_WILLNEED : POSIX_FADV_DONTNEED);
+        return;
+    }
+#endif
+#if defined(HAVE_MADVISE) && defined(HAVE_SYS_MMAN_H) && defined(HAVE_UNISTD_H)
+    if(io->ops == &pbo_io_mem_ops && advice != ADVISE_DONTNEED) {
+        const struct io_mem *h = io->handle;
+        if(off >= h->size)
+            return;
+        if(len > h->size - off)
+            len = h->size - off;
+
+        //madvise wants whole pages, round out to them
+        uintptr_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t start = (uintptr_t)(h->data + off) & ~(page - 1);
+        uintptr_t end = (uintptr_t)(h->data + off) + len;
+        madvise((void *)start, end - start, advice == ADVISE_SEQUENTIAL ? MADV_SEQUENTIAL : MADV_WILLNEED);
+    }
+#endif
+    (void)io, (void)off, (void)advice;
+}
+
+/* Read handles of all archives, most recently used first. Handles in use
+ * by a call are never closed from under it, the cap may be overshot for
+ * as long as they are. */
+static struct {
+    pbo_t head;
+    pbo_t tail;
+    size_t open;
+    size_t max; //0 for no limit
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock;
+#endif
+} pbo_fds = {
+    NULL, NULL, 0, 0,
+#ifdef HAVE_PTHREAD_H
+    PTHREAD_MUTEX_INITIALIZER,
+#endif
+};
+
+static void pbo_fds_lock(void)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&pbo_fds.lock);
+#endif
+}
+
+static void pbo_fds_unlock(void)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&pbo_fds.lock);
+#endif
+}
+
+static void pbo_fds_unlink(pbo_t d)
+{
+    if(d->fd_prev)
+        d->fd_prev->fd_next = d->fd_next;
+    else
+        pbo_fds.head = d->fd_next;
+    if(d->fd_next)
+        d->fd_next->fd_prev = d->fd_prev;
+    else
+        pbo_fds.tail = d->fd_prev;
+    d->fd_prev = d->fd_next = NULL;
+}
+
+static void pbo_fds_push(pbo_t d)
+{
+    d->fd_prev = NULL;
+    d->fd_next = pbo_fds.head;
+    if(pbo_fds.head)
+        pbo_fds.head->fd_prev = d;
+    else
+        pbo_fds.tail = d;
+    pbo_fds.head = d;
+}
+
+//Called with the lock held
+static void pbo_fds_drop(pbo_t d)
+{
+    pbo_fds_unlink(d);
+    pbo_io_close(&d->fd);
+    pbo_fds.open--;
+}
+
+static void pbo_fds_trim(void)
+{
+    for(pbo_t d = pbo_fds.tail; d && pbo_fds.max && pbo_fds.open > pbo_fds.max;) {
+        pbo_t prev = d->fd_prev;
+        if(!d->fd_users)
+            pbo_fds_drop(d);
+        d = prev;
+    }
+}
+
+void pbo_set_max_open_files(size_t max)
+{
+    pbo_fds_lock();
+    pbo_fds.max = max;
+    pbo_fds_trim();
+    pbo_fds_unlock();
+}
+
+//Closes the read handle d keeps between calls, if any
+void pbo_io_release(pbo_t d)
+{
+    pbo_fds_lock();
+    if(d->fd.ops)
+        pbo_fds_drop(d);
+    d->fd_users = 0;
+    pbo_fds_unlock();
+}
+
+/* Archives with an io attached use it, the others open their filename.
+ * Read handles stay open between calls until the archive is cleared or
+ * the cap evicts them, everything else is opened per call. */
+pbo_error pbo_io_begin(pbo_t d, int mode, pbo_io *io)
+{
+    if(d->io.ops) {
+        *io = d->io;
+        return PBO_SUCCESS;
+    }
+    if(!d->filename)
+        return PBO_ERROR_NEXIST;
+    if(mode != IO_READ) {
+        pbo_io_release(d); //Don't keep reading through a stale handle
+        return pbo_io_open_path(io, d->filename, mode);
+    }
+
+    pbo_fds_lock();
+    if(!d->fd.ops) {
+        //Open without the lock, a racing call on d may beat us to it
+        pbo_fds_unlock();
+        pbo_io fresh;
+        if(pbo_io_open_path(&fresh, d->filename, IO_READ))
+            return PBO_ERROR_IO;
+        pbo_fds_lock();
+        if(d->fd.ops)
+            pbo_io_close(&fresh);
+        else {
+            d->fd = fresh;
+            pbo_fds.open++;
+            pbo_fds_push(d);
+        }
+    } else if(pbo_fds.head != d) {
+        pbo_fds_unlink(d);
+        pbo_fds_push(d);
+    }
+    d->fd_users++;
+    *io = d->fd;
+    pbo_fds_trim();
+    pbo_fds_unlock();
+    return PBO_SUCCESS;
+}
+
+void pbo_io_end(pbo_t d, pbo_io *io)
+{
+    if(io->handle == d->io.handle)
+        return;
+
+    pbo_fds_lock();
+    int cached = io->handle == d->fd.handle;
+    if(cached)
+        d->fd_users--;
+    pbo_fds_unlock();
+    if(!cached)
+        pbo_io_close(io);
+}
+
+void pbo_reader_init(struct io_reader *r, const pbo_io *io, uint64_t pos)
+{
+    r->io = io;
+    r->pos = pos;
+    r->len = 0;
+    r->at = 0;
+}
+
+int pbo_reader_getc(struct io_reader *r)
+{
+    if(r->at == r->len) {
+        r->len = r->io->ops->read_at(r->io->handle, r->buf, sizeof r->buf, r->pos);
+        r->pos += r->len;
+        r->at = 0;
+        if(!r->len)
+            return EOF;
+    }
+    return r->buf[r->at++];
+}
+
+size_t pbo_reader_read(struct io_reader *r, void *dst, size_t n)
+{
+    size_t done = 0;
+    while(done < n) {
+        if(r->at == r->len) {
+            int c = pbo_reader_getc(r);
+            if(c == EOF)
+                break;
+            r->at--;
+        }
+        size_t c = r->len - r->at < n - done ? r->len - r->at : n - done;
+        memcpy((char *)dst + done, r->buf + r->at, c);
+        r->at += c;
+        done += c;
+    }
+    return done;
+}
+
+uint64_t pbo_reader_tell(const struct io_reader *r)
+{
+    return r->pos - (r->len - r->at);
+}
+
+void pbo_writer_init(struct io_writer *w, const pbo_io *io, uint64_t pos)
+{
+    w->io = io;
+    w->direct = NULL;
+    w->pos = pos;
+    w->fill = 0;
+    w->err = 0;
+}
+
+//A direct writer keeps its own chunks, those only go out on pbo_direct_close
+int pbo_writer_flush(struct io_writer *w)
+{
+    if(w->direct)
+        return w->err ? -1 : 0;
+    if(w->fill && w->io->ops->write_at(w->io->handle, w->buf, w->fill, w->pos) != w->fill)
+        w->err = 1;
+    w->pos += w->fill;
+    w->fill = 0;
+    return w->err ? -1 : 0;
+}
+
+void pbo_writer_write(struct io_writer *w, const void *p, size_t n)
+{
+    if(w->direct) {
+        pbo_direct_write(w->direct, p, n);
+        w->pos += n;
+        return;
+    }
+    if(w->fill + n <= sizeof w->buf) {
+        memcpy(w->buf + w->fill, p, n);
+        w->fill += n;
+        return;
+    }
+
+    //Anything big goes straight through
+    pbo_writer_flush(w);
+    if(n >= sizeof w->buf) {
+        if(w->io->ops->write_at(w->io->handle, p, n, w->pos) != n)
+            w->err = 1;
+        w->pos += n;
+        return;
+    }
+    memcpy(w->buf, p, n);
+    w->fill = n;
+}
@@ -0,0 +1,373 @@
+/* lookup.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#include "sha.h"
+#include "pbo-private.h"
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+#define LOOKUP_MAGIC "PBOL"
+#define LOOKUP_VERSION 1
+
+/* A lookup file is this header, count records sorted by hash and then by
+ * name, and the names they point into, NUL terminated. Everything is in
+ * host order, like the archive header, and used in place. */
+struct lookup_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t names_size;
+    uint64_t archive_size; //To tell a stale lookup file from a good one
+    uint8_t sha1[SHA1HashSize]; //Archive's trailing hash, zero if it has none
+    uint32_t reserved;
+};
+
+struct lookup_record {
+    uint32_t hash; //Of the normalised name
+    uint32_t name; //Offset into the names
+    uint64_t offset; //Of the data, from the start of the archive
+    uint32_t size;
+    uint32_t original_size;
+    uint32_t packing_method;
+    uint32_t timestamp;
+};
+
+struct pbo_lookup {
+    const unsigned char *base;
+    size_t size;
+    int mapped;
+    const struct lookup_header *hdr;
+    const struct lookup_record *recs;
+    const char *names;
+};
+
+static uint32_t pbo_lookup_hash(const char *key)
+{
+    uint32_t h = 2166136261u;
+    while(*key)
+        h = (h ^ (unsigned char)*key++) * 16777619u;
+    return h;
+}
+
+struct lookup_build {
+    struct lookup_record rec;
+    const char *key;
+    size_t ord;
+};
+
+static int pbo_lookup_cmp(const void *a, const void *b)
+{
+    const struct lookup_build *x = a, *y = b;
+    if(x->rec.hash != y->rec.hash)
+        return x->rec.hash < y->rec.hash ? -1 : 1;
+    int r = strcmp(x->key, y->key);
+    if(r)
+        return r;
+    return x->ord < y->ord ? -1 : x->ord > y->ord; //First of equal names wins
+}
+
+static uint64_t pbo_lookup_datastart(pbo_t d)
+{
+    return d->state == EXISTING ? d->headersz : pbo_header_size(d);
+}
+
+//Size and trailing hash of the archive d was read from or written to
+static pbo_error pbo_lookup_archive(pbo_t d, struct lookup_header *hdr)
+{
+    pbo_io io;
+    if(pbo_io_begin(d, IO_READ, &io))
+        return PBO_ERROR_IO;
+
+    pbo_error ret = PBO_ERROR_IO;
+    unsigned char trailer[1 + SHA1HashSize];
+    if(io.ops->size(io.handle, &hdr->archive_size))
+        goto cleanup;
+
+    uint64_t end = pbo_lookup_datastart(d);
+    for(struct list_entry *e = d->root; e; e = e->next)
+        end += e->data->properties[DATA_SIZE];
+    if(hdr->archive_size == end + sizeof trailer) {
+        if(io.ops->read_at(io.handle, trailer, sizeof trailer, end) != sizeof trailer)
+            goto cleanup;
+        memcpy(hdr->sha1, trailer + 1, SHA1HashSize);
+    } else if(hdr->archive_size != end) {
+        ret = PBO_ERROR_BROKEN; //The file isn't what d describes
+        goto cleanup;
+    }
+    ret = PBO_SUCCESS;
+
+cleanup:
+    pbo_io_end(d, &io);
+    return ret;
+}
+
+/* Writes a lookup file for d to path, for archives read or just written.
+ * It's put in place like an archive, batched along with it if d has a
+ * batch. The archive itself isn't touched. */
+pbo_error pbo_write_lookup(pbo_t d, const char *path)
+{
+    if(!d || !path)
+        return PBO_ERROR_NEXIST;
+    if(d->state != EXISTING && d->state != NEW)
+        return PBO_ERROR_STATE;
+    if(!d->last || d->last == d->root || *d->last->data->name != '\0')
+        return PBO_ERROR_STATE; //Not written yet
+
+    struct lookup_header hdr;
+    memset(&hdr, 0, sizeof hdr);
+    memcpy(hdr.magic, LOOKUP_MAGIC, 4);
+    hdr.version = LOOKUP_VERSION;
+    pbo_error ret = pbo_lookup_archive(d, &hdr);
+    if(ret)
+        return ret;
+
+    size_t n = 0, namesz = 0;
+    for(struct list_entry *e = d->root; e; e = e->next) {
+        if(*e->data->name == '\0')
+            continue;
+        n++;
+        namesz += strlen(e->data->name) + 1;
+    }
+    if(n > UINT32_MAX || namesz > UINT32_MAX)
+        return PBO_ERROR_STATE;
+
+    struct lookup_build *v = malloc((n ? n : 1) * sizeof *v);
+    char *keys = malloc(namesz ? namesz : 1);
+    char *names = malloc(namesz ? namesz : 1);
+    struct io_writer *file = malloc(sizeof *file);
+    char *tmp = NULL;
+    ret = PBO_ERROR_MALLOC;
+    if(!v || !keys || !names || !file)
+        goto cleanup;
+
+    //Data follows the header in list order
+    uint64_t off = pbo_lookup_datastart(d);
+    size_t i = 0, k = 0;
+    for(struct list_entry *e = d->root; e; e = e->next) {
+        const struct pbo_entry *pe = e->data;
+        if(*pe->name == '\0')
+            continue;
+        size_t len = strlen(pe->name) + 1;
+        memcpy(names + k, pe->name, len);
+        pbo_util_normalize(keys + k, pe->name, len);
+
+        struct lookup_build *b = &v[i];
+        b->key = keys + k;
+        b->ord = i++;
+        b->rec.hash = pbo_lookup_hash(b->key);
+        b->rec.name = k;
+        b->rec.offset = off;
+        b->rec.size = pe->properties[DATA_SIZE];
+        b->rec.original_size = pe->properties[ORIGINAL_SIZE];
+        b->rec.packing_method = pe->properties[PACKING_METHOD];
+        b->rec.timestamp = pe->properties[TIME_STAMP];
+        off += pe->properties[DATA_SIZE];
+        k += len;
+    }
+    qsort(v, n, sizeof *v, pbo_lookup_cmp);
+    hdr.count = n;
+    hdr.names_size = namesz;
+
+    ret = PBO_ERROR_IO;
+    tmp = pbo_atomic_temp(path);
+    pbo_io io;
+    if(!tmp || pbo_io_open_path(&io, tmp, IO_CREATE))
+        goto cleanup;
+    pbo_writer_init(file, &io, 0);
+    pbo_writer_write(file, &hdr, sizeof hdr);
+    for(i = 0; i < n; i++)
+        pbo_writer_write(file, &v[i].rec, sizeof v[i].rec);
+    pbo_writer_write(file, names, namesz);
+    int err = pbo_writer_flush(file);
+    pbo_io_close(&io);
+    if(!err) {
+        ret = pbo_atomic_finish(tmp, path, d->batch);
+        tmp = NULL;
+    }
+
+cleanup:
+    if(tmp)
+        pbo_atomic_abort(tmp);
+    free(v);
+    free(keys);
+    free(names);
+    free(file);
+    return ret;
+}
+
+static int pbo_lookup_load(struct pbo_lookup *l, const char *path)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_UNISTD_H)
+    int fd = open(path, O_RDONLY | O_BINARY);
+    if(fd < 0)
+        return -1;
+    struct stat st;
+    void *p = MAP_FAILED;
+    if(!fstat(fd, &st) && st.st_size > 0 && (uint64_t)st.st_size <= SIZE_MAX)
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p != MAP_FAILED) {
+        l->base = p;
+        l->size = st.st_size;
+        l->mapped = 1;
+        return 0;
+    }
+#endif
+    //Read into memory where it can't be mapped
+    pbo_io io;
+    uint64_t size;
+    if(pbo_io_open_path(&io, path, IO_READ))
+        return -1;
+    unsigned char *buf = NULL;
+    if(!io.ops->size(io.handle, &size) && size <= SIZE_MAX && (buf = malloc(size ? size : 1)) &&
+       io.ops->read_at(io.handle, buf, size, 0) != size) {
+        free(buf);
+        buf = NULL;
+    }
+    pbo_io_close(&io);
+    if(!buf)
+        return -1;
+    l->base = buf;
+    l->size = size;
+    l->mapped = 0;
+    return 0;
+}
+
+//Whether archive is still the one the lookup file was made for
+static int pbo_lookup_matches(const struct lookup_header *hdr, const char *archive)
+{
+    pbo_io io;
+    uint64_t size;
+    unsigned char trailer[SHA1HashSize];
+    static const unsigned char none[SHA1HashSize];
+    if(pbo_io_open_path(&io, archive, IO_READ))
+        return 0;
+
+    int ok = !io.ops->size(io.handle, &size) && size == hdr->archive_size;
+    if(ok && memcmp(hdr->sha1, none, SHA1HashSize))
+        ok = size >= SHA1HashSize && io.ops->read_at(io.handle, trailer, SHA1HashSize, size - SHA1HashSize) == SHA1HashSize &&
+             !memcmp(trailer, hdr->sha1, SHA1HashSize);
+    pbo_io_close(&io);
+    return ok;
+}
+
+/* Maps the lookup file at path. Only its size is checked against the
+ * header here, records are checked as lookups touch them. With archive
+ * set it has to belong to that archive, by size and trailing hash. */
+pbo_lookup_t pbo_lookup_open(const char *path, const char *archive)
+{
+    if(!path)
+        return NULL;
+
+    struct pbo_lookup *l = malloc(sizeof *l);
+    if(!l)
+        return NULL;
+    if(pbo_lookup_load(l, path)) {
+        free(l);
+        return NULL;
+    }
+
+    const struct lookup_header *hdr = (const void *)l->base;
+    if(l->size < sizeof *hdr || memcmp(hdr->magic, LOOKUP_MAGIC, 4) || hdr->version != LOOKUP_VERSION ||
+       (uint64_t)hdr->count * sizeof *l->recs + hdr->names_size != l->size - sizeof *hdr ||
+       (archive && !pbo_lookup_matches(hdr, archive))) {
+        pbo_lookup_close(l);
+        return NULL;
+    }
+
+    l->hdr = hdr;
+    l->recs = (const void *)(l->base + sizeof *hdr);
+    l->names = (const char *)(l->recs + hdr->count);
+    return l;
+}
+
+void pbo_lookup_close(pbo_lookup_t l)
+{
+    if(!l)
+        return;
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_UNISTD_H)
+    if(l->mapped)
+        munmap((void *)l->base, l->size);
+    else
+#endif
+    free((void *)l->base);
+    free(l);
+}
+
+size_t pbo_lookup_count(pbo_lookup_t l)
+{
+    return l ? l->hdr->count : 0;
+}
+
+/* Finds name by binary search over the hashes, names with the same hash
+ * are told apart by comparing them. No allocation, nothing but the pages
+ * touched is read. */
+static pbo_error pbo_lookup_find_untraced(pbo_lookup_t l, const char *name, pbo_file_info *info)
+{
+    if(!l || !name || !info)
+        return PBO_ERROR_NEXIST;
+
+    char key[MAXNAMELEN + 1], other[MAXNAMELEN + 1];
+    if(pbo_util_normalize(key, name, sizeof key) == MAXNAMELEN)
+        return PBO_ERROR_NEXIST;
+    uint32_t h = pbo_lookup_hash(key);
+
+    size_t lo = 0, hi = l->hdr->count;
+    while(lo < hi) {
+        size_t m = lo + (hi - lo) / 2;
+        if(l->recs[m].hash < h)
+            lo = m + 1;
+        else
+            hi = m;
+    }
+
+    for(; lo < l->hdr->count && l->recs[lo].hash == h; lo++) {
+        const struct lookup_record *r = &l->recs[lo];
+        if(r->name >= l->hdr->names_size || !memchr(l->names + r->name, '\0', l->hdr->names_size - r->name))
+            return PBO_ERROR_BROKEN;
+
+        pbo_util_normalize(other, l->names + r->name, sizeof other);
+        if(strcmp(other, key))
+            continue;
+
+        info->name = l->names + r->name;
+        info->packing_method = r->packing_method;
+        info->original_size = r->original_size;
+        info->timestamp = r->timestamp;
+        info->size = r->size;
+        info->offset = r->offset;
+        return PBO_SUCCESS;
+    }
+    return PBO_ERROR_NEXIST;
+}
+
+pbo_error pbo_lookup_find(pbo_lookup_t l, const char *name, pbo_file_info *info)
+{
+    struct pbo_span s;
+    pbo_trace_begin(&s, PBO_OP_LOOKUP, name);
+    return pbo_trace_end(&s, pbo_lookup_find_untraced(l, name, info));
+}
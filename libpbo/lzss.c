@@ -0,0 +1,167 @@
+/* lzss.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "pbo-private.h"
+
+/* The BI flavour of LZSS: a flag byte announces the next eight tokens,
+ * LSB first, 1 for a literal byte and 0 for a two byte back reference
+ * with a 12 bit distance and a 4 bit length - 3. References before the
+ * start of the output read as spaces. The stream is followed by the sum
+ * of all decoded bytes as a little endian uint32. */
+int pbo_lzss_decode(const unsigned char *src, size_t srclen, unsigned char *dst, size_t dstlen)
+{
+    const unsigned char *end = src + srclen;
+    size_t out = 0;
+    uint32_t sum = 0;
+
+    while(out < dstlen) {
+        if(src == end)
+            return -1;
+        unsigned int flags = *src++;
+
+        for(int bit = 0; bit < 8 && out < dstlen; bit++, flags >>= 1) {
+            if(flags & 1) {
+                if(src == end)
+                    return -1;
+                sum += dst[out++] = *src++;
+                continue;
+            }
+
+            if(end - src < 2)
+                return -1;
+            size_t dist = src[0] | (src[1] & 0xF0) << 4;
+            size_t len = (src[1] & 0x0F) + 3;
+            src += 2;
+            if(!dist)
+                return -1;
+
+            if(len > dstlen - out)
+                len = dstlen - out; //Only the last token can be cut off
+            for(size_t i = 0; i < len; i++, out++)
+                sum += dst[out] = out < dist ? ' ' : dst[out - dist];
+        }
+    }
+
+    if(end - src < 4)
+        return -1;
+    uint32_t stored = src[0] | src[1] << 8 | src[2] << 16 | (uint32_t)src[3] << 24;
+    return stored == sum ? 0 : -1;
+}
+
+#define LZSS_WINDOW 4095 //Largest distance
+#define LZSS_MIN 3
+#define LZSS_MAX 18
+#define LZSS_HASHBITS 13
+#define LZSS_CHAIN 32 //Candidates tried per position
+
+struct lzss_state {
+    int32_t head[1 << LZSS_HASHBITS];
+    int32_t prev[LZSS_WINDOW + 1]; //Ring over the window
+};
+
+static unsigned int pbo_lzss_hash(const unsigned char *p)
+{
+    return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - LZSS_HASHBITS);
+}
+
+/* Greedy encoder for the format above, with hash chains over the window.
+ * Never refers back past the start, so the spaces don't matter. Returns
+ * the encoded size, 0 if it wouldn't fit in cap. */
+size_t pbo_lzss_encode(const unsigned char *src, size_t n, unsigned char *dst, size_t cap)
+{
+    struct lzss_state *st = malloc(sizeof *st);
+    if(!st)
+        return 0;
+    for(size_t i = 0; i < sizeof st->head / sizeof *st->head; i++)
+        st->head[i] = -1;
+
+    size_t out = 0, flagpos = 0, i = 0;
+    uint32_t sum = 0;
+    int bit = 8;
+    while(i < n) {
+        if(bit == 8) {
+            if(out == cap)
+                goto full;
+            flagpos = out++;
+            dst[flagpos] = 0;
+            bit = 0;
+        }
+
+        size_t best = 0, dist = 0, max = n - i < LZSS_MAX ? n - i : LZSS_MAX;
+        if(max >= LZSS_MIN) {
+            int32_t p = st->head[pbo_lzss_hash(src + i)];
+            for(int chain = 0; p >= 0 && i - p <= LZSS_WINDOW && chain < LZSS_CHAIN; chain++) {
+                size_t len = 0;
+                while(len < max && src[p + len] == src[i + len])
+                    len++;
+                if(len > best) {
+                    best = len;
+                    dist = i - p;
+                    if(len == max)
+                        break;
+                }
+                int32_t q = st->prev[p & LZSS_WINDOW];
+                if(q >= p)
+                    break;
+                p = q;
+            }
+        }
+
+        size_t take = 1;
+        if(best >= LZSS_MIN) {
+            if(cap - out < 2)
+                goto full;
+            dst[out++] = dist & 0xFF;
+            dst[out++] = (dist >> 4 & 0xF0) | (best - LZSS_MIN);
+            take = best;
+        } else {
+            if(out == cap)
+                goto full;
+            dst[flagpos] |= 1 << bit;
+            dst[out++] = src[i];
+        }
+        bit++;
+
+        for(size_t end = i + take; i < end; i++) {
+            sum += src[i];
+            if(i + LZSS_MIN <= n) {
+                unsigned int h = pbo_lzss_hash(src + i);
+                st->prev[i & LZSS_WINDOW] = st->head[h];
+                st->head[h] = i;
+            }
+        }
+    }
+
+    free(st);
+    if(cap - out < 4)
+        return 0;
+    dst[out++] = sum & 0xFF;
+    dst[out++] = sum >> 8 & 0xFF;
+    dst[out++] = sum >> 16 & 0xFF;
+    dst[out++] = sum >> 24;
+    return out;
+
+full:
+    free(st);
+    return 0;
+}
+
+/* Whether a compressed entry claims more than its data could decode to,
+ * a flag byte and eight 2 byte references giving at most 8 * 18 bytes.
+ * Blocks are LZSS or stored, so the bound holds for them too. */
+int pbo_lzss_impossible(const struct pbo_entry *pe)
+{
+    if(!pbo_entry_packed(pe))
+        return 0;
+    uint64_t packed = pe->properties[DATA_SIZE];
+    return pe->properties[ORIGINAL_SIZE] > (packed / 17 + 1) * 8 * 18;
+}
@@ -0,0 +1,265 @@
+/* merge.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sha.h"
+#include "pbo-private.h"
+
+#define RECORDSZ (1 + 4 * 5) //Header record without the name
+
+struct merge_item {
+    const struct pbo_entry *pe;
+    const pbo_io *src;
+    size_t off; //Of the data in src
+};
+
+//Checksum tables describe the entries of their input, not of the output
+static int pbo_merge_keepext(const struct header_extension *he, size_t i)
+{
+    return strncmp(he->entries[i & ~(size_t)1], CHECKSUM_KEY, strlen(CHECKSUM_KEY)) != 0;
+}
+
+static size_t pbo_merge_extsize(const struct pbo_entry *ext)
+{
+    if(!ext)
+        return 0;
+
+    size_t sz = RECORDSZ;
+    for(size_t i = 0; i < ext->ext->len; i++)
+        if(pbo_merge_keepext(ext->ext, i))
+            sz += strlen(ext->ext->entries[i]) + 1;
+    return sz;
+}
+
+/* Writes the planned archive: the whole header first, then the data moved
+ * over as ranges as long as the sources allow, hashed on the way. */
+static pbo_error pbo_merge_write(const char *outfile, const struct pbo_entry *ext, const struct merge_item *items, size_t n)
+{
+    char *tmp = pbo_atomic_temp(outfile);
+    if(!tmp)
+        return PBO_ERROR_IO;
+    pbo_io io;
+    if(pbo_io_open_path(&io, tmp, IO_CREATE)) {
+        pbo_atomic_abort(tmp);
+        return PBO_ERROR_IO;
+    }
+    struct io_writer *file = malloc(sizeof *file);
+    if(!file) {
+        pbo_io_close(&io);
+        pbo_atomic_abort(tmp);
+        return PBO_ERROR_MALLOC;
+    }
+    pbo_writer_init(file, &io, 0);
+
+    pbo_error ret = PBO_ERROR_IO;
+    unsigned char *buf = NULL;
+    SHA1Context ctx;
+    SHA1Reset(&ctx);
+
+    if(ext) {
+        WRITE_N_SHA("", 1, 1, file, &ctx);
+        WRITE_N_SHA(ext->properties, 4, 5, file, &ctx);
+        for(size_t i = 0; i < ext->ext->len; i++) {
+            if(!pbo_merge_keepext(ext->ext, i))
+                continue;
+            WRITE_N_SHA(ext->ext->entries[i], 1, strlen(ext->ext->entries[i]) + 1, file, &ctx);
+        }
+    }
+    for(size_t i = 0; i < n; i++) {
+        WRITE_N_SHA(items[i].pe->name, 1, strlen(items[i].pe->name) + 1, file, &ctx);
+        WRITE_N_SHA(items[i].pe->properties, 4, 5, file, &ctx);
+    }
+    uint32_t term[5] = { 0 };
+    WRITE_N_SHA("", 1, 1, file, &ctx);
+    WRITE_N_SHA(term, 4, 5, file, &ctx);
+
+    //Chunks as big as the data needs, up to STREAMBUFSZ
+    uint64_t total = 0;
+    for(size_t i = 0; i < n; i++)
+        total += items[i].pe->properties[DATA_SIZE];
+    size_t bufsz = total < IOBUFSZ ? IOBUFSZ : total < STREAMBUFSZ ? total : STREAMBUFSZ;
+    buf = malloc(bufsz);
+    if(!buf) {
+        ret = PBO_ERROR_MALLOC;
+        goto cleanup;
+    }
+
+    for(size_t i = 0; i < n;) {
+        //Extend the range while the next entry follows on in the same source
+        const pbo_io *src = items[i].src;
+        size_t off = items[i].off, len = 0;
+        for(; i < n && items[i].src == src && items[i].off == off + len; i++)
+            len += items[i].pe->properties[DATA_SIZE];
+
+        pbo_io_advise(src, off, len, ADVISE_SEQUENTIAL);
+        while(len) {
+            size_t c = len < bufsz ? len : bufsz;
+            if(src->ops->read_at(src->handle, buf, c, off) != c)
+                goto cleanup;
+            pbo_io_advise(src, off, c, ADVISE_DONTNEED);
+            WRITE_N_SHA(buf, 1, c, file, &ctx);
+            off += c;
+            len -= c;
+        }
+    }
+
+    uint8_t sha[SHA1HashSize];
+    SHA1Result(&ctx, sha);
+    pbo_writer_write(file, "", 1);
+    pbo_writer_write(file, sha, SHA1HashSize);
+    if(!pbo_writer_flush(file))
+        ret = PBO_SUCCESS;
+
+cleanup:
+    free(buf);
+    free(file);
+    pbo_io_close(&io);
+    if(ret)
+        pbo_atomic_abort(tmp);
+    else
+        ret = pbo_atomic_finish(tmp, outfile, NULL);
+    return ret;
+}
+
+//Named entries of d, from the list since the index may have failed to build
+static size_t pbo_merge_count(pbo_t d)
+{
+    size_t n = 0;
+    for(struct list_entry *e = d->root; e; e = e->next)
+        n += *e->data->name != '\0';
+    return n;
+}
+
+static const struct pbo_entry *pbo_merge_ext(pbo_t d)
+{
+    if(d->root && *d->root->data->name == '\0' && d->root->data->ext)
+        return d->root->data;
+    return NULL;
+}
+
+/* The header extension comes from the first input that has one, a name
+ * that shows up in more than one input is taken from the first. */
+pbo_error pbo_merge(const char *outfile, pbo_t *inputs, size_t count)
+{
+    if(!outfile || !inputs)
+        return PBO_ERROR_NEXIST;
+
+    size_t n = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(!inputs[i])
+            return PBO_ERROR_NEXIST;
+        if(inputs[i]->state != EXISTING)
+            return PBO_ERROR_STATE;
+        n += pbo_merge_count(inputs[i]);
+    }
+
+    pbo_error ret = PBO_ERROR_MALLOC;
+    size_t opened = 0;
+    pbo_io *files = calloc(count ? count : 1, sizeof *files);
+    struct merge_item *items = malloc((n ? n : 1) * sizeof *items);
+    if(!files || !items)
+        goto cleanup;
+
+    ret = PBO_ERROR_IO;
+    for(; opened < count; opened++)
+        if(pbo_io_begin(inputs[opened], IO_READ, &files[opened]))
+            goto cleanup;
+
+    const struct pbo_entry *ext = NULL;
+    n = 0;
+    for(size_t i = 0; i < count; i++) {
+        pbo_t d = inputs[i];
+        if(!ext)
+            ext = pbo_merge_ext(d);
+
+        for(struct list_entry *e = d->root; e; e = e->next) {
+            if(*e->data->name == '\0')
+                continue;
+
+            int dup = 0;
+            for(size_t j = 0; j < i && !dup; j++)
+                dup = pbo_index_find(inputs[j], e->data->name) != NULL;
+            if(dup || pbo_index_find(d, e->data->name) != e)
+                continue;
+
+            items[n].pe = e->data;
+            items[n].src = &files[i];
+            items[n].off = d->headersz + e->data->file_offset;
+            n++;
+        }
+    }
+
+    ret = pbo_merge_write(outfile, ext, items, n);
+
+cleanup:
+    for(size_t i = 0; i < opened; i++)
+        pbo_io_end(inputs[i], &files[i]);
+    free(files);
+    free(items);
+    return ret;
+}
+
+/* Cuts d into <outbase>_1.pbo, <outbase>_2.pbo... of at most maxsize
+ * bytes each, all with d's header extension. Entries aren't split, one
+ * that doesn't fit on its own gets a part to itself. */
+pbo_error pbo_split(pbo_t d, const char *outbase, size_t maxsize, unsigned int *parts)
+{
+    if(!d || !outbase)
+        return PBO_ERROR_NEXIST;
+    if(d->state != EXISTING)
+        return PBO_ERROR_STATE;
+
+    size_t n = pbo_merge_count(d);
+    struct merge_item *items = malloc((n ? n : 1) * sizeof *items);
+    char *outfile = malloc(strlen(outbase) + 32);
+    pbo_io io;
+    int opened = 0;
+    pbo_error ret = !items || !outfile ? PBO_ERROR_MALLOC : PBO_SUCCESS;
+    if(!ret && !(opened = !pbo_io_begin(d, IO_READ, &io)))
+        ret = PBO_ERROR_IO;
+    if(ret)
+        goto cleanup;
+
+    n = 0;
+    for(struct list_entry *e = d->root; e; e = e->next) {
+        if(*e->data->name == '\0')
+            continue;
+        items[n].pe = e->data;
+        items[n].src = &io;
+        items[n].off = d->headersz + e->data->file_offset;
+        n++;
+    }
+
+    const struct pbo_entry *ext = pbo_merge_ext(d);
+    size_t fixed = pbo_merge_extsize(ext) + RECORDSZ + 1 + SHA1HashSize;
+    unsigned int part = 0;
+    for(size_t i = 0; i < n && !ret;) {
+        size_t first = i, sz = fixed;
+        do {
+            sz += RECORDSZ + strlen(items[i].pe->name) + items[i].pe->properties[DATA_SIZE];
+            i++;
+        } while(i < n && sz + RECORDSZ + strlen(items[i].pe->name) + items[i].pe->properties[DATA_SIZE] <= maxsize);
+
+        sprintf(outfile, "%s_%u.pbo", outbase, ++part);
+        ret = pbo_merge_write(outfile, ext, items + first, i - first);
+    }
+    if(parts)
+        *parts = part;
+
+cleanup:
+    if(opened)
+        pbo_io_end(d, &io);
+    free(items);
+    free(outfile);
+    return ret;
+}
@@ -0,0 +1,186 @@
+/* pack.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "pool.h"
+#include "pbo-private.h"
+
+struct pack_job {
+    pbo_pack_spec *spec;
+    size_t ind; //Into the caller's specs
+    struct dir_walk *walk;
+    uint64_t bytes;
+    int started;
+};
+
+/* Jobs largest first. Each worker takes the largest job that still fits
+ * the budget next to the ones running, or the largest one at all if
+ * nothing is running, so a job over budget runs alone. */
+struct pack_sched {
+    struct pack_job *jobs;
+    size_t count;
+    const pbo_pack_options *opts;
+    uint64_t inflight; //Bytes of the running jobs
+    size_t running;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+};
+
+static int pbo_pack_cmp(const void *a, const void *b)
+{
+    const struct pack_job *x = a, *y = b;
+    if(x->bytes != y->bytes)
+        return x->bytes > y->bytes ? -1 : 1;
+    return x->ind < y->ind ? -1 : x->ind > y->ind;
+}
+
+static void pbo_pack_scan(size_t i, void *user)
+{
+    struct pack_sched *s = user;
+    struct pack_job *job = &s->jobs[i];
+    if(job->spec->result == PBO_SUCCESS)
+        job->spec->result = pbo_dir_scan(job->spec->root, job->spec->opts, &job->walk, &job->bytes);
+}
+
+//Called with the lock held, NULL if nothing fits right now
+static struct pack_job *pbo_pack_pick(struct pack_sched *s)
+{
+    size_t budget = s->opts ? s->opts->budget : 0;
+    for(size_t i = 0; i < s->count; i++) {
+        struct pack_job *job = &s->jobs[i];
+        if(job->started)
+            continue;
+        if(!budget || !s->running || s->inflight + job->bytes <= budget)
+            return job;
+    }
+    return NULL;
+}
+
+static pbo_error pbo_pack_build(struct pack_sched *s, struct pack_job *job)
+{
+    if(!job->walk)
+        return job->spec->result; //Scanning it failed
+
+    pbo_t d = pbo_init(job->spec->output);
+    if(!d)
+        return PBO_ERROR_MALLOC;
+
+    pbo_error ret = pbo_init_new(d);
+    if(!ret && s->opts && s->opts->setup)
+        s->opts->setup(d, job->ind, s->opts->user);
+    if(!ret)
+        ret = pbo_dir_add(d, job->walk, 1); //Archives are what runs in parallel
+    if(!ret)
+        ret = pbo_write(d);
+    pbo_dispose(d);
+
+    pbo_dir_free(job->walk);
+    job->walk = NULL;
+    return ret;
+}
+
+//Runs one job per call, the pool makes as many calls as there are jobs
+static void pbo_pack_worker(size_t i, void *user)
+{
+    struct pack_sched *s = user;
+    (void)i;
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&s->lock);
+    struct pack_job *job;
+    while(!(job = pbo_pack_pick(s)))
+        pthread_cond_wait(&s->cond, &s->lock);
+#else
+    struct pack_job *job = pbo_pack_pick(s);
+#endif
+    job->started = 1;
+    s->inflight += job->bytes;
+    s->running++;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&s->lock);
+#endif
+
+    job->spec->result = pbo_pack_build(s, job);
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&s->lock);
+#endif
+    s->inflight -= job->bytes;
+    s->running--;
+#ifdef HAVE_PTHREAD_H
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+#endif
+}
+
+/* Packs every spec into its own archive on a pool. File data is only read
+ * once an archive starts and is gone once it's written, so the budget
+ * bounds what is held at once. Largest first keeps a big archive from
+ * starting last and running on alone. Fails if any archive failed, their
+ * result says which. */
+pbo_error pbo_pack_many(pbo_pack_spec *specs, size_t count, const pbo_pack_options *opts)
+{
+    if(!specs && count)
+        return PBO_ERROR_NEXIST;
+
+    struct pack_sched s;
+    s.jobs = malloc((count ? count : 1) * sizeof *s.jobs);
+    if(!s.jobs)
+        return PBO_ERROR_MALLOC;
+    s.count = count;
+    s.opts = opts;
+    s.inflight = 0;
+    s.running = 0;
+#ifdef HAVE_PTHREAD_H
+    if(pthread_mutex_init(&s.lock, NULL)) {
+        free(s.jobs);
+        return PBO_ERROR_MALLOC;
+    }
+    if(pthread_cond_init(&s.cond, NULL)) {
+        pthread_mutex_destroy(&s.lock);
+        free(s.jobs);
+        return PBO_ERROR_MALLOC;
+    }
+#endif
+
+    int threads = opts ? opts->threads : 0;
+    for(size_t i = 0; i < count; i++) {
+        s.jobs[i].spec = &specs[i];
+        s.jobs[i].ind = i;
+        s.jobs[i].walk = NULL;
+        s.jobs[i].bytes = 0;
+        s.jobs[i].started = 0;
+        specs[i].result = specs[i].output && specs[i].root ? PBO_SUCCESS : PBO_ERROR_NEXIST;
+    }
+
+    //Sizes decide the order, finding them is mostly waiting on stat
+    pbo_pool_run(count, threads, pbo_pack_scan, &s);
+    qsort(s.jobs, count, sizeof *s.jobs, pbo_pack_cmp);
+    pbo_pool_run(count, threads, pbo_pack_worker, &s);
+
+#ifdef HAVE_PTHREAD_H
+    pthread_cond_destroy(&s.cond);
+    pthread_mutex_destroy(&s.lock);
+#endif
+    free(s.jobs);
+
+    for(size_t i = 0; i < count; i++)
+        if(specs[i].result != PBO_SUCCESS)
+            return PBO_ERROR_BROKEN;
+    return PBO_SUCCESS;
+}
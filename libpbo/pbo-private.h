@@ -0,0 +1,265 @@
+/* pbo-private.h - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBpbo_pbo_private_H
+#define LIBpbo_pbo_private_H 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "sha.h"
+
+#include <libpbo/pbo.h>
+
+#define MAXNAMELEN PBO_MAXNAMELEN
+#define IOBUFSZ 65536
+#define STREAMBUFSZ (1 << 20) //Largest buffer for streaming one entry
+
+#define WRITE_N_SHA(P,S,N,W,C) \
+    pbo_writer_write((W), (P), (S) * (N)); \
+    SHA1Input((C), (const uint8_t *)(P), (S) * (N));
+
+typedef enum
+{
+    CLEAR = 0,
+    EXISTING,
+    NEW,
+    EDIT,
+} pbo_state;
+
+enum{
+    PACKING_METHOD = 0,
+    ORIGINAL_SIZE,
+    RES,
+    TIME_STAMP,
+    DATA_SIZE,
+};
+
+/* Extension strings, keys and values taking turns, closed by an empty
+ * string once finalized. One block holds the entries, a key table and
+ * the strings, it's rebuilt on every change. */
+struct header_extension {
+    size_t len;
+    char **entries;
+    uint32_t *slots; //Open addressing over keys, index into entries
+    size_t nslots;
+    char *block;
+};
+
+struct pbo_entry {
+    char *name;
+    uint32_t properties[5];
+    struct header_extension *ext;
+    size_t file_offset;
+    unsigned char *data;
+    pbo_freecb data_free; //NULL for malloc'd data
+    void *data_user;
+    uint32_t crc; //CRC32C of the stored bytes, if has_crc
+    int has_crc;
+};
+
+struct list_entry {
+    struct list_entry *next;
+    struct pbo_entry *data;
+};
+
+enum {
+    IO_READ = 0,
+    IO_CREATE,
+    IO_UPDATE,
+};
+
+enum {
+    ADVISE_SEQUENTIAL = 0, //About to stream through it
+    ADVISE_WILLNEED,
+    ADVISE_DONTNEED, //Streamed through, keep it out of the page cache
+};
+
+/* File descriptors, read and written with pread/pwrite so one handle can
+ * serve any number of readers without a shared file position. */
+struct io_fd {
+    int fd;
+    int owned;
+    int heap; //Freed on close
+};
+
+struct io_reader {
+    const pbo_io *io;
+    uint64_t pos;
+    size_t len;
+    size_t at;
+    unsigned char buf[IOBUFSZ];
+};
+
+struct direct_writer;
+
+struct io_writer {
+    const pbo_io *io;
+    struct direct_writer *direct; //Used instead of io if set
+    uint64_t pos;
+    size_t fill;
+    int err;
+    unsigned char buf[IOBUFSZ];
+};
+
+struct index_entry {
+    const char *key; //Normalised name
+    size_t keylen;
+    size_t ord; //Position in the list, keeps duplicates in order
+    struct list_entry *le;
+};
+
+struct name_index {
+    size_t len;
+    struct index_entry *byname;
+    struct index_entry **bysuffix; //Sorted by the reversed key
+    char *keys;
+};
+
+struct pbo {
+    size_t headersz;
+    struct list_entry *root;
+    struct list_entry *last;
+    char *filename;
+    pbo_state state;
+    struct name_index *index;
+    pbo_timestamp tsmode;
+    uint32_t epoch;
+    int canonical;
+    pbo_io io; //Attached by the user, ops is NULL if unset
+    pbo_io fd; //Read handle kept between calls, ops is NULL if closed
+    unsigned int fd_users;
+    struct pbo *fd_prev; //Open handles LRU
+    struct pbo *fd_next;
+    pbo_cache_t cache;
+    int direct;
+    pbo_batch_t batch;
+    int checksums;
+    int block_packing;
+    pbo_block_options block_opts;
+    int loadable;
+};
+
+//Decodes pieces of a PBO_PACKING_BLOCKS entry
+struct blocks_reader {
+    const pbo_io *io;
+    size_t orig;
+    uint32_t bsize;
+    uint32_t count;
+    unsigned char *sizes; //As stored
+    uint64_t *offs; //Of each block in io, and the end
+    unsigned char *buf;
+    uint32_t crc; //Of the table
+};
+
+/* io.c */
+pbo_error pbo_io_open_path(pbo_io *io, const char *path, int mode);
+pbo_error pbo_io_open_into(pbo_io *io, struct io_fd *h, const char *path);
+int pbo_io_fileno(const pbo_io *io);
+void pbo_io_advise(const pbo_io *io, uint64_t off, uint64_t len, int advice);
+pbo_error pbo_io_begin(pbo_t d, int mode, pbo_io *io);
+void pbo_io_end(pbo_t d, pbo_io *io);
+void pbo_io_release(pbo_t d);
+void pbo_reader_init(struct io_reader *r, const pbo_io *io, uint64_t pos);
+int pbo_reader_getc(struct io_reader *r);
+size_t pbo_reader_read(struct io_reader *r, void *dst, size_t n);
+uint64_t pbo_reader_tell(const struct io_reader *r);
+void pbo_writer_init(struct io_writer *w, const pbo_io *io, uint64_t pos);
+void pbo_writer_write(struct io_writer *w, const void *p, size_t n);
+int pbo_writer_flush(struct io_writer *w);
+
+/* direct.c */
+struct direct_writer *pbo_direct_open(const char *path);
+void pbo_direct_reserve(struct direct_writer *w, uint64_t size);
+void pbo_direct_write(struct direct_writer *w, const void *p, size_t n);
+int pbo_direct_close(struct direct_writer *w);
+
+/* atomic.c */
+char *pbo_atomic_temp(const char *path);
+void pbo_atomic_abort(char *tmp);
+pbo_error pbo_atomic_finish(char *tmp, const char *path, pbo_batch_t b);
+
+/* blocks.c */
+int pbo_entry_packed(const struct pbo_entry *pe);
+int pbo_entry_decode(const struct pbo_entry *pe, const unsigned char *src, size_t srclen, unsigned char *dst);
+pbo_error pbo_blocks_open(struct blocks_reader *r, const pbo_io *io, uint64_t off, const struct pbo_entry *pe);
+pbo_error pbo_blocks_get(struct blocks_reader *r, uint64_t first, size_t len, unsigned char *dst);
+pbo_error pbo_blocks_verify(struct blocks_reader *r, const struct pbo_entry *pe);
+void pbo_blocks_close(struct blocks_reader *r);
+pbo_error pbo_blocks_pack(pbo_t d);
+pbo_error pbo_blocks_refuse(pbo_t d);
+
+/* trace.c */
+struct pbo_span {
+    pbo_op op;
+    const char *name;
+    uint64_t start;
+};
+void pbo_trace_begin(struct pbo_span *s, pbo_op op, const char *name);
+pbo_error pbo_trace_end(struct pbo_span *s, pbo_error ret);
+/* Log linear buckets as in HdrHistogram: values below HIST_SUB have one
+ * each, above that every power of two is split into HIST_SUB, so a value
+ * is off by at most 1 / HIST_SUB from its bucket. Latencies in ns, capped
+ * at 2^HIST_MAXBITS (about 18 minutes). */
+#define HIST_SUBBITS 5
+#define HIST_SUB (1 << HIST_SUBBITS)
+#define HIST_MAXBITS 40
+#define HIST_BUCKETS ((HIST_MAXBITS - HIST_SUBBITS + 1) * HIST_SUB)
+size_t pbo_hist_index(uint64_t v);
+uint64_t pbo_hist_upper(size_t i);
+uint64_t pbo_hist_lower(size_t i);
+
+/* crc32c.c */
+#define CHECKSUM_KEY "crc32c."
+#define CHECKSUM_PER_KEY 63 //Keeps values within MAXNAMELEN
+uint32_t pbo_crc32c(uint32_t crc, const void *p, size_t n);
+void pbo_checksum_load(pbo_t d);
+pbo_error pbo_checksum_store(pbo_t d);
+
+/* dir.c */
+struct dir_walk;
+pbo_error pbo_dir_scan(const char *root, const pbo_dir_options *opts, struct dir_walk **out, uint64_t *bytes);
+pbo_error pbo_dir_add(pbo_t d, struct dir_walk *w, int threads);
+void pbo_dir_free(struct dir_walk *w);
+
+/* ext.c */
+struct header_extension *pbo_ext_new(void);
+void pbo_ext_free(struct header_extension *he);
+pbo_error pbo_ext_add(struct header_extension *he, const char *e);
+pbo_error pbo_ext_replace_prefixed(struct header_extension *he, const char *prefix, const char **strs, size_t count);
+void pbo_ext_unfinalize(struct header_extension *he);
+pbo_error pbo_ext_parse(struct header_extension *he, struct io_reader *r);
+
+/* cache.c */
+void pbo_cache_forget(pbo_t d);
+int pbo_cache_get(pbo_t d, const struct pbo_entry *pe, void *dst);
+void pbo_cache_put(pbo_t d, const struct pbo_entry *pe, const void *src, size_t size);
+
+/* lzss.c */
+int pbo_lzss_decode(const unsigned char *src, size_t srclen, unsigned char *dst, size_t dstlen);
+size_t pbo_lzss_encode(const unsigned char *src, size_t n, unsigned char *dst, size_t cap);
+int pbo_lzss_impossible(const struct pbo_entry *pe);
+
+/* index.c */
+pbo_error pbo_index_build(pbo_t d);
+void pbo_index_free(pbo_t d);
+struct list_entry *pbo_index_find(pbo_t d, const char *name);
+size_t pbo_util_normalize(char *dst, const char *src, size_t dstsz);
+int pbo_util_name_eq(const char *a, const char *b);
+int pbo_util_glob(const char *p, const char *s);
+
+/* pbo.c */
+void pbo_fill_info(const struct pbo_entry *pe, size_t headersz, pbo_file_info *info);
+pbo_error pbo_add_entry(pbo_t d, const char *name, unsigned char *data, size_t size, uint32_t timestamp,
+                        pbo_freecb cb, void *user);
+void pbo_release_data(struct pbo_entry *pe);
+size_t pbo_header_size(pbo_t d);
+size_t pbo_entry_size(const struct pbo_entry *pe);
+pbo_error pbo_load_entry(pbo_t d, const struct pbo_entry *pe, void *buf);
+void pbo_take_entries(pbo_t d, pbo_t from);
+uint32_t pbo_timestamp_for(pbo_t d, time_t mtime);
+
+#endif /* LIBpbo_pbo_private_H */
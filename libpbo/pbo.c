@@ -13,63 +13,35 @@
 #include <string.h>
 #include <time.h>
 
-#include "sha.h"
-
-#include <libpbo/pbo.h>
-
-#define MAXNAMELEN 512
-
-#define WRITE_N_SHA(P,S,N,F,C) \
-    fwrite((P), (S), (N), (F)); \
-    SHA1Input((C), (uint8_t *)(P), (S) * (N));
-
-typedef enum
-{
-    CLEAR = 0,
-    EXISTING,
-    NEW,
-} pbo_state;
-
-enum{
-    PACKING_METHOD = 0,
-    ORIGINAL_SIZE,
-    RES,
-    TIME_STAMP,
-    DATA_SIZE,
-};
-
-struct header_extension {
-    size_t len;
-    char **entries;
-};
-
-struct pbo_entry {
-    char *name;
-    uint32_t properties[5];
-    struct header_extension *ext;
-    size_t file_offset;
-    unsigned char *data;
-};
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_IO_H
+# include <io.h>
+#endif
 
-struct list_entry {
-    struct list_entry *next;
-    struct pbo_entry *data;
-};
+#include <sys/stat.h>
 
-struct pbo {
-    size_t headersz;
-    struct list_entry *root;
-    struct list_entry *last;
-    char *filename;
-    pbo_state state;
-};
+#include "sha.h"
+#include "hasher.h"
+#include "pool.h"
+#include "pbo-private.h"
 
-static pbo_error pbo_add_header_extension(struct header_extension *he, const char *e);
 static pbo_error pbo_list_add_entry(pbo_t d, struct pbo_entry *pe);
+static pbo_error pbo_insert_entry(pbo_t d, struct pbo_entry *pe);
+static void pbo_insert_node(pbo_t d, struct list_entry *le);
+static void pbo_list_link(pbo_t d, struct list_entry *le);
+static pbo_error pbo_finalize_header(pbo_t d);
+static void pbo_write_header(pbo_t d, struct io_writer *w, SHA1Context *ctx);
+static pbo_error pbo_sort_entries(pbo_t d);
+static void pbo_free_entry(struct pbo_entry *pe);
 static void pbo_clear_list(pbo_t d);
 static struct list_entry *pbo_find_file(pbo_t d, const char *file);
-static int pbo_util_getdelim(unsigned char *dst, FILE *src, size_t dstsz, char delim);
+static int pbo_util_getdelim(char *dst, struct io_reader *src, size_t dstsz, char delim);
+static int pbo_util_move(const pbo_io *io, uint64_t src, uint64_t dst, size_t len);
 static char *pbo_util_strdup(const char *src);
+static pbo_error pbo_verify_io(const pbo_io *io);
+static pbo_error pbo_verify_path(const char *path);
 
 pbo_t pbo_init(const char *filename)
 {
@@ -77,14 +49,31 @@ pbo_t pbo_init(const char *filename)
     if(!d)
         goto cleanup; //Malloc Error
 
-    d->filename = pbo_util_strdup(filename);
-    if(!d->filename)
+    //No filename is fine for archives that get an io attached
+    d->filename = filename ? pbo_util_strdup(filename) : NULL;
+    if(filename && !d->filename)
         goto cleanup;
 
     d->root = NULL;
     d->last = NULL;
     d->headersz = 0;
     d->state = CLEAR;
+    d->index = NULL;
+    d->tsmode = PBO_TIMESTAMP_NOW;
+    d->epoch = 0;
+    d->canonical = 0;
+    d->io.ops = NULL;
+    d->io.handle = NULL;
+    d->fd.ops = NULL;
+    d->fd.handle = NULL;
+    d->fd_users = 0;
+    d->fd_prev = d->fd_next = NULL;
+    d->cache = NULL;
+    d->direct = 0;
+    d->batch = NULL;
+    d->checksums = 0;
+    d->block_packing = 0;
+    d->loadable = 0;
     return d;
 
 cleanup:
@@ -97,7 +86,10 @@ void pbo_clear(pbo_t d)
     if(!d)
         return;
 
+    pbo_cache_forget(d);
     pbo_clear_list(d);
+    pbo_index_free(d);
+    pbo_io_release(d);
 
     free(d->filename);
     d->filename = NULL;
@@ -110,6 +102,8 @@ void pbo_dispose(pbo_t d)
     if(!d)
         return;
     pbo_clear(d);
+    pbo_set_cache(d, NULL);
+    pbo_set_batch(d, NULL);
     free(d);
 }
 
@@ -117,9 +111,10 @@ pbo_error pbo_set_filename(pbo_t d, const char *filename)
 {
     if(!d)
         return PBO_ERROR_NEXIST;
-    if(d->state == EXISTING)
+    if(d->state == EXISTING || d->state == EDIT)
         return PBO_ERROR_STATE;
 
+    pbo_io_release(d);
     free(d->filename);
     d->filename = NULL;
     d->filename = pbo_util_strdup(filename);
@@ -129,76 +124,142 @@ pbo_error pbo_set_filename(pbo_t d, const char *filename)
     return PBO_SUCCESS;
 }
 
-pbo_error pbo_read_header(pbo_t d)
+pbo_error pbo_set_io(pbo_t d, const pbo_io *io)
+{
+    if(!d)
+        return PBO_ERROR_NEXIST;
+    if(d->state == EXISTING || d->state == EDIT)
+        return PBO_ERROR_STATE;
+    if(io && (!io->ops || !io->ops->read_at || !io->ops->write_at || !io->ops->size))
+        return PBO_ERROR_NEXIST;
+
+    pbo_io_release(d);
+
+    if(io)
+        d->io = *io;
+    else
+        d->io.ops = NULL, d->io.handle = NULL;
+    return PBO_SUCCESS;
+}
+
+pbo_error pbo_set_timestamps(pbo_t d, pbo_timestamp mode, uint32_t epoch)
+{
+    if(!d)
+        return PBO_ERROR_NEXIST;
+    if(mode != PBO_TIMESTAMP_NOW && mode != PBO_TIMESTAMP_EPOCH && mode != PBO_TIMESTAMP_SOURCE)
+        return PBO_ERROR_STATE;
+
+    d->tsmode = mode;
+    d->epoch = epoch;
+    return PBO_SUCCESS;
+}
+
+pbo_error pbo_set_canonical_order(pbo_t d, int enable)
+{
+    if(!d)
+        return PBO_ERROR_NEXIST;
+
+    d->canonical = !!enable;
+    return PBO_SUCCESS;
+}
+
+pbo_error pbo_set_direct_io(pbo_t d, int enable)
+{
+    if(!d)
+        return PBO_ERROR_NEXIST;
+
+    d->direct = !!enable;
+    return PBO_SUCCESS;
+}
+
+/* Everything claimed by the header has to fit in the file, which bounds
+ * both the time and the memory a hostile header can cost to linear in
+ * its size: each entry takes at least 21 bytes to describe. */
+static pbo_error pbo_read_header_untraced(pbo_t d)
 {
     if(!d)
         return PBO_ERROR_NEXIST;
     if(d->state != CLEAR)
         return PBO_ERROR_STATE;
 
-    FILE *file = fopen(d->filename, "r");
-    if(!file)
+    pbo_io io;
+    if(pbo_io_begin(d, IO_READ, &io))
         return PBO_ERROR_IO; //I/O Error
 
+    uint64_t filesz;
+    struct io_reader *file = malloc(sizeof *file);
+    pbo_error ret = !file ? PBO_ERROR_MALLOC : io.ops->size(io.handle, &filesz) ? PBO_ERROR_IO : PBO_SUCCESS;
+    if(ret)
+        goto cleanup;
+    pbo_reader_init(file, &io, 0);
+
     char buf[MAXNAMELEN];
-    size_t file_offset = 0;
+    uint64_t file_offset = 0;
 
-    struct pbo_entry *pe = NULL;
+    ret = PBO_ERROR_BROKEN;
     for(int i = 0;; i++) {
         int sz = pbo_util_getdelim(buf, file, sizeof buf, '\0');
         if(sz < 0)
-            return PBO_ERROR_BROKEN; //Broken Pbo header
-
-        pe = malloc(sizeof *pe);
-        if(!pe)
-            goto cleanup; //Malloc error
-
-        pe->ext = NULL;
-        pe->data = NULL;
-
-        pe->name = pbo_util_strdup(buf);
-        if(!pe->name)
+            goto cleanup; //Broken Pbo header
+
+        struct pbo_entry *pe = calloc(1, sizeof *pe);
+        if(!pe || !(pe->name = pbo_util_strdup(buf)) || pbo_list_add_entry(d, pe)) {
+            if(pe)
+                free(pe->name);
+            free(pe);
+            ret = PBO_ERROR_MALLOC;
             goto cleanup;
+        }
 
-        fread(pe->properties, 4, 5, file); //Get all properties
+        if(pbo_reader_read(file, pe->properties, 4 * 5) != 4 * 5)
+            goto cleanup; //Cut off
         pe->file_offset = file_offset;
         file_offset += pe->properties[DATA_SIZE];
-        if(!sz && !i) { //Header Extension
-            pe->ext = malloc(sizeof *pe->ext);
-            if(!pe->ext)
-                goto cleanup; //Malloc Error
+        if(file_offset > filesz || pbo_lzss_impossible(pe))
+            goto cleanup; //Claims more than there is
 
-            pe->ext->len = 0;
-            pe->ext->entries = NULL;
-
-            //Add Header extension can fail should handle that
-            while(pbo_util_getdelim(buf, file, sizeof buf, '\0') > 0)
-                pbo_add_header_extension(pe->ext, buf);
-            pbo_add_header_extension(pe->ext, "\0");
-        }
-
-        if(pbo_list_add_entry(d, pe))
-            goto cleanup;
-
-        if(!sz && i)
+        if(!sz && !i) { //Header Extension
+            pe->ext = pbo_ext_new();
+            if(!pe->ext) {
+                ret = PBO_ERROR_MALLOC;
+                goto cleanup;
+            }
+            if((ret = pbo_ext_parse(pe->ext, file)))
+                goto cleanup;
+            ret = PBO_ERROR_BROKEN;
+        } else if(!sz)
             break;
     }
-    d->headersz = ftell(file);
+    d->headersz = pbo_reader_tell(file);
+    if(d->headersz > filesz - file_offset)
+        goto cleanup;
+    pbo_checksum_load(d);
+
+    ret = PBO_ERROR_MALLOC;
+    if(pbo_index_build(d))
+        goto cleanup;
+
+    free(file);
+    pbo_io_end(d, &io);
     d->state = EXISTING;
-    fclose(file);
     return PBO_SUCCESS;
 
 cleanup:
-    if(pe){
-        free(pe->name);
-        free(pe->ext);
-    }
-    free(pe);
-    fclose(file);
-    return PBO_ERROR_MALLOC;
+    pbo_clear_list(d);
+    d->headersz = 0;
+    free(file);
+    pbo_io_end(d, &io);
+    return ret;
 }
 
-pbo_error pbo_write(pbo_t d)
+pbo_error pbo_read_header(pbo_t d)
+{
+    struct pbo_span s;
+    pbo_trace_begin(&s, PBO_OP_READ_HEADER, d ? d->filename : NULL);
+    return pbo_trace_end(&s, pbo_read_header_untraced(d));
+}
+
+static pbo_error pbo_write_untraced(pbo_t d)
 {
     if(!d)
         return PBO_ERROR_NEXIST;
@@ -208,99 +269,447 @@ pbo_error pbo_write(pbo_t d)
     if(d->root == NULL)
         return PBO_ERROR_STATE;
 
-    FILE *file = fopen(d->filename, "w");
-    if(!file)
-        return PBO_ERROR_IO;
-
-    //Add the dummy entry to indicate end of header
-    struct pbo_entry *pe = malloc(sizeof *pe);
-    if(!pe)
-        goto cleanup; //Malloc Error
-
-    pe->name = pbo_util_strdup("");
-    if(!pe->name)
-        goto cleanup;
+    if(d->canonical && pbo_sort_entries(d))
+        return PBO_ERROR_MALLOC;
 
-    pe->properties[PACKING_METHOD] = 0;
-    pe->properties[ORIGINAL_SIZE] = 0;
-    pe->properties[RES] = 0;
-    pe->properties[TIME_STAMP] = 0;
-    pe->properties[DATA_SIZE] = 0;
-    pe->file_offset = 0;
-    pe->data = NULL;
-    pe->ext = NULL;
-    if(pbo_list_add_entry(d, pe))
-        goto cleanup;
+    pbo_error ret = pbo_blocks_refuse(d);
+    if(!ret)
+        ret = pbo_blocks_pack(d);
+    if(!ret)
+        ret = pbo_finalize_header(d);
+    if(ret)
+        return ret;
+
+    //Files are written next to the target and replace it once complete
+    char *tmp = NULL;
+    struct direct_writer *direct = NULL;
+    pbo_io io = d->io;
+    if(!io.ops) {
+        if(!d->filename)
+            return PBO_ERROR_NEXIST;
+        pbo_io_release(d);
+        tmp = pbo_atomic_temp(d->filename);
+        if(!tmp)
+            return PBO_ERROR_IO;
+
+        //Direct I/O falls back where the filesystem refuses it
+        if(d->direct)
+            direct = pbo_direct_open(tmp);
+        if(!direct && pbo_io_open_path(&io, tmp, IO_CREATE)) {
+            pbo_atomic_abort(tmp);
+            return PBO_ERROR_IO;
+        }
+    }
 
-    //Finalize the header extension at d->root
-    if(*d->root->data->name == '\0')
-        pbo_add_header_extension(d->root->data->ext, "");
+    struct io_writer *file = malloc(sizeof *file);
+    if(!file) {
+        if(direct)
+            pbo_direct_close(direct);
+        else
+            pbo_io_end(d, &io);
+        if(tmp)
+            pbo_atomic_abort(tmp);
+        return PBO_ERROR_MALLOC;
+    }
+    pbo_writer_init(file, &io, 0);
+    file->direct = direct;
 
     SHA1Context ctx;
     SHA1Reset(&ctx);
 
     //First write the header
-    for(struct list_entry *e = d->root; e; e = e->next) {
-        WRITE_N_SHA(e->data->name, 1, strlen(e->data->name) + 1, file, &ctx);
-        WRITE_N_SHA(e->data->properties, 4, 5, file, &ctx);
-        if(e->data->ext) {
-            for(unsigned int i = 0; i < e->data->ext->len; i++) {
-                WRITE_N_SHA(e->data->ext->entries[i], 1, strlen(e->data->ext->entries[i]) + 1, file, &ctx);
-            }
-        }
-    }
+    pbo_write_header(d, file, &ctx);
 
-    //Then write the data block
+    //Then write the data block, hashing the chunk being written on the side
+    size_t datasz = 0;
+    for(struct list_entry *e = d->root; e; e = e->next)
+        datasz += e->data->properties[DATA_SIZE];
+
+    struct pbo_hasher h;
+    pbo_hasher_start(&h, &ctx, datasz > HASHER_CHUNK);
     for(struct list_entry *e = d->root; e; e = e->next){
-        if(*e->data->name != '\0'){
-            WRITE_N_SHA(e->data->data, 1, e->data->properties[DATA_SIZE], file, &ctx);
+        if(*e->data->name == '\0')
+            continue;
+
+        const unsigned char *p = e->data->data;
+        for(size_t left = e->data->properties[DATA_SIZE]; left;) {
+            size_t n = left < HASHER_CHUNK ? left : HASHER_CHUNK;
+            pbo_hasher_input(&h, p, n);
+            pbo_writer_write(file, p, n);
+            p += n;
+            left -= n;
         }
     }
 
     //Finalize SHA and write it at the end
     uint8_t sha[SHA1HashSize];
-    SHA1Result(&ctx, sha);
-    fputc('\0', file); //Format specifies a null before the hash
-    fwrite(sha, 1, SHA1HashSize, file);
+    pbo_hasher_result(&h, sha);
+    pbo_writer_write(file, "", 1); //Format specifies a null before the hash
+    pbo_writer_write(file, sha, SHA1HashSize);
+
+    ret = pbo_writer_flush(file) ? PBO_ERROR_IO : PBO_SUCCESS;
+
+    if(direct) {
+        if(pbo_direct_close(direct))
+            ret = PBO_ERROR_IO;
+    } else {
+        //An attached io may have held something longer before
+        if(!ret && !tmp && io.ops->truncate && io.ops->truncate(io.handle, file->pos))
+            ret = PBO_ERROR_IO;
+        pbo_io_end(d, &io);
+    }
+    free(file);
 
-    fclose(file);
+    if(tmp) {
+        if(ret)
+            pbo_atomic_abort(tmp);
+        else
+            ret = pbo_atomic_finish(tmp, d->filename, d->batch);
+    }
+    return ret;
+}
+
+pbo_error pbo_write(pbo_t d)
+{
+    struct pbo_span s;
+    pbo_trace_begin(&s, PBO_OP_WRITE, d ? d->filename : NULL);
+    return pbo_trace_end(&s, pbo_write_untraced(d));
+}
+
+pbo_error pbo_edit(pbo_t d)
+{
+    if(!d)
+        return PBO_ERROR_NEXIST;
+    if(d->state != EXISTING)
+        return PBO_ERROR_STATE;
+
+    pbo_cache_forget(d);
+
+    //Detach the terminating entry, pbo_commit puts it back after any new files
+    struct list_entry *prev = NULL;
+    for(struct list_entry *e = d->root; e != d->last; e = e->next)
+        prev = e;
+    if(prev && *d->last->data->name == '\0') {
+        pbo_free_entry(d->last->data);
+        free(d->last);
+        prev->next = NULL;
+        d->last = prev;
+    }
+
+    //Same for the empty string closing the header extension
+    if(d->root->data->ext)
+        pbo_ext_unfinalize(d->root->data->ext);
+
+    pbo_index_free(d); //Rebuilt by pbo_commit
+    d->state = EDIT;
     return PBO_SUCCESS;
+}
 
-cleanup:
-    fclose(file);
-    if(pe)
-        free(pe->name);
-    free(pe);
-    return PBO_ERROR_MALLOC;
+pbo_error pbo_remove_file(pbo_t d, const char *filename)
+{
+    if(!d || !filename)
+        return PBO_ERROR_NEXIST;
+    if(d->state != NEW && d->state != EDIT)
+        return PBO_ERROR_STATE;
+    if(*filename == '\0')
+        return PBO_ERROR_NEXIST;
+
+    struct list_entry *prev = NULL;
+    for(struct list_entry *e = d->root; e; prev = e, e = e->next) {
+        if(!*e->data->name || !pbo_util_name_eq(e->data->name, filename))
+            continue;
+
+        if(prev)
+            prev->next = e->next;
+        else
+            d->root = e->next;
+        if(d->last == e)
+            d->last = prev;
+
+        pbo_free_entry(e->data);
+        free(e);
+        return PBO_SUCCESS;
+    }
+    return PBO_ERROR_NEXIST; //Doesn't exist
+}
+
+/* Entries keep their relative order, so data that only has to shift is moved
+ * inside the file and entries whose position didn't change are not touched.
+ * The trailing SHA1 covers the header, so the data block is streamed once
+ * to rehash it. */
+static pbo_error pbo_commit_untraced(pbo_t d)
+{
+    if(!d)
+        return PBO_ERROR_NEXIST;
+    if(d->state != EDIT)
+        return PBO_ERROR_STATE;
+
+    if(d->root == NULL)
+        return PBO_ERROR_STATE;
+
+    if(d->io.ops && !d->io.ops->truncate)
+        return PBO_ERROR_STATE; //Can't shrink in place
+
+    pbo_error ret = pbo_blocks_refuse(d);
+    if(!ret)
+        ret = pbo_blocks_pack(d);
+    if(!ret)
+        ret = pbo_finalize_header(d);
+    if(ret)
+        return ret;
+
+    pbo_io io;
+    if(pbo_io_begin(d, IO_UPDATE, &io))
+        return PBO_ERROR_IO;
+
+    size_t oldhsz = d->headersz;
+    size_t newhsz = pbo_header_size(d);
+    size_t n = 0;
+    for(struct list_entry *e = d->root; e; e = e->next)
+        n++;
+
+    struct pbo_entry **v = malloc(n * sizeof *v);
+    size_t *dst = malloc(n * sizeof *dst);
+    struct io_writer *file = malloc(sizeof *file);
+    if(!v || !dst || !file) {
+        free(v);
+        free(dst);
+        free(file);
+        pbo_io_end(d, &io);
+        return PBO_ERROR_MALLOC;
+    }
+
+    size_t off = newhsz;
+    n = 0;
+    for(struct list_entry *e = d->root; e; e = e->next) {
+        v[n] = e->data;
+        dst[n++] = off;
+        off += e->data->properties[DATA_SIZE];
+    }
+    size_t datasz = off - newhsz;
+
+    //Entries moving towards the start of the file go first, in order,
+    //then the ones moving towards the end in reverse order
+    int err = 0;
+    for(size_t i = 0; i < n && !err; i++)
+        if(!v[i]->data && dst[i] < oldhsz + v[i]->file_offset)
+            err = pbo_util_move(&io, oldhsz + v[i]->file_offset, dst[i], v[i]->properties[DATA_SIZE]);
+    for(size_t i = n; i-- && !err;)
+        if(!v[i]->data && dst[i] > oldhsz + v[i]->file_offset)
+            err = pbo_util_move(&io, oldhsz + v[i]->file_offset, dst[i], v[i]->properties[DATA_SIZE]);
+
+    //Write the new and replaced files and settle the offsets
+    for(size_t i = 0; i < n && !err; i++) {
+        struct pbo_entry *pe = v[i];
+        if(pe->data) {
+            size_t sz = pe->properties[DATA_SIZE];
+            if(io.ops->write_at(io.handle, pe->data, sz, dst[i]) != sz) {
+                err = 1;
+                break;
+            }
+            pbo_release_data(pe);
+        }
+        pe->file_offset = dst[i] - newhsz;
+    }
+    free(v);
+    free(dst);
+    if(err)
+        goto ioerror;
+
+    SHA1Context ctx;
+    SHA1Reset(&ctx);
+
+    pbo_writer_init(file, &io, 0);
+    pbo_write_header(d, file, &ctx);
+    if(pbo_writer_flush(file))
+        goto ioerror;
+
+    uint8_t sha[SHA1HashSize];
+    if(pbo_hasher_io(&io, newhsz, datasz, &ctx, sha))
+        goto ioerror;
+
+    pbo_writer_init(file, &io, newhsz + datasz);
+    pbo_writer_write(file, "", 1);
+    pbo_writer_write(file, sha, SHA1HashSize);
+    if(pbo_writer_flush(file) || io.ops->truncate(io.handle, file->pos))
+        goto ioerror;
+
+    free(file);
+    pbo_io_end(d, &io);
+    d->headersz = newhsz;
+    d->state = EXISTING;
+    pbo_index_build(d); //The file is committed either way, lookups scan without it
+    return PBO_SUCCESS;
+
+ioerror:
+    free(file);
+    pbo_io_end(d, &io);
+    return PBO_ERROR_IO;
+}
+
+pbo_error pbo_commit(pbo_t d)
+{
+    struct pbo_span s;
+    pbo_trace_begin(&s, PBO_OP_COMMIT, d ? d->filename : NULL);
+    return pbo_trace_end(&s, pbo_commit_untraced(d));
+}
+
+static pbo_error pbo_verify_untraced(pbo_t d)
+{
+    if(!d)
+        return PBO_ERROR_NEXIST;
+    if(d->state != CLEAR && d->state != EXISTING)
+        return PBO_ERROR_STATE;
+
+    pbo_io io;
+    if(pbo_io_begin(d, IO_READ, &io))
+        return PBO_ERROR_IO;
+    pbo_error ret = pbo_verify_io(&io);
+    pbo_io_end(d, &io);
+    return ret;
+}
+
+pbo_error pbo_verify(pbo_t d)
+{
+    struct pbo_span s;
+    pbo_trace_begin(&s, PBO_OP_VERIFY, d ? d->filename : NULL);
+    return pbo_trace_end(&s, pbo_verify_untraced(d));
+}
+
+struct verify_item {
+    size_t size;
+    size_t ind;
+};
+
+struct verify_job {
+    const char **filenames;
+    pbo_error *results;
+    struct verify_item *order;
+};
+
+static void pbo_verify_worker(size_t i, void *user)
+{
+    struct verify_job *job = user;
+    size_t ind = job->order[i].ind;
+    job->results[ind] = pbo_verify_path(job->filenames[ind]);
+}
+
+static int pbo_verify_cmp(const void *a, const void *b)
+{
+    size_t x = ((const struct verify_item *)a)->size, y = ((const struct verify_item *)b)->size;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/* Archives are handed out largest first so a big one picked up last
+ * doesn't keep a single core busy after everything else is done. */
+pbo_error pbo_verify_many(const char **filenames, size_t count, pbo_error *results, int threads)
+{
+    if(!filenames || !results)
+        return PBO_ERROR_NEXIST;
+
+    struct verify_item *order = malloc(count * sizeof *order);
+    if(count && !order)
+        return PBO_ERROR_MALLOC;
+
+    for(size_t i = 0; i < count; i++) {
+        struct stat st;
+        order[i].ind = i;
+        order[i].size = stat(filenames[i], &st) ? 0 : (size_t)st.st_size;
+    }
+    qsort(order, count, sizeof *order, pbo_verify_cmp);
+
+    struct verify_job job = { filenames, results, order };
+    pbo_pool_run(count, threads, pbo_verify_worker, &job);
+    free(order);
+
+    for(size_t i = 0; i < count; i++)
+        if(results[i] != PBO_SUCCESS)
+            return PBO_ERROR_BROKEN;
+    return PBO_SUCCESS;
+}
+
+size_t pbo_entry_size(const struct pbo_entry *pe)
+{
+    if(pbo_entry_packed(pe))
+        return pe->properties[ORIGINAL_SIZE];
+    return pe->properties[DATA_SIZE];
+}
+
+//Reads the decoded contents of pe into buf, pbo_entry_size bytes of it
+pbo_error pbo_load_entry(pbo_t d, const struct pbo_entry *pe, void *buf)
+{
+    if(d->cache && !pbo_cache_get(d, pe, buf))
+        return PBO_SUCCESS;
+
+    pbo_io io;
+    if(pbo_io_begin(d, IO_READ, &io))
+        return PBO_ERROR_IO;
+
+    //Stored bytes are checked against their checksum before anything else
+    pbo_error ret = PBO_SUCCESS;
+    size_t sz = pe->properties[DATA_SIZE];
+    uint64_t off = pe->file_offset + d->headersz;
+    if(pbo_entry_packed(pe)) {
+        unsigned char *packed = malloc(sz ? sz : 1);
+        if(!packed)
+            ret = PBO_ERROR_MALLOC;
+        else if(io.ops->read_at(io.handle, packed, sz, off) != sz)
+            ret = PBO_ERROR_IO;
+        else if(pe->has_crc && pbo_crc32c(0, packed, sz) != pe->crc)
+            ret = PBO_ERROR_BROKEN;
+        else if(pbo_entry_decode(pe, packed, sz, buf))
+            ret = PBO_ERROR_BROKEN;
+        free(packed);
+    } else if(io.ops->read_at(io.handle, buf, sz, off) != sz)
+        ret = PBO_ERROR_IO;
+    else if(pe->has_crc && pbo_crc32c(0, buf, sz) != pe->crc)
+        ret = PBO_ERROR_BROKEN;
+    pbo_io_end(d, &io);
+
+    if(!ret && d->cache)
+        pbo_cache_put(d, pe, buf, pbo_entry_size(pe));
+    return ret;
 }
 
 //TODO: Add some other way of reading files. Possibly a fread like API.
-size_t pbo_read_file(pbo_t d, const char *filename, void *buf, size_t size)
+//Sets *n to the bytes read, the status is for tracing
+static pbo_error pbo_read_file_untraced(pbo_t d, const char *filename, void *buf, size_t size, size_t *n)
 {
-    if(!d || !filename || d->state != EXISTING)
-        return 0;
+    *n = 0;
+    if(!d || !filename)
+        return PBO_ERROR_NEXIST;
+    if(d->state != EXISTING)
+        return PBO_ERROR_STATE;
 
     struct list_entry *e = pbo_find_file(d, filename);
     if(!e)
-        return 0; //Doesn't exist
+        return PBO_ERROR_NEXIST; //Doesn't exist
 
-    if(e->data->properties[DATA_SIZE] > size)
-        return 0; //Doesn't fit
+    size_t sz = pbo_entry_size(e->data);
+    if(sz > size)
+        return PBO_ERROR_STATE; //Doesn't fit
 
-    FILE *file = fopen(d->filename, "r");
-    if(!file)
-        return 0; //I/O Error
+    pbo_error ret = pbo_load_entry(d, e->data, buf);
+    if(!ret)
+        *n = sz;
+    return ret;
+}
 
-    fseek(file, e->data->file_offset + d->headersz, SEEK_SET);
-    size_t sz = fread(buf, 1, e->data->properties[DATA_SIZE], file);
-    fclose(file);
-    return sz;
+size_t pbo_read_file(pbo_t d, const char *filename, void *buf, size_t size)
+{
+    struct pbo_span s;
+    size_t n;
+    pbo_trace_begin(&s, PBO_OP_READ_FILE, filename);
+    pbo_trace_end(&s, pbo_read_file_untraced(d, filename, buf, size, &n));
+    return n;
 }
 
 const char *pbo_read_extension(pbo_t d, int ind)
 {
     if(!d || d->state != EXISTING || !d->root->data->ext)
         return NULL;
+    if(ind < 0 || (size_t)ind >= d->root->data->ext->len)
+        return NULL;
 
     return d->root->data->ext->entries[ind];
 }
@@ -328,11 +737,11 @@ pbo_error pbo_add_extension(pbo_t d, const char *e)
 {
     if(!d)
         return PBO_ERROR_NEXIST;
-    if(d->state != NEW)
+    if(d->state != NEW && d->state != EDIT)
         return PBO_ERROR_STATE;
 
     struct pbo_entry *pe = NULL;
-    if(*d->root->data->name != '\0') {
+    if(!d->root || *d->root->data->name != '\0') {
         //Add the dummy entry with the extension
         pe = malloc(sizeof *pe);
         if(!pe)
@@ -347,14 +756,13 @@ pbo_error pbo_add_extension(pbo_t d, const char *e)
 
         pe->file_offset = 0;
 
-        pe->ext = malloc(sizeof *pe->ext);
+        pe->ext = pbo_ext_new();
         if(!pe->ext)
             goto cleanup; //Malloc Error
 
         pe->data = NULL;
-
-        pe->ext->len = 0;
-        pe->ext->entries = NULL;
+        pe->data_free = NULL;
+        pe->has_crc = 0;
 
         //Insert the header extension entry at the beginning
         struct list_entry *le = malloc(sizeof *le);
@@ -364,13 +772,17 @@ pbo_error pbo_add_extension(pbo_t d, const char *e)
         le->next = d->root;
         le->data = pe;
         d->root = le;
+        if(!d->last)
+            d->last = le;
     }
 
-    return pbo_add_header_extension(d->root->data->ext, e);
+    return pbo_ext_add(d->root->data->ext, e);
 
 cleanup:
-    if(pe)
-        free(pe->ext);
+    if(pe) {
+        free(pe->name);
+        pbo_ext_free(pe->ext);
+    }
     free(pe);
     return PBO_ERROR_MALLOC;
 }
@@ -379,7 +791,7 @@ pbo_error pbo_add_file_d(pbo_t d, const char *name, void *data,  size_t size)
 {
     if(!d)
         return PBO_ERROR_NEXIST;
-    if(d->state != NEW)
+    if(d->state != NEW && d->state != EDIT)
         return PBO_ERROR_STATE;
 
     struct pbo_entry *pe = malloc(sizeof *pe);
@@ -399,13 +811,15 @@ pbo_error pbo_add_file_d(pbo_t d, const char *name, void *data,  size_t size)
     pe->properties[PACKING_METHOD] = 0;
     pe->properties[ORIGINAL_SIZE] = size;
     pe->properties[RES] = 0;
-    pe->properties[TIME_STAMP] = (uint32_t)time(NULL);
+    pe->properties[TIME_STAMP] = pbo_timestamp_for(d, (time_t)-1);
     pe->properties[DATA_SIZE] = size;
 
     pe->file_offset = 0;
     pe->ext = NULL;
+    pe->data_free = NULL;
+    pe->has_crc = 0;
 
-    return pbo_list_add_entry(d, pe);
+    return pbo_insert_entry(d, pe);
 
 cleanup:
     if(pe)
@@ -418,7 +832,7 @@ pbo_error pbo_add_file_f(pbo_t d, const char *name, FILE *file)
 {
     if(!d || !file)
         return PBO_ERROR_NEXIST;
-    if(d->state != NEW)
+    if(d->state != NEW && d->state != EDIT)
         return PBO_ERROR_STATE;
 
     struct pbo_entry *pe = malloc(sizeof *pe);
@@ -434,6 +848,9 @@ pbo_error pbo_add_file_f(pbo_t d, const char *name, FILE *file)
     size_t filesz = ftell(file);
     rewind(file);
 
+    struct stat st;
+    time_t mtime = fstat(fileno(file), &st) ? (time_t)-1 : st.st_mtime;
+
     pe->data = malloc(filesz);
     if(!pe->data)
         goto cleanup;
@@ -444,12 +861,15 @@ pbo_error pbo_add_file_f(pbo_t d, const char *name, FILE *file)
     pe->properties[PACKING_METHOD] = 0;
     pe->properties[ORIGINAL_SIZE] = filesz;
     pe->properties[RES] = 0;
-    pe->properties[TIME_STAMP] = (uint32_t)time(NULL);
+    pe->properties[TIME_STAMP] = pbo_timestamp_for(d, mtime);
     pe->properties[DATA_SIZE] = filesz;
 
+    pe->file_offset = 0;
     pe->ext = NULL;
+    pe->data_free = NULL;
+    pe->has_crc = 0;
 
-    return  pbo_list_add_entry(d, pe);
+    return pbo_insert_entry(d, pe);
 
 cleanup:
     if(pe)
@@ -469,6 +889,92 @@ pbo_error pbo_add_file_p(pbo_t d, const char *name, const char *path)
     return ret;
 }
 
+pbo_error pbo_add_file_own(pbo_t d, const char *name, void *data, size_t size, pbo_freecb cb, void *user)
+{
+    pbo_error ret;
+    if(!d || !name || (!data && size))
+        ret = PBO_ERROR_NEXIST;
+    else if(d->state != NEW && d->state != EDIT)
+        ret = PBO_ERROR_STATE;
+    else
+        ret = pbo_add_entry(d, name, data, size, pbo_timestamp_for(d, (time_t)-1), cb, user);
+
+    //Handed over either way, the caller never has to tell whether to free it
+    if(ret && data) {
+        if(cb)
+            cb(data, user);
+        else
+            free(data);
+    }
+    return ret;
+}
+
+static void pbo_util_nofree(void *data, void *user)
+{
+    (void)data;
+    (void)user;
+}
+
+pbo_error pbo_add_file_borrow(pbo_t d, const char *name, const void *data, size_t size)
+{
+    if(!d || !name || (!data && size))
+        return PBO_ERROR_NEXIST;
+    if(d->state != NEW && d->state != EDIT)
+        return PBO_ERROR_STATE;
+
+    //Never written through, the cast only saves a second pointer in the entry
+    return pbo_add_entry(d, name, (unsigned char *)data, size, pbo_timestamp_for(d, (time_t)-1), pbo_util_nofree, NULL);
+}
+
+//Takes over data on success, cb releases it (free() if NULL)
+pbo_error pbo_add_entry(pbo_t d, const char *name, unsigned char *data, size_t size, uint32_t timestamp,
+                        pbo_freecb cb, void *user)
+{
+    struct pbo_entry *pe = malloc(sizeof *pe);
+    if(!pe)
+        return PBO_ERROR_MALLOC;
+
+    pe->name = pbo_util_strdup(name);
+    if(!pe->name) {
+        free(pe);
+        return PBO_ERROR_MALLOC;
+    }
+
+    pe->data = data;
+    pe->data_free = cb;
+    pe->data_user = user;
+    pe->properties[PACKING_METHOD] = 0;
+    pe->properties[ORIGINAL_SIZE] = size;
+    pe->properties[RES] = 0;
+    pe->properties[TIME_STAMP] = timestamp;
+    pe->properties[DATA_SIZE] = size;
+
+    pe->file_offset = 0;
+    pe->ext = NULL;
+    pe->has_crc = 0;
+
+    if(pbo_insert_entry(d, pe)) {
+        pe->data = NULL; //Still the caller's
+        pe->data_free = NULL;
+        pbo_free_entry(pe);
+        return PBO_ERROR_MALLOC;
+    }
+    return PBO_SUCCESS;
+}
+
+//mtime is (time_t)-1 for data that didn't come from a file
+uint32_t pbo_timestamp_for(pbo_t d, time_t mtime)
+{
+    switch(d->tsmode) {
+    case PBO_TIMESTAMP_EPOCH:
+        return d->epoch;
+    case PBO_TIMESTAMP_SOURCE:
+        return mtime == (time_t)-1 ? d->epoch : (uint32_t)mtime;
+    default:
+        return (uint32_t)time(NULL);
+    }
+}
+
 pbo_error pbo_get_file_list(pbo_t d, pbo_listcb cb, void *user)
 {
     if(!d)
@@ -477,24 +983,103 @@ pbo_error pbo_get_file_list(pbo_t d, pbo_listcb cb, void *user)
         return PBO_ERROR_STATE;
 
     for(struct list_entry *e = d->root; e; e = e->next)
-        cb(e->data->name, user);
+        if(*e->data->name != '\0')
+            cb(e->data->name, user);
 
     return PBO_SUCCESS;
 }
 
-size_t pbo_get_file_size(pbo_t d, const char *filename)
+pbo_error pbo_iter_begin(pbo_t d, pbo_iterator *it)
 {
-    if(!d)
-        return 0;
+    if(!d || !it)
+        return PBO_ERROR_NEXIST;
+    if(d->state != EXISTING)
+        return PBO_ERROR_STATE;
+
+    it->next = d->root;
+    it->headersz = d->headersz;
+    return PBO_SUCCESS;
+}
+
+const pbo_file_info *pbo_iter_next(pbo_iterator *it)
+{
+    if(!it)
+        return NULL;
+
+    const struct list_entry *e = it->next;
+    while(e && *e->data->name == '\0') //Skip the extension and terminator
+        e = e->next;
+    if(!e) {
+        it->next = NULL;
+        return NULL;
+    }
+    it->next = e->next;
+
+    pbo_fill_info(e->data, it->headersz, &it->info);
+    return &it->info;
+}
+
+void pbo_fill_info(const struct pbo_entry *pe, size_t headersz, pbo_file_info *info)
+{
+    info->name = pe->name;
+    info->packing_method = pe->properties[PACKING_METHOD];
+    info->original_size = pe->properties[ORIGINAL_SIZE];
+    info->timestamp = pe->properties[TIME_STAMP];
+    info->size = pe->properties[DATA_SIZE];
+    info->offset = headersz + pe->file_offset;
+}
+
+static pbo_error pbo_get_file_size_untraced(pbo_t d, const char *filename, size_t *n)
+{
+    *n = 0;
+    if(!d || !filename)
+        return PBO_ERROR_NEXIST;
 
     struct list_entry *e = pbo_find_file(d, filename);
     if(!e)
-        return 0; //Doesn't Exist
+        return PBO_ERROR_NEXIST; //Doesn't Exist
 
-    return e->data->properties[DATA_SIZE];
+    *n = pbo_entry_size(e->data);
+    return PBO_SUCCESS;
 }
 
-pbo_error pbo_write_to_file(pbo_t d, const char *filename, FILE *file)
+size_t pbo_get_file_size(pbo_t d, const char *filename)
+{
+    struct pbo_span s;
+    size_t n;
+    pbo_trace_begin(&s, PBO_OP_LOOKUP, filename);
+    pbo_trace_end(&s, pbo_get_file_size_untraced(d, filename, &n));
+    return n;
+}
+
+static pbo_error pbo_write_blocks(pbo_t d, const struct pbo_entry *pe, FILE *file)
+{
+    pbo_io io;
+    if(pbo_io_begin(d, IO_READ, &io))
+        return PBO_ERROR_IO;
+
+    struct blocks_reader r;
+    unsigned char *buf = NULL;
+    pbo_error ret = pbo_blocks_open(&r, &io, d->headersz + pe->file_offset, pe);
+    //Checked up front, what went into file can't be taken back
+    if(!ret)
+        ret = pbo_blocks_verify(&r, pe);
+    if(!ret && !(buf = malloc(r.bsize)))
+        ret = PBO_ERROR_MALLOC;
+    for(size_t at = 0; !ret && at < r.orig; at += r.bsize) {
+        size_t n = r.orig - at < r.bsize ? r.orig - at : r.bsize;
+        ret = pbo_blocks_get(&r, at, n, buf);
+        if(!ret && fwrite(buf, 1, n, file) != n)
+            ret = PBO_ERROR_IO;
+    }
+
+    free(buf);
+    pbo_blocks_close(&r);
+    pbo_io_end(d, &io);
+    return ret;
+}
+
+static pbo_error pbo_write_to_file_untraced(pbo_t d, const char *filename, FILE *file)
 {
     if(!d)
         return PBO_ERROR_NEXIST;
@@ -503,18 +1088,72 @@ pbo_error pbo_write_to_file(pbo_t d, const char *filename, FILE *file)
     if(!le)
         return PBO_ERROR_NEXIST; //Doesn't exist
 
-    FILE *f = fopen(d->filename, "r");
-    if(!f)
-        return PBO_ERROR_IO;
+    //Blocks are streamed one at a time, LZSS has to be decoded whole
+    if(le->data->properties[PACKING_METHOD] == PBO_PACKING_BLOCKS)
+        return pbo_write_blocks(d, le->data, file);
+    if(le->data->properties[PACKING_METHOD] == PBO_PACKING_COMPRESSED) {
+        size_t sz = pbo_entry_size(le->data);
+        unsigned char *data = malloc(sz ? sz : 1);
+        if(!data)
+            return PBO_ERROR_MALLOC;
+        pbo_error ret = pbo_load_entry(d, le->data, data);
+        if(!ret && fwrite(data, 1, sz, file) != sz)
+            ret = PBO_ERROR_IO;
+        free(data);
+        return ret;
+    }
 
-    fseek(f, le->data->file_offset + d->headersz, SEEK_SET);
+    //Small entries go through the stack, big ones are streamed in big chunks
     size_t sz = le->data->properties[DATA_SIZE];
-    char buf[sz];
-    fread(buf, 1, sz, f);
-    fwrite(buf, 1, sz, file);
-    fclose(f);
+    unsigned char stackbuf[IOBUFSZ], *buf = stackbuf;
+    size_t bufsz = sizeof stackbuf;
+    if(sz > bufsz) {
+        size_t want = sz < STREAMBUFSZ ? sz : STREAMBUFSZ;
+        unsigned char *heapbuf = malloc(want);
+        if(heapbuf)
+            buf = heapbuf, bufsz = want;
+    }
 
-    return PBO_SUCCESS;
+    pbo_io io;
+    if(pbo_io_begin(d, IO_READ, &io)) {
+        if(buf != stackbuf)
+            free(buf);
+        return PBO_ERROR_IO;
+    }
+
+    pbo_error ret = PBO_SUCCESS;
+    uint64_t off = le->data->file_offset + d->headersz;
+    uint32_t crc = 0;
+    int streaming = sz > IOBUFSZ;
+    if(streaming)
+        pbo_io_advise(&io, off, sz, ADVISE_SEQUENTIAL);
+    for(size_t left = sz; left;) {
+        size_t n = left < bufsz ? left : bufsz;
+        if(io.ops->read_at(io.handle, buf, n, off) != n || fwrite(buf, 1, n, file) != n) {
+            ret = PBO_ERROR_IO;
+            break;
+        }
+        if(le->data->has_crc)
+            crc = pbo_crc32c(crc, buf, n);
+        if(streaming)
+            pbo_io_advise(&io, off, n, ADVISE_DONTNEED);
+        off += n;
+        left -= n;
+    }
+    //Only known once it's all out, file holds the damaged bytes then
+    if(!ret && le->data->has_crc && crc != le->data->crc)
+        ret = PBO_ERROR_BROKEN;
+    pbo_io_end(d, &io);
+    if(buf != stackbuf)
+        free(buf);
+    return ret;
+}
+
+pbo_error pbo_write_to_file(pbo_t d, const char *filename, FILE *file)
+{
+    struct pbo_span s;
+    pbo_trace_begin(&s, PBO_OP_READ_FILE, filename);
+    return pbo_trace_end(&s, pbo_write_to_file_untraced(d, filename, file));
 }
 
 void pbo_dump_header(pbo_t d)
@@ -537,27 +1176,116 @@ void pbo_dump_header(pbo_t d)
     }
 }
 
-static pbo_error pbo_add_header_extension(struct header_extension *he, const char *e)
+//Allocates first, so d is unchanged if it fails
+static pbo_error pbo_insert_entry(pbo_t d, struct pbo_entry *pe)
 {
-    if(he->len % 4 == 0) {
-        char **new = realloc(he->entries, (he->len + 4) * sizeof *new);
-        if(!new)
-            return PBO_ERROR_MALLOC; //Malloc Error
-        he->entries = new;
+    struct list_entry *le = malloc(sizeof *le);
+    if(!le)
+        return PBO_ERROR_MALLOC;
+
+    le->data = pe;
+    pbo_insert_node(d, le);
+    return PBO_SUCCESS;
+}
+
+//Links le into d, in an edit session in place of an entry of the same name
+static void pbo_insert_node(pbo_t d, struct list_entry *le)
+{
+    struct list_entry *e = d->state == EDIT ? pbo_find_file(d, le->data->name) : NULL;
+    if(e && e->data->properties[DATA_SIZE] == le->data->properties[DATA_SIZE]) {
+        //Same size, take over its place so nothing else has to move
+        pbo_free_entry(e->data);
+        e->data = le->data;
+        free(le);
+        return;
     }
-    he->entries[he->len] = pbo_util_strdup(e);
-    if(!he->entries[he->len])
+    if(e)
+        pbo_remove_file(d, le->data->name);
+
+    pbo_list_link(d, le);
+}
+
+/* Moves every entry of from into d as if each was added there, without
+ * allocating. from is left empty. */
+void pbo_take_entries(pbo_t d, pbo_t from)
+{
+    struct list_entry *le = from->root;
+    from->root = from->last = NULL;
+    while(le) {
+        struct list_entry *next = le->next;
+        pbo_insert_node(d, le);
+        le = next;
+    }
+}
+
+static pbo_error pbo_finalize_header(pbo_t d)
+{
+    //Already finalized by an earlier (possibly failed) write
+    if(d->last && d->last != d->root && *d->last->data->name == '\0')
+        return PBO_SUCCESS;
+
+    pbo_error ret = pbo_checksum_store(d);
+    if(ret)
+        return ret;
+
+    //Add the dummy entry to indicate end of header
+    struct pbo_entry *pe = malloc(sizeof *pe);
+    if(!pe)
+        return PBO_ERROR_MALLOC;
+
+    pe->name = pbo_util_strdup("");
+    if(!pe->name)
         goto cleanup;
-    he->len++;
 
+    pe->properties[PACKING_METHOD] = 0;
+    pe->properties[ORIGINAL_SIZE] = 0;
+    pe->properties[RES] = 0;
+    pe->properties[TIME_STAMP] = 0;
+    pe->properties[DATA_SIZE] = 0;
+    pe->file_offset = 0;
+    pe->data = NULL;
+    pe->data_free = NULL;
+    pe->ext = NULL;
+    pe->has_crc = 0;
+    if(pbo_list_add_entry(d, pe))
+        goto cleanup;
+
+    //Finalize the header extension at d->root
+    if(*d->root->data->name == '\0')
+        return pbo_ext_add(d->root->data->ext, "");
     return PBO_SUCCESS;
 
 cleanup:
-    if(he->len % 4 == 0)
-        he->entries = realloc(he->entries, (he->len) * sizeof *he->entries);
+    free(pe->name);
+    free(pe);
     return PBO_ERROR_MALLOC;
 }
 
+size_t pbo_header_size(pbo_t d)
+{
+    size_t sz = 0;
+    for(struct list_entry *e = d->root; e; e = e->next) {
+        sz += strlen(e->data->name) + 1 + 4 * 5;
+        if(e->data->ext)
+            for(unsigned int i = 0; i < e->data->ext->len; i++)
+                sz += strlen(e->data->ext->entries[i]) + 1;
+    }
+    return sz;
+}
+
+static void pbo_write_header(pbo_t d, struct io_writer *file, SHA1Context *ctx)
+{
+    for(struct list_entry *e = d->root; e; e = e->next) {
+        WRITE_N_SHA(e->data->name, 1, strlen(e->data->name) + 1, file, ctx);
+        WRITE_N_SHA(e->data->properties, 4, 5, file, ctx);
+        if(e->data->ext) {
+            for(unsigned int i = 0; i < e->data->ext->len; i++) {
+                WRITE_N_SHA(e->data->ext->entries[i], 1, strlen(e->data->ext->entries[i]) + 1, file, ctx);
+            }
+        }
+    }
+}
+
 static pbo_error pbo_list_add_entry(pbo_t d, struct pbo_entry *pe)
 {
     if(!d)
@@ -567,32 +1295,111 @@ static pbo_error pbo_list_add_entry(pbo_t d, struct pbo_entry *pe)
     if(!le)
         return PBO_ERROR_MALLOC; //Malloc Error
 
-    le->next = NULL;
     le->data = pe;
+    pbo_list_link(d, le);
+    return PBO_SUCCESS;
+}
 
+static void pbo_list_link(pbo_t d, struct list_entry *le)
+{
+    le->next = NULL;
     if(!d->root)
         d->root = le;
     else
         d->last->next = le;
     d->last = le;
+}
 
+struct sort_item {
+    const char *key;
+    size_t ord;
+    struct list_entry *le;
+};
+
+static int pbo_sort_cmp(const void *a, const void *b)
+{
+    const struct sort_item *x = a, *y = b;
+    int r = strcmp(x->key, y->key);
+    if(r)
+        return r;
+    return x->ord < y->ord ? -1 : x->ord > y->ord;
+}
+
+//Orders the files by normalised name, the header extension stays in front
+static pbo_error pbo_sort_entries(pbo_t d)
+{
+    struct list_entry *head = NULL;
+    struct list_entry *first = d->root;
+    if(first && *first->data->name == '\0') {
+        head = first;
+        first = first->next;
+    }
+
+    size_t n = 0, keysz = 0;
+    for(struct list_entry *e = first; e; e = e->next) {
+        n++;
+        keysz += strlen(e->data->name) + 1;
+    }
+    if(n < 2)
+        return PBO_SUCCESS;
+
+    struct sort_item *v = malloc(n * sizeof *v);
+    char *keys = malloc(keysz);
+    if(!v || !keys) {
+        free(v);
+        free(keys);
+        return PBO_ERROR_MALLOC;
+    }
+
+    char *k = keys;
+    n = 0;
+    for(struct list_entry *e = first; e; e = e->next) {
+        v[n].key = k;
+        v[n].ord = n;
+        v[n].le = e;
+        k += pbo_util_normalize(k, e->data->name, keysz - (k - keys)) + 1;
+        n++;
+    }
+    qsort(v, n, sizeof *v, pbo_sort_cmp);
+
+    for(size_t i = 0; i + 1 < n; i++)
+        v[i].le->next = v[i + 1].le;
+    v[n - 1].le->next = NULL;
+    d->last = v[n - 1].le;
+    if(head)
+        head->next = v[0].le;
+    else
+        d->root = v[0].le;
+
+    free(v);
+    free(keys);
     return PBO_SUCCESS;
 }
 
+static void pbo_free_entry(struct pbo_entry *pe)
+{
+    free(pe->name);
+    pbo_ext_free(pe->ext);
+    pbo_release_data(pe);
+    free(pe);
+}
+
+void pbo_release_data(struct pbo_entry *pe)
+{
+    if(pe->data_free)
+        pe->data_free(pe->data, pe->data_user);
+    else
+        free(pe->data);
+    pe->data = NULL;
+    pe->data_free = NULL;
+}
+
 static void pbo_clear_list(pbo_t d)
 {
     struct list_entry *e = d->root;
     while(e) {
         struct list_entry *t = e->next;
-        free(e->data->name);
-        if(e->data->ext) {
-            for(unsigned int i = 0; i < e->data->ext->len; i++)
-                free(e->data->ext->entries[i]);
-            free(e->data->ext->entries);
-            free(e->data->ext);
-        }
-        free(e->data->data);
-        free(e->data);
+        pbo_free_entry(e->data);
         free(e);
         e = t;
     }
@@ -605,30 +1412,78 @@ static struct list_entry *pbo_find_file(pbo_t d, const char *file)
     if(!d)
         return NULL;
 
-    for(struct list_entry *e = d->root; e; e = e->next)
-        if(!strcmp(e->data->name, file))
-            return e;
-    return NULL;
+    return pbo_index_find(d, file);
 }
 
-static int pbo_util_getdelim(unsigned char *dst, FILE *src, size_t dstsz, char delim)
+static int pbo_util_getdelim(char *dst, struct io_reader *src, size_t dstsz, char delim)
 {
     if(!dstsz || !dst)
         return -1;
 
-    char c = 0;
+    int c = 0;
     int sz = 0;
 
-    while(dstsz && (c = fgetc(src)) != EOF && c != delim)
+    while(dstsz && (c = pbo_reader_getc(src)) != EOF && c != delim)
         sz++, dstsz--, *dst++ = c;
 
-    if(dstsz && !feof(src))
+    if(dstsz && c != EOF)
         *dst = delim;
     else
         sz = -1;
     return sz;
 }
 
+static pbo_error pbo_verify_io(const pbo_io *io)
+{
+    uint64_t sz;
+    if(io->ops->size(io->handle, &sz))
+        return PBO_ERROR_IO;
+    if(sz < 1 + SHA1HashSize)
+        return PBO_ERROR_BROKEN; //Too short to even hold the hash
+
+    SHA1Context ctx;
+    SHA1Reset(&ctx);
+
+    uint8_t sha[SHA1HashSize], stored[1 + SHA1HashSize];
+    if(pbo_hasher_io(io, 0, sz - sizeof stored, &ctx, sha) ||
+       io->ops->read_at(io->handle, stored, sizeof stored, sz - sizeof stored) != sizeof stored)
+        return PBO_ERROR_IO;
+
+    if(stored[0] != '\0' || memcmp(stored + 1, sha, SHA1HashSize))
+        return PBO_ERROR_BROKEN;
+    return PBO_SUCCESS;
+}
+
+static pbo_error pbo_verify_path(const char *path)
+{
+    pbo_io io;
+    if(pbo_io_open_path(&io, path, IO_READ))
+        return PBO_ERROR_IO;
+
+    pbo_error ret = pbo_verify_io(&io);
+    pbo_io_close(&io);
+    return ret;
+}
+
+static int pbo_util_move(const pbo_io *io, uint64_t src, uint64_t dst, size_t len)
+{
+    unsigned char buf[IOBUFSZ];
+
+    //Copy back to front when moving towards the end so overlaps are safe
+    int backwards = dst > src;
+    for(size_t done = 0; done < len;) {
+        size_t n = len - done < sizeof buf ? len - done : sizeof buf;
+        size_t pos = backwards ? len - done - n : done;
+
+        if(io->ops->read_at(io->handle, buf, n, src + pos) != n)
+            return -1;
+        if(io->ops->write_at(io->handle, buf, n, dst + pos) != n)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
 static char *pbo_util_strdup(const char *src)
 {
     size_t len = strlen(src) + 1;
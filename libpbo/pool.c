@@ -0,0 +1,93 @@
+/* pool.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "pool.h"
+
+#define POOL_MAXTHREADS 256
+
+struct pool {
+    size_t n;
+    size_t next;
+    pbo_pool_fn fn;
+    void *user;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock;
+#endif
+};
+
+int pbo_pool_threads(int threads)
+{
+    if(threads > 0)
+        return threads < POOL_MAXTHREADS ? threads : POOL_MAXTHREADS;
+
+#if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n > 0)
+        return n < POOL_MAXTHREADS ? (int)n : POOL_MAXTHREADS;
+#endif
+    return 1;
+}
+
+#ifdef HAVE_PTHREAD_H
+static void *pbo_pool_worker(void *arg)
+{
+    struct pool *p = arg;
+    for(;;) {
+        pthread_mutex_lock(&p->lock);
+        size_t i = p->next++;
+        pthread_mutex_unlock(&p->lock);
+        if(i >= p->n)
+            break;
+        p->fn(i, p->user);
+    }
+    return NULL;
+}
+#endif
+
+void pbo_pool_run(size_t n, int threads, pbo_pool_fn fn, void *user)
+{
+    threads = pbo_pool_threads(threads);
+    if((size_t)threads > n)
+        threads = n;
+
+#ifdef HAVE_PTHREAD_H
+    if(threads > 1) {
+        struct pool p;
+        p.n = n;
+        p.next = 0;
+        p.fn = fn;
+        p.user = user;
+        pthread_t tids[POOL_MAXTHREADS];
+        int started = 0;
+
+        if(!pthread_mutex_init(&p.lock, NULL)) {
+            while(started < threads - 1 && !pthread_create(&tids[started], NULL, pbo_pool_worker, &p))
+                started++;
+
+            pbo_pool_worker(&p); //Help out, also covers failed thread creation
+            for(int i = 0; i < started; i++)
+                pthread_join(tids[i], NULL);
+            pthread_mutex_destroy(&p.lock);
+            return;
+        }
+    }
+#endif
+
+    for(size_t i = 0; i < n; i++)
+        fn(i, user);
+}
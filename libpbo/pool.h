@@ -0,0 +1,17 @@
+/* pool.h - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBpbo_pool_H
+#define LIBpbo_pool_H 1
+
+#include <stddef.h>
+
+typedef void (*pbo_pool_fn)(size_t, void*);
+
+/* Runs fn(0..n-1) on up to threads workers, handing out indices in order,
+ * threads <= 0 means one per online CPU. Runs inline without pthreads. */
+void pbo_pool_run(size_t n, int threads, pbo_pool_fn fn, void *user);
+int pbo_pool_threads(int threads);
+
+#endif /* LIBpbo_pool_H */
@@ -0,0 +1,129 @@
+/* stat.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "sha.h"
+#include "pool.h"
+#include "pbo-private.h"
+
+//Reads a NUL terminated string, -1 if it's cut off or too long
+static int pbo_stat_string(struct io_reader *r, char *dst, size_t dstsz)
+{
+    for(size_t i = 0; i < dstsz; i++) {
+        int c = pbo_reader_getc(r);
+        if(c == EOF)
+            return -1;
+        dst[i] = c;
+        if(c == '\0')
+            return i;
+    }
+    return -1;
+}
+
+static pbo_error pbo_stat_io(const pbo_io *io, pbo_stat *st)
+{
+    struct io_reader r;
+    char name[MAXNAMELEN];
+    uint32_t prop[5];
+
+    pbo_reader_init(&r, io, 0);
+    for(int i = 0;; i++) {
+        int sz = pbo_stat_string(&r, name, sizeof name);
+        if(sz < 0 || pbo_reader_read(&r, prop, sizeof prop) != sizeof prop)
+            return PBO_ERROR_BROKEN;
+
+        if(!sz && !i) { //Header extension, only the prefix is of interest
+            char value[MAXNAMELEN];
+            while((sz = pbo_stat_string(&r, name, sizeof name)) > 0) {
+                if(pbo_stat_string(&r, value, sizeof value) < 0)
+                    return PBO_ERROR_BROKEN;
+                if(!strcmp(name, "prefix"))
+                    memcpy(st->prefix, value, sizeof value);
+            }
+            if(sz < 0)
+                return PBO_ERROR_BROKEN;
+            continue;
+        }
+        if(!sz)
+            break;
+
+        st->entries++;
+        st->data_size += prop[DATA_SIZE];
+        int packed = prop[PACKING_METHOD] == PBO_PACKING_COMPRESSED || prop[PACKING_METHOD] == PBO_PACKING_BLOCKS;
+        st->original_size += packed ? prop[ORIGINAL_SIZE] : prop[DATA_SIZE];
+    }
+    st->header_size = pbo_reader_tell(&r);
+
+    if(io->ops->size(io->handle, &st->file_size))
+        return PBO_ERROR_IO;
+
+    //Archives from before the hash was added simply end with the data
+    uint64_t end = st->header_size + st->data_size;
+    if(st->file_size == end)
+        return PBO_SUCCESS;
+
+    unsigned char trailer[1 + SHA1HashSize];
+    if(st->file_size != end + sizeof trailer ||
+       io->ops->read_at(io->handle, trailer, sizeof trailer, end) != sizeof trailer || trailer[0] != '\0')
+        return PBO_ERROR_BROKEN;
+
+    memcpy(st->sha1, trailer + 1, SHA1HashSize);
+    st->has_sha1 = 1;
+    return PBO_SUCCESS;
+}
+
+/* Summarises an archive from its header and trailing hash alone, without
+ * building any of the lists pbo_read_header does or touching the heap. */
+pbo_error pbo_stat_file(const char *path, pbo_stat *st)
+{
+    if(!path || !st)
+        return PBO_ERROR_NEXIST;
+
+    memset(st, 0, sizeof *st);
+
+    pbo_io io;
+    struct io_fd h;
+    if(pbo_io_open_into(&io, &h, path))
+        st->error = PBO_ERROR_IO;
+    else {
+        st->error = pbo_stat_io(&io, st);
+        pbo_io_close(&io);
+    }
+    return st->error;
+}
+
+struct stat_job {
+    const char **paths;
+    pbo_stat *stats;
+};
+
+static void pbo_stat_worker(size_t ind, void *user)
+{
+    struct stat_job *job = user;
+    pbo_stat_file(job->paths[ind], &job->stats[ind]);
+}
+
+/* Fills stats[i] for paths[i] on up to threads threads, 0 for one per CPU.
+ * Fails if any archive couldn't be read, their error says which. */
+pbo_error pbo_stat_many(const char **paths, size_t count, pbo_stat *stats, int threads)
+{
+    if(!paths || !stats)
+        return PBO_ERROR_NEXIST;
+
+    struct stat_job job = { paths, stats };
+    pbo_pool_run(count, threads, pbo_stat_worker, &job);
+
+    for(size_t i = 0; i < count; i++)
+        if(stats[i].error != PBO_SUCCESS)
+            return PBO_ERROR_BROKEN;
+    return PBO_SUCCESS;
+}
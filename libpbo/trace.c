@@ -0,0 +1,300 @@
+/* trace.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+#ifdef HAVE_SYS_SDT_H
+# include <sys/sdt.h> //USDT probes libpbo:op_begin and libpbo:op_end
+#endif
+
+#include "pbo-private.h"
+
+struct histogram {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock;
+#endif
+};
+
+static const char *trace_names[PBO_OP_COUNT] = {
+    "read_header", "lookup", "read_file", "write", "commit", "extract", "verify",
+};
+
+//Set before archives are used, read without a lock on every call
+static struct {
+    pbo_trace_hooks hooks;
+    int histograms;
+    int on;
+} trace;
+
+static struct histogram trace_hists[PBO_OP_COUNT];
+
+static uint64_t pbo_trace_now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    if(!clock_gettime(CLOCK_MONOTONIC, &ts))
+        return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+    return (uint64_t)clock() * (1000000000u / CLOCKS_PER_SEC);
+}
+
+size_t pbo_hist_index(uint64_t v)
+{
+    if(v >= (uint64_t)1 << HIST_MAXBITS)
+        v = ((uint64_t)1 << HIST_MAXBITS) - 1;
+    if(v < HIST_SUB)
+        return v;
+    int msb = 63;
+    while(!(v >> msb))
+        msb--;
+    int shift = msb - HIST_SUBBITS;
+    return (size_t)(shift + 1) * HIST_SUB + (v >> shift & (HIST_SUB - 1));
+}
+
+//Highest value that falls into bucket i
+uint64_t pbo_hist_upper(size_t i)
+{
+    if(i < HIST_SUB)
+        return i;
+    int shift = i / HIST_SUB - 1;
+    return ((uint64_t)(HIST_SUB + i % HIST_SUB) << shift) + ((uint64_t)1 << shift) - 1;
+}
+
+uint64_t pbo_hist_lower(size_t i)
+{
+    if(i < HIST_SUB)
+        return i;
+    return (uint64_t)(HIST_SUB + i % HIST_SUB) << (i / HIST_SUB - 1);
+}
+
+static void pbo_hist_lock(struct histogram *h)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock(&h->lock);
+#else
+    (void)h;
+#endif
+}
+
+static void pbo_hist_unlock(struct histogram *h)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock(&h->lock);
+#else
+    (void)h;
+#endif
+}
+
+static void pbo_hist_init(void)
+{
+    for(int i = 0; i < PBO_OP_COUNT; i++) {
+        memset(&trace_hists[i], 0, sizeof trace_hists[i]);
+        trace_hists[i].min = UINT64_MAX;
+#ifdef HAVE_PTHREAD_H
+        pthread_mutex_init(&trace_hists[i].lock, NULL);
+#endif
+    }
+}
+
+static void pbo_hist_once(void)
+{
+#ifdef HAVE_PTHREAD_H
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, pbo_hist_init);
+#else
+    static int done;
+    if(!done)
+        pbo_hist_init();
+    done = 1;
+#endif
+}
+
+static void pbo_hist_record(pbo_op op, uint64_t ns, pbo_error ret)
+{
+    struct histogram *h = &trace_hists[op];
+    size_t i = pbo_hist_index(ns);
+    pbo_hist_lock(h);
+    h->count++;
+    h->errors += ret != PBO_SUCCESS;
+    h->sum += ns;
+    if(ns < h->min)
+        h->min = ns;
+    if(ns > h->max)
+        h->max = ns;
+    h->buckets[i]++;
+    pbo_hist_unlock(h);
+}
+
+void pbo_trace_begin(struct pbo_span *s, pbo_op op, const char *name)
+{
+    s->op = op;
+    s->name = name;
+    s->start = 0;
+#ifdef HAVE_SYS_SDT_H
+    DTRACE_PROBE2(libpbo, op_begin, (int)op, name);
+#endif
+    if(!trace.on)
+        return;
+    if(trace.hooks.begin)
+        trace.hooks.begin(op, name, trace.hooks.user);
+    s->start = pbo_trace_now();
+}
+
+/* Closes the span begun on s, with ret what the call returns. Hands ret
+ * back so calls can end with return pbo_trace_end(...). */
+pbo_error pbo_trace_end(struct pbo_span *s, pbo_error ret)
+{
+#ifdef HAVE_SYS_SDT_H
+    DTRACE_PROBE2(libpbo, op_end, (int)s->op, (int)ret);
+#endif
+    if(!trace.on)
+        return ret;
+    uint64_t ns = pbo_trace_now() - s->start;
+    if(trace.histograms)
+        pbo_hist_record(s->op, ns, ret);
+    if(trace.hooks.end)
+        trace.hooks.end(s->op, s->name, ret, ns, trace.hooks.user);
+    return ret;
+}
+
+void pbo_set_trace_hooks(const pbo_trace_hooks *hooks)
+{
+    if(hooks)
+        trace.hooks = *hooks;
+    else
+        memset(&trace.hooks, 0, sizeof trace.hooks);
+    trace.on = trace.histograms || trace.hooks.begin || trace.hooks.end;
+}
+
+void pbo_set_latency_histograms(int enable)
+{
+    pbo_hist_once();
+    trace.histograms = !!enable;
+    trace.on = trace.histograms || trace.hooks.begin || trace.hooks.end;
+}
+
+const char *pbo_op_name(pbo_op op)
+{
+    return (unsigned int)op < PBO_OP_COUNT ? trace_names[op] : NULL;
+}
+
+void pbo_latency_reset(void)
+{
+    pbo_hist_once();
+    for(int i = 0; i < PBO_OP_COUNT; i++) {
+        struct histogram *h = &trace_hists[i];
+        pbo_hist_lock(h);
+        h->count = h->errors = h->sum = h->max = 0;
+        h->min = UINT64_MAX;
+        memset(h->buckets, 0, sizeof h->buckets);
+        pbo_hist_unlock(h);
+    }
+}
+
+//Called with the lock held
+static uint64_t pbo_hist_percentile(const struct histogram *h, double q)
+{
+    if(!h->count)
+        return 0;
+    //The ceil(q * count)th smallest, the first for q <= 0
+    double rank = q * h->count;
+    uint64_t want = rank <= 1 ? 1 : rank >= h->count ? h->count : (uint64_t)rank, seen = 0;
+    if(want < rank && want < h->count)
+        want++;
+    for(size_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if(seen >= want) {
+            uint64_t v = pbo_hist_upper(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+/* Latency under which a fraction q of the calls of op finished, in ns, as
+ * the top of its bucket. 0 before any were recorded. */
+uint64_t pbo_latency_percentile(pbo_op op, double q)
+{
+    if((unsigned int)op >= PBO_OP_COUNT)
+        return 0;
+    pbo_hist_once();
+    struct histogram *h = &trace_hists[op];
+    pbo_hist_lock(h);
+    uint64_t v = pbo_hist_percentile(h, q);
+    pbo_hist_unlock(h);
+    return v;
+}
+
+struct json_out {
+    char *buf;
+    size_t size;
+    size_t len; //Needed so far, may be past size
+};
+
+static void pbo_json_printf(struct json_out *o, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    size_t room = o->len < o->size ? o->size - o->len : 0;
+    int n = vsnprintf(room ? o->buf + o->len : NULL, room, fmt, ap);
+    va_end(ap);
+    if(n > 0)
+        o->len += n;
+}
+
+/* Writes all histograms as JSON into buf like snprintf, returning the
+ * length it needs without the terminator. Buckets that saw calls are
+ * listed as [lowest value, count] so histograms of several processes can
+ * be added up. */
+size_t pbo_latency_json(char *buf, size_t size)
+{
+    pbo_hist_once();
+    struct json_out o = { buf, size, 0 };
+    if(size)
+        *buf = '\0';
+
+    pbo_json_printf(&o, "{\"unit\":\"ns\",\"ops\":{");
+    for(int op = 0; op < PBO_OP_COUNT; op++) {
+        struct histogram *h = &trace_hists[op];
+        pbo_hist_lock(h);
+        pbo_json_printf(&o, "%s\"%s\":{\"count\":%llu,\"errors\":%llu,\"min\":%llu,\"max\":%llu,\"mean\":%llu",
+                        op ? "," : "", trace_names[op], (unsigned long long)h->count,
+                        (unsigned long long)h->errors, (unsigned long long)(h->count ? h->min : 0),
+                        (unsigned long long)h->max, (unsigned long long)(h->count ? h->sum / h->count : 0));
+        pbo_json_printf(&o, ",\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"buckets\":[",
+                        (unsigned long long)pbo_hist_percentile(h, 0.5), (unsigned long long)pbo_hist_percentile(h, 0.9),
+                        (unsigned long long)pbo_hist_percentile(h, 0.99), (unsigned long long)pbo_hist_percentile(h, 0.999));
+        int first = 1;
+        for(size_t i = 0; i < HIST_BUCKETS; i++) {
+            if(!h->buckets[i])
+                continue;
+            pbo_json_printf(&o, "%s[%llu,%llu]", first ? "" : ",", (unsigned long long)pbo_hist_lower(i),
+                            (unsigned long long)h->buckets[i]);
+            first = 0;
+        }
+        pbo_hist_unlock(h);
+        pbo_json_printf(&o, "]}");
+    }
+    pbo_json_printf(&o, "}}");
+    return o.len;
+}
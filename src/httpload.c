@@ -0,0 +1,289 @@
+/* httpload.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libpbo/pbo.h>
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_UNISTD_H) && defined(HAVE_SYS_SOCKET_H) && defined(HAVE_NETINET_IN_H)
+# include <pthread.h>
+# include <signal.h>
+# include <unistd.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <netinet/tcp.h>
+# define HTTPLOAD_SUPPORTED
+#endif
+
+#define HTTPLOAD_CONNECTIONS 4
+#define HTTPLOAD_REQUESTS 20000 //Over all connections
+
+/* Serves one archive on a loopback port and keeps every connection busy
+ * with keep-alive GETs for one entry, then reports requests per second
+ * and latency percentiles as seen by the clients. */
+
+#ifdef HTTPLOAD_SUPPORTED
+struct httpload_client {
+    pthread_t thread;
+    struct sockaddr_in addr;
+    const char *request;
+    size_t count;
+    uint64_t *ns; //Latency of each request
+    size_t done;
+    size_t failed;
+};
+
+struct httpload_server {
+    pthread_t thread;
+    pbo_http_t s;
+    int fd;
+};
+
+static uint64_t httpload_now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#else
+    return (uint64_t)clock() * (1000000000u / CLOCKS_PER_SEC);
+#endif
+}
+
+static int httpload_send(int fd, const char *p, size_t n)
+{
+    while(n) {
+        ssize_t w = send(fd, p, n, 0);
+        if(w <= 0)
+            return -1;
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+/* Reads one response off fd, buf keeps what came after it. Returns the
+ * status, -1 if the connection broke. */
+static int httpload_response(int fd, char *buf, size_t cap, size_t *len)
+{
+    char *end;
+    buf[*len] = '\0';
+    while(!(end = strstr(buf, "\r\n\r\n"))) {
+        if(*len + 1 >= cap)
+            return -1;
+        ssize_t r = recv(fd, buf + *len, cap - 1 - *len, 0);
+        if(r <= 0)
+            return -1;
+        *len += r;
+        buf[*len] = '\0';
+    }
+    end += 4;
+
+    int status = strncmp(buf, "HTTP/1.1 ", 9) ? -1 : atoi(buf + 9);
+    const char *cl = strstr(buf, "\r\nContent-Length: ");
+    unsigned long long body = cl && cl < end ? strtoull(cl + 18, NULL, 10) : 0;
+
+    //Whatever of the body is buffered, then the rest straight off the socket
+    size_t have = *len - (end - buf);
+    size_t used = have < body ? have : body;
+    memmove(buf, end + used, have - used);
+    *len = have - used;
+    for(body -= used; body;) {
+        ssize_t r = recv(fd, buf, body < cap ? body : cap, 0);
+        if(r <= 0)
+            return -1;
+        body -= r;
+    }
+    return status;
+}
+
+static void *httpload_client_run(void *arg)
+{
+    struct httpload_client *c = arg;
+    char buf[16384];
+    size_t len = 0, reqlen = strlen(c->request);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr *)&c->addr, sizeof c->addr)) {
+        c->failed = c->count;
+        if(fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    for(size_t i = 0; i < c->count; i++) {
+        uint64_t start = httpload_now();
+        int status = httpload_send(fd, c->request, reqlen) ? -1 : httpload_response(fd, buf, sizeof buf, &len);
+        if(status < 0) {
+            c->failed += c->count - i;
+            break;
+        }
+        if(status != 200 && status != 206)
+            c->failed++;
+        c->ns[c->done++] = httpload_now() - start;
+    }
+    close(fd);
+    return NULL;
+}
+
+static void *httpload_server_run(void *arg)
+{
+    struct httpload_server *sv = arg;
+    pbo_http_serve(sv->s, sv->fd);
+    close(sv->fd);
+    return NULL;
+}
+
+static int httpload_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+//The entry as a request target below /a/, percent encoded
+static void httpload_target(char *out, size_t size, const char *name)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    size_t o = snprintf(out, size, "/a/");
+    for(; *name && o + 4 < size; name++) {
+        unsigned char ch = *name;
+        if(ch == '\\')
+            out[o++] = '/';
+        else if((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || strchr("-._~", ch))
+            out[o++] = ch;
+        else {
+            out[o++] = '%';
+            out[o++] = hex[ch >> 4];
+            out[o++] = hex[ch & 15];
+        }
+    }
+    out[o] = '\0';
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s archive.pbo [entry [connections [requests [range]]]]\n", argv[0]);
+        return 1;
+    }
+    int conns = argc > 3 ? atoi(argv[3]) : HTTPLOAD_CONNECTIONS;
+    size_t total = argc > 4 ? strtoul(argv[4], NULL, 10) : HTTPLOAD_REQUESTS;
+    const char *range = argc > 5 ? argv[5] : NULL;
+    if(conns < 1 || total < (size_t)conns) {
+        fprintf(stderr, "need at least one request per connection\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    pbo_t d = pbo_init(argv[1]);
+    pbo_error ret = pbo_read_header(d);
+    if(ret) {
+        fprintf(stderr, "%s: can't read, %d\n", argv[1], (int)ret);
+        pbo_dispose(d);
+        return 1;
+    }
+    char name[PBO_MAXNAMELEN + 1] = "";
+    if(argc > 2)
+        snprintf(name, sizeof name, "%s", argv[2]);
+    else {
+        pbo_iterator it;
+        const pbo_file_info *fi;
+        if(!pbo_iter_begin(d, &it) && (fi = pbo_iter_next(&it)))
+            snprintf(name, sizeof name, "%s", fi->name);
+    }
+
+    char target[3 * PBO_MAXNAMELEN + 8], request[4 * PBO_MAXNAMELEN + 128];
+    httpload_target(target, sizeof target, name);
+    snprintf(request, sizeof request, "GET %s HTTP/1.1\r\nHost: localhost\r\n%s%s%s\r\n", target,
+             range ? "Range: bytes=" : "", range ? range : "", range ? "\r\n" : "");
+
+    pbo_http_t s = pbo_http_init();
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct httpload_client *clients = calloc(conns, sizeof *clients);
+    struct httpload_server *servers = calloc(conns, sizeof *servers);
+    uint64_t *ns = malloc(total * sizeof *ns);
+    int failed = 1;
+    if(!s || pbo_http_add(s, "a", d) || lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof addr) ||
+       listen(lfd, conns) || getsockname(lfd, (struct sockaddr *)&addr, &addrlen) || !clients || !servers || !ns) {
+        fprintf(stderr, "can't set up the server\n");
+        goto cleanup;
+    }
+
+    //The clients queue up in the backlog until they're accepted
+    uint64_t start = httpload_now();
+    int started = 0, accepted = 0;
+    size_t at = 0;
+    for(; started < conns; started++) {
+        struct httpload_client *c = &clients[started];
+        c->addr = addr;
+        c->request = request;
+        c->count = total / conns + ((size_t)started < total % conns);
+        c->ns = ns + at;
+        if(pthread_create(&c->thread, NULL, httpload_client_run, c))
+            break;
+        at += c->count;
+    }
+    for(; accepted < started; accepted++) {
+        struct httpload_server *sv = &servers[accepted];
+        sv->s = s;
+        if((sv->fd = accept(lfd, NULL, NULL)) < 0)
+            break;
+        int one = 1;
+        setsockopt(sv->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+        if(pthread_create(&sv->thread, NULL, httpload_server_run, sv)) {
+            close(sv->fd);
+            break;
+        }
+    }
+    for(int i = 0; i < started; i++)
+        pthread_join(clients[i].thread, NULL);
+    for(int i = 0; i < accepted; i++)
+        pthread_join(servers[i].thread, NULL);
+    double secs = (httpload_now() - start) / 1e9;
+
+    //Each client's latencies, packed after another
+    size_t done = 0, errors = total - at; //Of clients that never started
+    for(int i = 0; i < started; i++) {
+        memmove(ns + done, clients[i].ns, clients[i].done * sizeof *ns);
+        done += clients[i].done;
+        errors += clients[i].failed;
+    }
+    qsort(ns, done, sizeof *ns, httpload_cmp);
+
+    printf("%s  %d connections  %zu requests  %zu failed  %.2f s\n", target, started, done, errors, secs);
+    if(done)
+        printf("%.0f req/s  p50 %.1f us  p99 %.1f us  max %.1f us\n", done / secs, ns[done / 2] / 1e3,
+               ns[done - 1 - done / 100] / 1e3, ns[done - 1] / 1e3);
+    failed = errors != 0 || !done;
+
+cleanup:
+    if(lfd >= 0)
+        close(lfd);
+    free(ns);
+    free(clients);
+    free(servers);
+    pbo_http_dispose(s);
+    pbo_dispose(d);
+    return failed;
+}
+#else
+int main(void)
+{
+    fprintf(stderr, "needs sockets and threads\n");
+    return 1;
+}
+#endif
@@ -0,0 +1,75 @@
+/* check.h - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libpbo/pbo.h>
+
+/* Helpers for the programs make check runs. Each exits 0 when all its
+ * checks held, failed checks are reported as they happen. Files are
+ * written to the current directory under the program's name. */
+
+static int check_failed;
+
+#define CHECK(cond) \
+    ((cond) ? (void)0 : (void)(check_failed = 1, fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond)))
+
+//Deterministic bytes, text repeats enough to compress, noise doesn't
+static inline void check_fill(unsigned char *buf, size_t n, uint32_t seed, int text)
+{
+    for(size_t i = 0; i < n; i++) {
+        seed = seed * 1103515245u + 12345u;
+        buf[i] = text ? (unsigned char)("lorem ipsum dolor sit amet\n"[i % 27] ^ (seed >> 27 == 0)) : (unsigned char)(seed >> 24);
+    }
+}
+
+//Whether filename in d reads back as exactly data
+static inline int check_entry(pbo_t d, const char *filename, const void *data, size_t n)
+{
+    size_t sz = pbo_get_file_size(d, filename);
+    if(sz != n)
+        return 0;
+    unsigned char *buf = malloc(n ? n : 1);
+    int same = buf && pbo_read_file(d, filename, buf, n) == n && !memcmp(buf, data, n);
+    free(buf);
+    return same;
+}
+
+//The archive at path, its header read, NULL if it can't be
+static inline pbo_t check_open(const char *path)
+{
+    pbo_t d = pbo_init(path);
+    if(d && pbo_read_header(d)) {
+        pbo_dispose(d);
+        d = NULL;
+    }
+    return d;
+}
+
+//All of the file at path in a buffer to free, NULL if it can't be read
+static inline unsigned char *check_slurp(const char *path, size_t *n)
+{
+    FILE *file = fopen(path, "rb");
+    unsigned char *buf = NULL;
+    long len;
+    if(file && !fseek(file, 0, SEEK_END) && (len = ftell(file)) >= 0 && !fseek(file, 0, SEEK_SET) &&
+       (buf = malloc(len + 1)) && fread(buf, 1, len, file) == (size_t)len)
+        *n = len;
+    else {
+        free(buf);
+        buf = NULL;
+    }
+    if(file)
+        fclose(file);
+    return buf;
+}
+
+#endif
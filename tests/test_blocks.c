@@ -0,0 +1,108 @@
+/* test_blocks.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "check.h"
+#include "pbo-private.h"
+
+#define BLOCK 16384
+
+static unsigned char text[300000], noise[100000], small[1000], mixed[200000];
+
+//Pieces of the entry decoded on their own, across block edges
+static void check_pieces(pbo_t d, const pbo_io *io, const char *name, const unsigned char *want, size_t n)
+{
+    struct list_entry *le = pbo_index_find(d, name);
+    struct blocks_reader r;
+    CHECK(le && le->data->properties[PACKING_METHOD] == PBO_PACKING_BLOCKS);
+    if(!le || pbo_blocks_open(&r, io, d->headersz + le->data->file_offset, le->data))
+        return;
+    CHECK(pbo_blocks_verify(&r, le->data) == PBO_SUCCESS);
+    static const size_t firsts[] = { 0, 1, BLOCK - 1, BLOCK, 3 * BLOCK + 5 };
+    unsigned char *buf = malloc(2 * BLOCK + 10);
+    for(size_t i = 0; buf && i < sizeof firsts / sizeof *firsts; i++) {
+        size_t len = 2 * BLOCK + 10 < n - firsts[i] ? 2 * BLOCK + 10 : n - firsts[i];
+        CHECK(pbo_blocks_get(&r, firsts[i], len, buf) == PBO_SUCCESS && !memcmp(buf, want + firsts[i], len));
+    }
+    CHECK(buf && pbo_blocks_get(&r, n - 1, 2, buf) == PBO_ERROR_NEXIST);
+    free(buf);
+    pbo_blocks_close(&r);
+}
+
+int main(void)
+{
+    const char *path = "test_blocks.pbo";
+    check_fill(text, sizeof text, 1, 1);
+    check_fill(noise, sizeof noise, 2, 0);
+    check_fill(small, sizeof small, 3, 1);
+    memcpy(mixed, noise, sizeof noise); //Blocks that stay raw among packed ones
+    memcpy(mixed + sizeof noise, text, sizeof mixed - sizeof noise);
+
+    pbo_block_options bo = { 50000, BLOCK, 2 };
+    pbo_t d = pbo_init(path);
+    CHECK(pbo_init_new(d) == PBO_SUCCESS);
+    CHECK(pbo_set_checksums(d, 1) == PBO_SUCCESS);
+    CHECK(pbo_set_block_packing(d, &bo) == PBO_SUCCESS);
+    CHECK(pbo_add_file_borrow(d, "text.txt", text, sizeof text) == PBO_SUCCESS);
+    CHECK(pbo_add_file_borrow(d, "noise.bin", noise, sizeof noise) == PBO_SUCCESS);
+    CHECK(pbo_add_file_borrow(d, "small.txt", small, sizeof small) == PBO_SUCCESS);
+    CHECK(pbo_add_file_borrow(d, "mixed.bin", mixed, sizeof mixed) == PBO_SUCCESS);
+
+    //Not for the game
+    CHECK(pbo_set_game_loadable(d, 1) == PBO_SUCCESS);
+    CHECK(pbo_write(d) == PBO_ERROR_STATE);
+    CHECK(pbo_set_game_loadable(d, 0) == PBO_SUCCESS);
+    CHECK(pbo_write(d) == PBO_SUCCESS);
+    pbo_dispose(d);
+
+    //Text shrinks, noise can't and is stored as it is, everything reads back whole
+    size_t n = 0;
+    unsigned char *file = check_slurp(path, &n);
+    CHECK(file && n < (sizeof text + sizeof mixed) / 2 + sizeof noise * 2 + sizeof small);
+    CHECK((d = check_open(path)) != NULL);
+    if(!d || !file)
+        return 1;
+    CHECK(check_entry(d, "text.txt", text, sizeof text));
+    CHECK(check_entry(d, "noise.bin", noise, sizeof noise));
+    CHECK(check_entry(d, "small.txt", small, sizeof small));
+    CHECK(check_entry(d, "mixed.bin", mixed, sizeof mixed));
+    CHECK(pbo_verify(d) == PBO_SUCCESS);
+    pbo_dispose(d);
+
+    pbo_io io;
+    d = pbo_init(NULL);
+    CHECK(d && !pbo_io_memory(&io, file, n) && !pbo_set_io(d, &io) && !pbo_read_header(d));
+    check_pieces(d, &io, "text.txt", text, sizeof text);
+    check_pieces(d, &io, "mixed.bin", mixed, sizeof mixed);
+    struct list_entry *le = pbo_index_find(d, "noise.bin");
+    CHECK(le && !pbo_entry_packed(le->data));
+
+    //A damaged block is caught before a single byte is written out
+    le = pbo_index_find(d, "text.txt");
+    size_t at = le ? d->headersz + le->data->file_offset + le->data->properties[DATA_SIZE] / 2 : 0;
+    CHECK(le != NULL);
+    pbo_dispose(d);
+    pbo_io_close(&io);
+    if(at) {
+        file[at] ^= 0x40;
+        FILE *out = tmpfile();
+        d = pbo_init(NULL);
+        CHECK(out && d && !pbo_io_memory(&io, file, n) && !pbo_set_io(d, &io) && !pbo_read_header(d));
+        CHECK(out && pbo_write_to_file(d, "text.txt", out) == PBO_ERROR_BROKEN);
+        CHECK(out && ftell(out) == 0);
+        CHECK(check_entry(d, "noise.bin", noise, sizeof noise));
+        CHECK(pbo_verify(d) != PBO_SUCCESS);
+        if(out)
+            fclose(out);
+        pbo_dispose(d);
+        pbo_io_close(&io);
+    }
+
+    free(file);
+    remove(path);
+    return check_failed;
+}
@@ -0,0 +1,109 @@
+/* test_commit.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "check.h"
+
+#define FILES 8
+
+static unsigned char data[FILES][40000];
+static size_t sizes[FILES] = { 1000, 40000, 3, 25000, 0, 12345, 40000, 777 };
+static unsigned char grown[90000];
+
+static void name_of(char *out, int i)
+{
+    sprintf(out, "dir\\file%d.bin", i);
+}
+
+//Every file but the removed one as it should be, the grown one bigger
+static void check_all(pbo_t d, int removed, int regrown)
+{
+    char name[32];
+    for(int i = 0; i < FILES; i++) {
+        name_of(name, i);
+        if(i == removed)
+            CHECK(pbo_get_file_size(d, name) == 0);
+        else if(i == regrown)
+            CHECK(check_entry(d, name, grown, sizeof grown));
+        else
+            CHECK(check_entry(d, name, data[i], sizes[i]));
+    }
+    CHECK(pbo_verify(d) == PBO_SUCCESS);
+}
+
+//The entries' numbers in archive order, -1 for any that isn't one of them
+static void check_order(pbo_t d, const int *want, int n)
+{
+    pbo_iterator it;
+    const pbo_file_info *fi;
+    int i = 0;
+    CHECK(pbo_iter_begin(d, &it) == PBO_SUCCESS);
+    while((fi = pbo_iter_next(&it)) && i < n) {
+        size_t len = strlen(fi->name);
+        CHECK(len > 5 && fi->name[len - 5] - '0' == want[i]);
+        i++;
+    }
+    CHECK(i == n && !fi);
+}
+
+int main(void)
+{
+    const char *path = "test_commit.pbo";
+    char name[32];
+
+    pbo_t d = pbo_init(path);
+    CHECK(pbo_init_new(d) == PBO_SUCCESS);
+    CHECK(pbo_set_checksums(d, 1) == PBO_SUCCESS);
+    for(int i = 0; i < FILES; i++) {
+        check_fill(data[i], sizes[i], i, i % 2);
+        name_of(name, i);
+        CHECK(pbo_add_file_borrow(d, name, data[i], sizes[i]) == PBO_SUCCESS);
+    }
+    CHECK(pbo_write(d) == PBO_SUCCESS);
+    pbo_dispose(d);
+
+    //Removing one near the front moves everything after it down
+    CHECK((d = check_open(path)) != NULL);
+    if(!d)
+        return 1;
+    CHECK(pbo_edit(d) == PBO_SUCCESS);
+    CHECK(pbo_remove_file(d, "DIR/FILE1.BIN") == PBO_SUCCESS);
+    CHECK(pbo_commit(d) == PBO_SUCCESS);
+    check_all(d, 1, -1);
+    pbo_dispose(d);
+
+    //A replacement of the same size takes over the old one's place. One of
+    //another size is removed and appended, so what followed it moves down
+    //and it comes last, after it entries added go in the order added
+    static const int removed[] = { 0, 2, 3, 4, 5, 6, 7 }, moved[] = { 0, 2, 4, 5, 6, 7, 3, 1 };
+    check_fill(grown, sizeof grown, 99, 1);
+    CHECK((d = check_open(path)) != NULL);
+    if(!d)
+        return 1;
+    check_all(d, 1, -1);
+    check_order(d, removed, 7);
+    check_fill(data[5], sizes[5], 55, 0);
+    CHECK(pbo_edit(d) == PBO_SUCCESS);
+    CHECK(pbo_add_file_borrow(d, "dir/file3.bin", grown, sizeof grown) == PBO_SUCCESS);
+    CHECK(pbo_add_file_borrow(d, "DIR\\file5.bin", data[5], sizes[5]) == PBO_SUCCESS);
+    CHECK(pbo_add_file_borrow(d, "dir\\file1.bin", data[1], sizes[1]) == PBO_SUCCESS);
+    CHECK(pbo_commit(d) == PBO_SUCCESS);
+    check_all(d, -1, 3);
+    check_order(d, moved, 8);
+    pbo_dispose(d);
+
+    //What's on disk reads back the same from scratch
+    CHECK((d = check_open(path)) != NULL);
+    if(d) {
+        check_all(d, -1, 3);
+        check_order(d, moved, 8);
+    }
+    pbo_dispose(d);
+
+    remove(path);
+    return check_failed;
+}
@@ -0,0 +1,80 @@
+/* test_crc32c.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "check.h"
+#include "pbo-private.h"
+
+//Bit at a time, to hold the fast one against
+static uint32_t reference(uint32_t crc, const unsigned char *p, size_t n)
+{
+    crc = ~crc;
+    while(n--) {
+        crc ^= *p++;
+        for(int k = 0; k < 8; k++)
+            crc = crc >> 1 ^ (0x82F63B78u & -(crc & 1));
+    }
+    return ~crc;
+}
+
+int main(void)
+{
+    CHECK(pbo_crc32c(0, "123456789", 9) == 0xE3069283u);
+    CHECK(pbo_crc32c(0, "", 0) == 0);
+
+    //Every length and alignment around the word sizes, whole and in pieces
+    static unsigned char buf[4200];
+    check_fill(buf, sizeof buf, 5, 0);
+    for(size_t off = 0; off < 16; off++)
+        for(size_t n = 0; n + off <= sizeof buf; n += n < 80 ? 1 : 997) {
+            uint32_t want = reference(0, buf + off, n);
+            CHECK(pbo_crc32c(0, buf + off, n) == want);
+            CHECK(pbo_crc32c(pbo_crc32c(0, buf + off, n / 3), buf + off + n / 3, n - n / 3) == want);
+        }
+
+    //Archives with checksums verify, and a flipped bit is found
+    static unsigned char a[30000], b[30000];
+    const char *path = "test_crc32c.pbo";
+    check_fill(a, sizeof a, 1, 1);
+    check_fill(b, sizeof b, 2, 0);
+    pbo_t d = pbo_init(path);
+    CHECK(pbo_init_new(d) == PBO_SUCCESS);
+    CHECK(pbo_set_checksums(d, 1) == PBO_SUCCESS);
+    CHECK(pbo_add_file_borrow(d, "a.txt", a, sizeof a) == PBO_SUCCESS);
+    CHECK(pbo_add_file_borrow(d, "b.bin", b, sizeof b) == PBO_SUCCESS);
+    CHECK(pbo_write(d) == PBO_SUCCESS);
+    pbo_dispose(d);
+    CHECK((d = check_open(path)) && pbo_verify(d) == PBO_SUCCESS);
+    pbo_dispose(d);
+
+    //The last byte of b.bin, just before the hash
+    size_t n = 0;
+    unsigned char *file = check_slurp(path, &n);
+    CHECK(file && n > sizeof b + 21);
+    if(file && n > sizeof b + 21) {
+        file[n - 22] ^= 0x10;
+        pbo_io io;
+        d = pbo_init(NULL);
+        CHECK(d && !pbo_io_memory(&io, file, n) && !pbo_set_io(d, &io));
+        CHECK(pbo_read_header(d) == PBO_SUCCESS);
+        CHECK(pbo_verify(d) != PBO_SUCCESS);
+        CHECK(check_entry(d, "a.txt", a, sizeof a));
+        unsigned char *back = malloc(sizeof b);
+        CHECK(back && pbo_read_file(d, "b.bin", back, sizeof b) != sizeof b);
+        free(back);
+        FILE *out = tmpfile();
+        CHECK(out && pbo_write_to_file(d, "a.txt", out) == PBO_SUCCESS);
+        CHECK(out && pbo_write_to_file(d, "b.bin", out) == PBO_ERROR_BROKEN);
+        if(out)
+            fclose(out);
+        pbo_dispose(d);
+        pbo_io_close(&io);
+    }
+    free(file);
+    remove(path);
+    return check_failed;
+}
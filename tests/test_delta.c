@@ -0,0 +1,82 @@
+/* test_delta.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "check.h"
+
+static unsigned char a[50000], b[20000], c[3000], changed[50000];
+
+static void build(const char *path, int cur)
+{
+    pbo_t d = pbo_init(path);
+    CHECK(pbo_init_new(d) == PBO_SUCCESS);
+    CHECK(pbo_set_extension(d, "prefix", "delta") == PBO_SUCCESS);
+    CHECK(pbo_add_file_borrow(d, "a.txt", cur ? changed : a, sizeof a) == PBO_SUCCESS);
+    CHECK(pbo_add_file_borrow(d, cur ? "c.bin" : "b.bin", cur ? c : b, cur ? sizeof c : sizeof b) == PBO_SUCCESS);
+    CHECK(pbo_write(d) == PBO_SUCCESS);
+    pbo_dispose(d);
+}
+
+int main(void)
+{
+    const char *oldpath = "test_delta_old.pbo", *curpath = "test_delta_cur.pbo";
+    const char *patch = "test_delta.patch", *out = "test_delta_out.pbo";
+
+    check_fill(a, sizeof a, 1, 1);
+    check_fill(b, sizeof b, 2, 0);
+    check_fill(c, sizeof c, 3, 0);
+    memcpy(changed, a, sizeof a);
+    memset(changed + 20000, 'x', 100);
+    build(oldpath, 0);
+    build(curpath, 1);
+
+    pbo_t old = check_open(oldpath), cur = check_open(curpath);
+    CHECK(old && cur);
+    if(!old || !cur)
+        return 1;
+    CHECK(pbo_diff(old, cur, patch) == PBO_SUCCESS);
+
+    //Only what changed is shipped, the result is the new archive to the byte
+    size_t patchsz = 0, cursz = 0, outsz = 0;
+    unsigned char *pbuf = check_slurp(patch, &patchsz), *cbuf = check_slurp(curpath, &cursz), *obuf;
+    CHECK(pbuf && cbuf && patchsz < sizeof a / 2 + sizeof c);
+    CHECK(pbo_patch(old, patch, out) == PBO_SUCCESS);
+    CHECK((obuf = check_slurp(out, &outsz)) && outsz == cursz && !memcmp(obuf, cbuf, cursz));
+    free(obuf);
+    remove(out);
+
+    //Not against the archive it was made for, nor over it
+    CHECK(pbo_patch(cur, patch, out) != PBO_SUCCESS);
+    CHECK(pbo_patch(old, patch, oldpath) == PBO_ERROR_STATE);
+    pbo_dispose(old);
+    CHECK((old = check_open(oldpath)) && check_entry(old, "b.bin", b, sizeof b));
+
+    //A damaged patch leaves nothing behind
+    if(pbuf && patchsz) {
+        pbuf[patchsz - 1] ^= 1;
+        FILE *file = fopen(patch, "wb");
+        CHECK(file && fwrite(pbuf, 1, patchsz, file) == patchsz);
+        if(file)
+            fclose(file);
+        remove(out);
+        CHECK(old && pbo_patch(old, patch, out) != PBO_SUCCESS);
+        FILE *left = fopen(out, "rb");
+        CHECK(!left);
+        if(left)
+            fclose(left);
+    }
+
+    free(pbuf);
+    free(cbuf);
+    pbo_dispose(old);
+    pbo_dispose(cur);
+    remove(oldpath);
+    remove(curpath);
+    remove(patch);
+    remove(out);
+    return check_failed;
+}
@@ -0,0 +1,144 @@
+/* test_dir.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "check.h"
+
+#define SKIP 77 //What automake's test driver takes for skipped
+
+#if defined(HAVE_UNISTD_H) && defined(HAVE_DIRENT_H)
+# include <unistd.h>
+# include <sys/stat.h>
+
+#define ROOT "test_dir_src"
+
+static const char *files[] = { "a.sqf", "b.txt", "sub/c.sqf", "sub/deep/d.paa", "skip/e.sqf" };
+#define FILES (sizeof files / sizeof *files)
+
+static void make_tree(void)
+{
+    char path[128];
+    mkdir(ROOT, 0755);
+    mkdir(ROOT "/sub", 0755);
+    mkdir(ROOT "/sub/deep", 0755);
+    mkdir(ROOT "/skip", 0755);
+    for(size_t i = 0; i < FILES; i++) {
+        sprintf(path, ROOT "/%s", files[i]);
+        FILE *file = fopen(path, "wb");
+        CHECK(file && fputs(files[i], file) >= 0);
+        if(file)
+            fclose(file);
+    }
+}
+
+static void remove_tree(void)
+{
+    char path[128];
+    for(size_t i = 0; i < FILES; i++) {
+        sprintf(path, ROOT "/%s", files[i]);
+        remove(path);
+    }
+    remove(ROOT "/bad");
+    rmdir(ROOT "/sub/deep");
+    rmdir(ROOT "/sub");
+    rmdir(ROOT "/skip");
+    rmdir(ROOT);
+}
+
+/* Whether the archive d was written to holds exactly the NULL terminated
+ * names, in that order, each with the source path as its contents, and
+ * the given prefix. */
+static int holds(pbo_t d, const char *prefix, const char **want)
+{
+    const char *path = "test_dir.pbo";
+    CHECK(pbo_set_filename(d, path) == PBO_SUCCESS);
+    CHECK(pbo_write(d) == PBO_SUCCESS);
+    pbo_t r = check_open(path);
+    if(!r)
+        return 0;
+
+    const char *got = pbo_get_extension(r, "prefix");
+    int ok = prefix ? got && !strcmp(got, prefix) : !got;
+    pbo_iterator it;
+    const pbo_file_info *fi;
+    size_t i = 0;
+    ok &= !pbo_iter_begin(r, &it);
+    while(ok && (fi = pbo_iter_next(&it))) {
+        if(!want[i]) {
+            ok = 0;
+            break;
+        }
+        char contents[64];
+        snprintf(contents, sizeof contents, "%s", want[i]);
+        for(char *p = contents; *p; p++)
+            if(*p == '\\')
+                *p = '/';
+        ok = !strcmp(fi->name, want[i]) && check_entry(r, fi->name, contents, strlen(contents));
+        i++;
+    }
+    ok &= !want[i];
+    pbo_dispose(r);
+    remove(path);
+    return ok;
+}
+
+int main(void)
+{
+    make_tree();
+
+    //Everything, in the same order whatever order the directory listed it in
+    static const char *all[] = { "a.sqf", "b.txt", "skip\\e.sqf", "sub\\c.sqf", "sub\\deep\\d.paa", NULL };
+    pbo_t d = pbo_init(NULL);
+    CHECK(pbo_init_new(d) == PBO_SUCCESS);
+    CHECK(pbo_add_directory(d, ROOT, NULL) == PBO_SUCCESS);
+    CHECK(holds(d, NULL, all));
+    pbo_dispose(d);
+
+    //Includes and excludes match normalised names, the prefix is set once
+    static const char *txt[] = { "*.TXT", NULL };
+    static const char *inc[] = { "*.SQF", "sub/deep/*", NULL }, *exc[] = { "skip\\*", NULL };
+    static const char *picked[] = { "b.txt", "a.sqf", "sub\\c.sqf", "sub\\deep\\d.paa", NULL };
+    pbo_dir_options opts = { "my\\mod", txt, NULL, 2 };
+    d = pbo_init(NULL);
+    CHECK(pbo_init_new(d) == PBO_SUCCESS);
+    CHECK(pbo_add_directory(d, ROOT "/", &opts) == PBO_SUCCESS);
+    opts.prefix = "other\\mod";
+    opts.include = inc;
+    opts.exclude = exc;
+    CHECK(pbo_add_directory(d, ROOT, &opts) == PBO_SUCCESS);
+    CHECK(holds(d, "other\\mod", picked));
+
+    //A file that can't be read leaves d as it was, prefix included
+    int unreadable = 0;
+    if(geteuid() != 0) {
+        FILE *file = fopen(ROOT "/bad", "wb");
+        if(file) {
+            fclose(file);
+            unreadable = !chmod(ROOT "/bad", 0);
+        }
+    } else
+        unreadable = !symlink("/sys/devices/system/cpu/online", ROOT "/bad"); //Says 4096 bytes, has fewer
+    if(unreadable) {
+        opts.prefix = "third";
+        opts.include = NULL;
+        opts.exclude = NULL;
+        CHECK(pbo_add_directory(d, ROOT, &opts) == PBO_ERROR_IO);
+        CHECK(holds(d, "other\\mod", picked));
+    }
+    CHECK(pbo_add_directory(d, ROOT "/missing", &opts) == PBO_ERROR_IO);
+    CHECK(holds(d, "other\\mod", picked));
+    pbo_dispose(d);
+
+    remove_tree();
+    return check_failed;
+}
+#else
+int main(void)
+{
+    return SKIP;
+}
+#endif
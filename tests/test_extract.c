@@ -0,0 +1,145 @@
+/* test_extract.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "check.h"
+
+#define SKIP 77 //What automake's test driver takes for skipped
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+# include <sys/stat.h>
+
+#define EPOCH 1000000000u
+
+//Siblings sharing prefixes, which sort around their directories
+static const char *names[] = {
+    "a-b\\f.txt", "a\\g.txt", "a\\b\\h.txt", "a.b\\j.txt", "ab\\i.txt", "a\\b-c\\k.txt", "top.txt", "big.txt",
+};
+#define FILES (sizeof names / sizeof *names)
+
+static unsigned char data[FILES][3000], big[3 << 20];
+
+static size_t size_of(size_t i)
+{
+    return i == FILES - 1 ? sizeof big : 100 + i * 300;
+}
+
+static const unsigned char *data_of(size_t i)
+{
+    return i == FILES - 1 ? big : data[i];
+}
+
+//The entry's path below dir, \ turned to /
+static void path_of(char *out, const char *dir, const char *name)
+{
+    size_t n = sprintf(out, "%s/%s", dir, name);
+    for(size_t i = 0; i < n; i++)
+        if(out[i] == '\\')
+            out[i] = '/';
+}
+
+static int exists(const char *path)
+{
+    struct stat st;
+    return !stat(path, &st);
+}
+
+//Removes what was extracted, deepest first
+static void clean(const char *dir)
+{
+    static const char *dirs[] = { "a/b-c", "a/b", "a", "a-b", "a.b", "ab", "" };
+    char path[256];
+    for(size_t i = 0; i < FILES; i++) {
+        path_of(path, dir, names[i]);
+        remove(path);
+    }
+    for(size_t i = 0; i < sizeof dirs / sizeof *dirs; i++) {
+        path_of(path, dir, dirs[i]);
+        rmdir(path);
+    }
+}
+
+static pbo_t build(const char *path, const char *evil)
+{
+    pbo_block_options bo = { 1 << 20, 65536, 1 };
+    pbo_t d = pbo_init(path);
+    CHECK(pbo_init_new(d) == PBO_SUCCESS);
+    CHECK(pbo_set_checksums(d, 1) == PBO_SUCCESS);
+    CHECK(pbo_set_timestamps(d, PBO_TIMESTAMP_EPOCH, EPOCH) == PBO_SUCCESS);
+    CHECK(pbo_set_block_packing(d, &bo) == PBO_SUCCESS);
+    for(size_t i = 0; i < FILES; i++)
+        CHECK(pbo_add_file_borrow(d, names[i], data_of(i), size_of(i)) == PBO_SUCCESS);
+    if(evil)
+        CHECK(pbo_add_file_borrow(d, evil, "x", 1) == PBO_SUCCESS);
+    CHECK(pbo_write(d) == PBO_SUCCESS);
+    pbo_dispose(d);
+    return check_open(path);
+}
+
+static void extract(pbo_t d, const char *dir, int direct)
+{
+    char path[256];
+    pbo_extract_options eo = { 1, direct };
+    CHECK(pbo_extract(d, dir, &eo) == PBO_SUCCESS);
+    for(size_t i = 0; i < FILES; i++) {
+        size_t n = 0;
+        path_of(path, dir, names[i]);
+        unsigned char *got = check_slurp(path, &n);
+        CHECK(got && n == size_of(i) && !memcmp(got, data_of(i), n));
+        free(got);
+        struct stat st;
+        CHECK(!stat(path, &st) && st.st_mtime == EPOCH);
+    }
+}
+
+int main(void)
+{
+    const char *path = "test_extract.pbo", *dir = "test_extract_out";
+    for(size_t i = 0; i < FILES - 1; i++)
+        check_fill(data[i], size_of(i), i, i % 2);
+    check_fill(big, sizeof big, 99, 1);
+
+    //Every directory made, the big entry packed, through the page cache or around it
+    pbo_t d = build(path, NULL);
+    CHECK(d != NULL);
+    if(!d)
+        return 1;
+    pbo_iterator it;
+    const pbo_file_info *fi;
+    int packed = 0;
+    CHECK(pbo_iter_begin(d, &it) == PBO_SUCCESS);
+    while((fi = pbo_iter_next(&it)))
+        packed += fi->packing_method == PBO_PACKING_BLOCKS;
+    CHECK(packed == 1);
+    for(int direct = 0; direct < 2; direct++) {
+        clean(dir);
+        extract(d, dir, direct);
+    }
+    pbo_dispose(d);
+    clean(dir);
+
+    //Names leaving the directory fail the call before anything is written
+    static const char *evil[] = { "a\\..\\..\\evil.txt", "..\\evil.txt", "c:\\evil.txt", "a\\b:c.txt", ".\\x.txt" };
+    for(size_t i = 0; i < sizeof evil / sizeof *evil; i++) {
+        CHECK((d = build(path, evil[i])) != NULL);
+        if(d)
+            CHECK(pbo_extract(d, dir, NULL) == PBO_ERROR_BROKEN);
+        CHECK(!exists(dir));
+        pbo_dispose(d);
+        clean(dir);
+    }
+
+    remove(path);
+    return check_failed;
+}
+#else
+int main(void)
+{
+    return SKIP;
+}
+#endif
@@ -0,0 +1,131 @@
+/* test_http.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "check.h"
+#include "pbo-private.h"
+
+#define SKIP 77 //What automake's test driver takes for skipped
+
+#if defined(HAVE_UNISTD_H) && defined(HAVE_SYS_SOCKET_H)
+# include <unistd.h>
+# include <sys/socket.h>
+
+static unsigned char stored[4000], packed[80000];
+static char replies[65536];
+
+struct reply {
+    int status;
+    const char *range; //Content-Range, NULL without one
+    size_t length;
+    const char *body; //NULL for HEAD
+};
+
+//Takes the next response off *p, expecting a body unless head
+static int next_reply(char **p, char *end, int head, struct reply *r)
+{
+    char *sep = strstr(*p, "\r\n\r\n");
+    if(!sep || strncmp(*p, "HTTP/1.1 ", 9))
+        return -1;
+    *sep = '\0';
+    r->status = atoi(*p + 9);
+    char *cl = strstr(*p, "\r\nContent-Length: "), *cr = strstr(*p, "\r\nContent-Range: "), *eol;
+    r->length = cl ? strtoul(cl + 18, NULL, 10) : 0;
+    r->range = cr ? cr + 17 : NULL;
+    if(cr && (eol = strchr(cr + 17, '\r')))
+        *eol = '\0';
+    r->body = head ? NULL : sep + 4;
+    *p = sep + 4 + (head ? 0 : r->length);
+    return *p > end ? -1 : 0;
+}
+
+int main(void)
+{
+    const char *path = "test_http.pbo";
+    check_fill(stored, sizeof stored, 1, 0);
+    check_fill(packed, sizeof packed, 2, 1);
+    pbo_block_options bo = { 50000, 16384, 1 };
+    pbo_t d = pbo_init(path);
+    CHECK(pbo_init_new(d) == PBO_SUCCESS);
+    CHECK(pbo_set_block_packing(d, &bo) == PBO_SUCCESS);
+    CHECK(pbo_add_file_borrow(d, "dir\\stored.bin", stored, sizeof stored) == PBO_SUCCESS);
+    CHECK(pbo_add_file_borrow(d, "packed.txt", packed, sizeof packed) == PBO_SUCCESS);
+    CHECK(pbo_write(d) == PBO_SUCCESS);
+    pbo_dispose(d);
+
+    pbo_http_t s = pbo_http_init();
+    int fds[2];
+    CHECK((d = check_open(path)) && s && !pbo_http_add(s, "a", d));
+    //One without its index, as after a commit that couldn't rebuild it
+    pbo_t bare = check_open(path);
+    if(bare)
+        pbo_index_free(bare);
+    CHECK(bare && s && !pbo_http_add(s, "b", bare));
+    if(!d || !bare || !s || socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+        return SKIP;
+
+    //All pipelined, the answers are small enough to sit in the socket meanwhile
+    static const char requests[] =
+        "GET /a/dir/stored.bin HTTP/1.1\r\nRange: bytes=0-9\r\n\r\n"
+        "GET /a/DIR/stored.bin HTTP/1.1\r\nRange: bytes=-5\r\n\r\n"
+        "GET /a/dir%5Cstored.bin HTTP/1.1\r\nRange: bytes=3990-\r\n\r\n"
+        "GET /a/dir/stored.bin HTTP/1.1\r\nRange: bytes=4000-\r\n\r\n"
+        "GET /a/dir/stored.bin HTTP/1.1\r\nRange: bytes=-0\r\n\r\n"
+        "GET /a/dir/stored.bin HTTP/1.1\r\nRange: bytes=5-2\r\n\r\n"
+        "GET /a/packed.txt HTTP/1.1\r\nRange: bytes=16380-16399\r\n\r\n"
+        "GET /a/packed.txt HTTP/1.1\r\nRange: bytes=80000-80001\r\n\r\n"
+        "HEAD /a/packed.txt HTTP/1.1\r\nRange: bytes=0-0\r\n\r\n"
+        "GET /b/DIR/stored.bin HTTP/1.1\r\nRange: bytes=1-2\r\n\r\n"
+        "GET /a/missing HTTP/1.1\r\nConnection: close\r\n\r\n";
+    CHECK(write(fds[0], requests, sizeof requests - 1) == sizeof requests - 1);
+    shutdown(fds[0], SHUT_WR);
+    CHECK(pbo_http_serve(s, fds[1]) == PBO_SUCCESS);
+    close(fds[1]);
+
+    size_t len = 0;
+    ssize_t got;
+    while(len < sizeof replies - 1 && (got = read(fds[0], replies + len, sizeof replies - 1 - len)) > 0)
+        len += got;
+    close(fds[0]);
+    replies[len] = '\0';
+
+    char *p = replies, *end = replies + len;
+    struct reply r;
+    CHECK(!next_reply(&p, end, 0, &r) && r.status == 206 && r.length == 10 && r.range &&
+          !strcmp(r.range, "bytes 0-9/4000") && !memcmp(r.body, stored, 10));
+    CHECK(!next_reply(&p, end, 0, &r) && r.status == 206 && r.length == 5 && r.range &&
+          !strcmp(r.range, "bytes 3995-3999/4000") && !memcmp(r.body, stored + 3995, 5));
+    CHECK(!next_reply(&p, end, 0, &r) && r.status == 206 && r.length == 10 && r.range &&
+          !strcmp(r.range, "bytes 3990-3999/4000") && !memcmp(r.body, stored + 3990, 10));
+    //Starting past the end, or asking for no bytes at all, can't be satisfied
+    CHECK(!next_reply(&p, end, 0, &r) && r.status == 416 && r.length == 0 && r.range &&
+          !strcmp(r.range, "bytes */4000"));
+    CHECK(!next_reply(&p, end, 0, &r) && r.status == 416 && r.length == 0);
+    //A malformed range is ignored
+    CHECK(!next_reply(&p, end, 0, &r) && r.status == 200 && r.length == 4000 && !r.range &&
+          !memcmp(r.body, stored, 4000));
+    //Across a block edge of a packed entry, sizes are the decoded ones
+    CHECK(!next_reply(&p, end, 0, &r) && r.status == 206 && r.length == 20 && r.range &&
+          !strcmp(r.range, "bytes 16380-16399/80000") && !memcmp(r.body, packed + 16380, 20));
+    CHECK(!next_reply(&p, end, 0, &r) && r.status == 416 && r.range && !strcmp(r.range, "bytes */80000"));
+    CHECK(!next_reply(&p, end, 1, &r) && r.status == 206 && r.length == 1);
+    CHECK(!next_reply(&p, end, 0, &r) && r.status == 206 && r.length == 2 && !memcmp(r.body, stored + 1, 2));
+    CHECK(!next_reply(&p, end, 0, &r) && r.status == 404);
+    CHECK(p == end);
+
+    pbo_http_dispose(s);
+    pbo_dispose(bare);
+    pbo_dispose(d);
+    remove(path);
+    return check_failed;
+}
+#else
+int main(void)
+{
+    return SKIP;
+}
+#endif
@@ -0,0 +1,90 @@
+/* test_latency.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "check.h"
+#include "pbo-private.h"
+
+//Buckets tile the range without gaps, each value lands in the one holding it
+static void check_buckets(void)
+{
+    for(size_t i = 0; i < HIST_BUCKETS; i++) {
+        uint64_t lo = pbo_hist_lower(i), hi = pbo_hist_upper(i);
+        CHECK(lo <= hi);
+        CHECK(pbo_hist_index(lo) == i && pbo_hist_index(hi) == i);
+        CHECK(pbo_hist_index(lo + (hi - lo) / 2) == i);
+        if(i + 1 < HIST_BUCKETS)
+            CHECK(hi + 1 == pbo_hist_lower(i + 1));
+        if(i >= HIST_SUB)
+            CHECK((hi - lo + 1) * HIST_SUB <= lo);
+    }
+    CHECK(pbo_hist_lower(0) == 0);
+    CHECK(pbo_hist_upper(HIST_BUCKETS - 1) == ((uint64_t)1 << HIST_MAXBITS) - 1);
+    CHECK(pbo_hist_index((uint64_t)1 << HIST_MAXBITS) == HIST_BUCKETS - 1);
+    CHECK(pbo_hist_index(UINT64_MAX) == HIST_BUCKETS - 1);
+}
+
+//Cut off anywhere it's the start of the whole, terminated, nothing past size written
+static void check_json(const char *full, size_t need, size_t size)
+{
+    char buf[4096];
+    if(size + 8 > sizeof buf)
+        return;
+    memset(buf, '#', size + 8);
+    CHECK(pbo_latency_json(size ? buf : NULL, size) == need);
+    if(size) {
+        size_t len = size - 1 < need ? size - 1 : need;
+        CHECK(strlen(buf) == len && !memcmp(buf, full, len));
+    }
+    for(size_t i = size; i < size + 8; i++)
+        CHECK(buf[i] == '#');
+}
+
+int main(void)
+{
+    const char *path = "test_latency.pbo";
+    unsigned char data[5000];
+    check_buckets();
+
+    pbo_set_latency_histograms(1);
+    pbo_latency_reset();
+    check_fill(data, sizeof data, 1, 1);
+    pbo_t d = pbo_init(path);
+    CHECK(pbo_init_new(d) == PBO_SUCCESS);
+    CHECK(pbo_add_file_borrow(d, "a.txt", data, sizeof data) == PBO_SUCCESS);
+    CHECK(pbo_write(d) == PBO_SUCCESS);
+    pbo_dispose(d);
+    for(int i = 0; i < 3; i++)
+        pbo_dispose(check_open(path));
+    pbo_set_latency_histograms(0);
+    remove(path);
+
+    CHECK(pbo_latency_percentile(PBO_OP_READ_HEADER, 0.5) <= pbo_latency_percentile(PBO_OP_READ_HEADER, 1));
+    CHECK(pbo_latency_percentile(PBO_OP_VERIFY, 0.5) == 0);
+    CHECK(pbo_latency_percentile(PBO_OP_COUNT, 0.5) == 0);
+
+    size_t need = pbo_latency_json(NULL, 0);
+    char *full = malloc(need + 1);
+    CHECK(full && pbo_latency_json(full, need + 1) == need && strlen(full) == need);
+    if(full) {
+        CHECK(!strncmp(full, "{\"unit\":\"ns\",\"ops\":{\"read_header\":{\"count\":3,", 44));
+        CHECK(strstr(full, "\"write\":{\"count\":1,") && strstr(full, "\"verify\":{\"count\":0,"));
+        CHECK(!strcmp(full + need - 2, "}}"));
+        static const size_t sizes[] = { 0, 1, 2, 20, 100 };
+        for(size_t i = 0; i < sizeof sizes / sizeof *sizes; i++)
+            check_json(full, need, sizes[i]);
+        check_json(full, need, need / 2);
+        check_json(full, need, need);
+        check_json(full, need, need + 1);
+        check_json(full, need, need + 5);
+    }
+    free(full);
+
+    pbo_latency_reset();
+    CHECK(pbo_latency_percentile(PBO_OP_READ_HEADER, 1) == 0);
+    return check_failed;
+}
@@ -0,0 +1,82 @@
+/* test_lzss.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "check.h"
+#include "pbo-private.h"
+
+//Decodes src of n bytes to exactly want, or checks that it's refused
+static int decodes(const unsigned char *src, size_t n, const char *want, size_t len)
+{
+    unsigned char out[64];
+    if(pbo_lzss_decode(src, n, out, len))
+        return !want;
+    return want && !memcmp(out, want, len);
+}
+
+static void round_trip(const unsigned char *src, size_t n)
+{
+    size_t cap = n + n / 8 + 16;
+    unsigned char *packed = malloc(cap), *back = malloc(n ? n : 1);
+    size_t len = packed && back ? pbo_lzss_encode(src, n, packed, cap) : 0;
+    CHECK(len > 0);
+    CHECK(len && !pbo_lzss_decode(packed, len, back, n) && !memcmp(back, src, n));
+    CHECK(!len || !n || pbo_lzss_encode(src, n, packed, len - 1) == 0); //Too small a buffer is no result
+    free(packed);
+    free(back);
+}
+
+int main(void)
+{
+    //Literals, a back reference overlapping itself, and one before the start
+    static const unsigned char lit[] = { 0x0F, 'a', 'b', 'c', 'd', 0x8A, 0x01, 0, 0 };
+    static const unsigned char ref[] = { 0x07, 'a', 'b', 'c', 0x03, 0x03, 0x72, 0x03, 0, 0 };
+    static const unsigned char spaces[] = { 0x02, 0x05, 0x00, 'x', 0xD8, 0, 0, 0 };
+    CHECK(decodes(lit, sizeof lit, "abcd", 4));
+    CHECK(decodes(ref, sizeof ref, "abcabcabc", 9));
+    CHECK(decodes(spaces, sizeof spaces, "   x", 4));
+
+    //Wrong sums, streams ending early and distance 0 are refused
+    static const unsigned char badsum[] = { 0x0F, 'a', 'b', 'c', 'd', 0x8B, 0x01, 0, 0 };
+    static const unsigned char zero[] = { 0x00, 0x00, 0x00, 0, 0, 0, 0 };
+    CHECK(decodes(badsum, sizeof badsum, NULL, 4));
+    CHECK(decodes(lit, sizeof lit - 1, NULL, 4));
+    CHECK(decodes(lit, 3, NULL, 4));
+    CHECK(decodes(ref, 5, NULL, 9));
+    CHECK(decodes(zero, sizeof zero, NULL, 3));
+
+    static unsigned char text[200000], noise[70000];
+    check_fill(text, sizeof text, 1, 1);
+    check_fill(noise, sizeof noise, 2, 0);
+    round_trip(text, sizeof text);
+    round_trip(noise, sizeof noise);
+    round_trip(text, 1);
+    round_trip(text, 0);
+
+    //A compressed entry in an archive reads back decoded
+    static unsigned char archive[4096];
+    unsigned char packed[2048];
+    size_t plen = pbo_lzss_encode(text, 1500, packed, sizeof packed), at = 0;
+    CHECK(plen > 0 && plen < 1500);
+    uint32_t props[5] = { PBO_PACKING_COMPRESSED, 1500, 0, 0, plen };
+    memcpy(archive, "z.txt", 6);
+    at = 6;
+    for(int i = 0; i < 20; i++)
+        archive[at++] = props[i / 4] >> (8 * (i % 4));
+    at += 21; //The terminating entry, all zero
+    memcpy(archive + at, packed, plen);
+    at += plen + 21; //And an empty hash
+
+    pbo_io io;
+    pbo_t d = pbo_init(NULL);
+    CHECK(d && !pbo_io_memory(&io, archive, at) && !pbo_set_io(d, &io));
+    CHECK(pbo_read_header(d) == PBO_SUCCESS);
+    CHECK(check_entry(d, "z.txt", text, 1500));
+    pbo_dispose(d);
+    pbo_io_close(&io);
+    return check_failed;
+}
@@ -0,0 +1,115 @@
+/* test_merge.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "check.h"
+#include "pbo-private.h"
+
+#define FILES 6
+
+static unsigned char data[FILES][30000];
+static unsigned char other[500];
+static size_t sizes[FILES] = { 10000, 10000, 30000, 100, 9000, 9000 }; //The third won't fit a part
+
+static long size_of(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    long len = file && !fseek(file, 0, SEEK_END) ? ftell(file) : -1;
+    if(file)
+        fclose(file);
+    return len;
+}
+
+static int first_prefix(pbo_t d)
+{
+    const char *v = pbo_get_extension(d, "prefix");
+    return v && !strcmp(v, "first");
+}
+
+int main(void)
+{
+    const char *inputs[2] = { "test_merge_a.pbo", "test_merge_b.pbo" }, *merged = "test_merge.pbo";
+    char name[32], path[64];
+
+    //Files 0-3 in the first input, 3-5 in the second with its own 3
+    check_fill(other, sizeof other, 77, 0);
+    for(int i = 0; i < FILES; i++)
+        check_fill(data[i], sizes[i], i, i % 2);
+    for(int k = 0; k < 2; k++) {
+        pbo_t d = pbo_init(inputs[k]);
+        CHECK(pbo_init_new(d) == PBO_SUCCESS);
+        CHECK(pbo_set_extension(d, "prefix", k ? "second" : "first") == PBO_SUCCESS);
+        for(int i = k ? 3 : 0; i < (k ? FILES : 4); i++) {
+            sprintf(name, "f%d", i);
+            if(k && i == 3)
+                CHECK(pbo_add_file_borrow(d, name, other, sizeof other) == PBO_SUCCESS);
+            else
+                CHECK(pbo_add_file_borrow(d, name, data[i], sizes[i]) == PBO_SUCCESS);
+        }
+        CHECK(pbo_write(d) == PBO_SUCCESS);
+        pbo_dispose(d);
+    }
+
+    //Everything once, the first input winning both the name and the extension
+    pbo_t in[2] = { check_open(inputs[0]), check_open(inputs[1]) };
+    CHECK(in[0] && in[1]);
+    if(!in[0] || !in[1])
+        return 1;
+    pbo_index_free(in[1]); //As after a commit whose index couldn't be rebuilt
+    CHECK(pbo_merge(merged, in, 2) == PBO_SUCCESS);
+    pbo_t d = check_open(merged);
+    CHECK(d != NULL);
+    if(!d)
+        return 1;
+    for(int i = 0; i < FILES; i++) {
+        sprintf(name, "f%d", i);
+        CHECK(check_entry(d, name, data[i], sizes[i]));
+    }
+    CHECK(first_prefix(d));
+    CHECK(pbo_verify(d) == PBO_SUCCESS);
+
+    //Cut apart again, each part within bounds but for the one entry too big
+    unsigned int parts = 0;
+    long maxsize = 25000;
+    pbo_index_free(d);
+    CHECK(pbo_split(d, "test_merge_part", maxsize, &parts) == PBO_SUCCESS);
+    CHECK(parts >= 3);
+    int found[FILES] = { 0 };
+    for(unsigned int p = 1; p <= parts; p++) {
+        sprintf(path, "test_merge_part_%u.pbo", p);
+        pbo_t part = check_open(path);
+        CHECK(part != NULL);
+        if(!part)
+            continue;
+        CHECK(first_prefix(part));
+        int mine = 0, big = 0;
+        for(int i = 0; i < FILES; i++) {
+            sprintf(name, "f%d", i);
+            if(pbo_get_file_size(part, name)) {
+                CHECK(check_entry(part, name, data[i], sizes[i]));
+                found[i]++;
+                mine++;
+                big |= sizes[i] > (size_t)maxsize / 2;
+            }
+        }
+        CHECK(size_of(path) <= maxsize || (mine == 1 && big));
+        pbo_dispose(part);
+        remove(path);
+    }
+    for(int i = 0; i < FILES; i++)
+        CHECK(found[i] == 1);
+    sprintf(path, "test_merge_part_%u.pbo", parts + 1);
+    CHECK(size_of(path) < 0);
+
+    pbo_dispose(d);
+    pbo_dispose(in[0]);
+    pbo_dispose(in[1]);
+    remove(inputs[0]);
+    remove(inputs[1]);
+    remove(merged);
+    return check_failed;
+}
@@ -0,0 +1,83 @@
+/* test_own.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "check.h"
+
+//Counts its calls in user, frees like the default would
+static void counted_free(void *data, void *user)
+{
+    (*(int *)user)++;
+    free(data);
+}
+
+static unsigned char *owned(size_t n, uint32_t seed)
+{
+    unsigned char *p = malloc(n);
+    if(p)
+        check_fill(p, n, seed, 1);
+    return p;
+}
+
+int main(void)
+{
+    const char *path = "test_own.pbo";
+    static const unsigned char borrowed[] = "borrowed, never freed nor written to";
+    unsigned char copy[sizeof borrowed];
+    memcpy(copy, borrowed, sizeof copy);
+    unsigned char want[5000];
+    check_fill(want, sizeof want, 1, 1);
+
+    //Released once, when the archive lets go of it and not when written
+    int freed = 0, replaced = 0, removed = 0, failed = 0;
+    pbo_t d = pbo_init(path);
+    CHECK(pbo_init_new(d) == PBO_SUCCESS);
+    CHECK(pbo_add_file_own(d, "own.txt", owned(sizeof want, 1), sizeof want, counted_free, &freed) == PBO_SUCCESS);
+    CHECK(pbo_add_file_own(d, "same.txt", owned(100, 2), 100, counted_free, &replaced) == PBO_SUCCESS);
+    CHECK(pbo_add_file_own(d, "gone.txt", owned(100, 3), 100, counted_free, &removed) == PBO_SUCCESS);
+    CHECK(pbo_add_file_own(d, "default.txt", owned(10, 4), 10, NULL, NULL) == PBO_SUCCESS);
+    CHECK(pbo_add_file_borrow(d, "borrowed.txt", borrowed, sizeof borrowed) == PBO_SUCCESS);
+    CHECK(pbo_write(d) == PBO_SUCCESS);
+    CHECK(freed <= 1);
+    pbo_dispose(d);
+    CHECK(freed == 1 && replaced == 1 && removed == 1);
+    CHECK(!memcmp(borrowed, copy, sizeof copy));
+
+    //Replaced or removed in an edit session, and what's added there
+    freed = replaced = removed = 0;
+    int added = 0;
+    CHECK((d = check_open(path)) != NULL);
+    if(!d)
+        return 1;
+    CHECK(check_entry(d, "own.txt", want, sizeof want));
+    CHECK(check_entry(d, "borrowed.txt", borrowed, sizeof borrowed));
+    CHECK(pbo_edit(d) == PBO_SUCCESS);
+    CHECK(pbo_add_file_own(d, "same.txt", owned(100, 5), 100, counted_free, &replaced) == PBO_SUCCESS);
+    CHECK(pbo_add_file_own(d, "same.txt", owned(100, 6), 100, counted_free, &added) == PBO_SUCCESS);
+    CHECK(replaced == 1 && added == 0);
+    CHECK(pbo_add_file_own(d, "gone.txt", owned(50, 7), 50, counted_free, &removed) == PBO_SUCCESS);
+    CHECK(pbo_remove_file(d, "gone.txt") == PBO_SUCCESS);
+    CHECK(removed == 1);
+    CHECK(pbo_commit(d) == PBO_SUCCESS);
+    pbo_dispose(d);
+    CHECK(replaced == 1 && added == 1 && removed == 1);
+
+    //Failing hands it back through cb at once, borrowed data is left alone
+    d = pbo_init(path);
+    CHECK(pbo_add_file_own(d, "clear.txt", owned(10, 8), 10, counted_free, &failed) == PBO_ERROR_STATE);
+    CHECK(failed == 1);
+    CHECK(pbo_add_file_own(d, NULL, owned(10, 9), 10, counted_free, &failed) == PBO_ERROR_NEXIST);
+    CHECK(failed == 2);
+    CHECK(pbo_add_file_own(NULL, "x", owned(10, 10), 10, NULL, NULL) == PBO_ERROR_NEXIST);
+    CHECK(pbo_add_file_borrow(d, "clear.txt", borrowed, sizeof borrowed) == PBO_ERROR_STATE);
+    pbo_dispose(d);
+    CHECK(failed == 2);
+    CHECK(!memcmp(borrowed, copy, sizeof copy));
+
+    remove(path);
+    return check_failed;
+}
@@ -0,0 +1,97 @@
+/* test_query.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "check.h"
+
+#define MAXHITS 16
+
+static const char *names[] = {
+    "Data\\Tex\\a.paa", "data\\tex\\B.PAA", "data\\tex\\sub\\c.paa", "data\\texture.txt",
+    "Scripts\\init.sqf", "scripts\\fn\\x.sqf", "readme.txt", NULL,
+};
+#define FILES (sizeof names / sizeof *names - 1)
+
+static int cmp(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+//Whether q yields exactly the NULL terminated want, in any order
+static int yields(pbo_query *q, const char **want)
+{
+    char got[MAXHITS][PBO_MAXNAMELEN];
+    const char *gp[MAXHITS], *wp[MAXHITS];
+    const pbo_file_info *fi;
+    size_t n = 0, w = 0;
+    while((fi = pbo_query_next(q)))
+        if(n < MAXHITS) {
+            snprintf(got[n], sizeof got[n], "%s", fi->name);
+            gp[n] = got[n];
+            n++;
+        }
+    while(want[w])
+        wp[w] = want[w], w++;
+    if(n != w)
+        return 0;
+    qsort(gp, n, sizeof *gp, cmp);
+    qsort(wp, w, sizeof *wp, cmp);
+    for(size_t i = 0; i < n; i++)
+        if(strcmp(gp[i], wp[i]))
+            return 0;
+    return 1;
+}
+
+int main(void)
+{
+    const char *path = "test_query.pbo";
+    pbo_query q;
+    pbo_t d = pbo_init(path);
+    CHECK(pbo_init_new(d) == PBO_SUCCESS);
+    for(size_t i = 0; i < FILES; i++)
+        CHECK(pbo_add_file_borrow(d, names[i], names[i], strlen(names[i])) == PBO_SUCCESS);
+    CHECK(pbo_query_prefix(d, "data", &q) == PBO_ERROR_STATE); //Only read archives have an index
+    CHECK(pbo_write(d) == PBO_SUCCESS);
+    pbo_dispose(d);
+    CHECK((d = check_open(path)) != NULL);
+    if(!d)
+        return 1;
+
+    //Prefixes are plain string prefixes, files come back under their own names
+    static const char *data_tex[] = { "Data\\Tex\\a.paa", "data\\tex\\B.PAA", "data\\tex\\sub\\c.paa", "data\\texture.txt", NULL };
+    static const char *in_tex[] = { "Data\\Tex\\a.paa", "data\\tex\\B.PAA", "data\\tex\\sub\\c.paa", NULL };
+    static const char *none[] = { NULL };
+    CHECK(!pbo_query_prefix(d, "DATA/TEX", &q) && yields(&q, data_tex));
+    CHECK(!pbo_query_prefix(d, "/data\\Tex/", &q) && yields(&q, in_tex));
+    CHECK(!pbo_query_prefix(d, "data\\tex\\b", &q) && yields(&q, (const char *[]){ "data\\tex\\B.PAA", NULL }));
+    CHECK(!pbo_query_prefix(d, "zzz", &q) && yields(&q, none));
+    CHECK(!pbo_query_prefix(d, "", &q) && yields(&q, names));
+
+    //Directories list files and each subdirectory once, folded with a trailing \.
+    static const char *tex_dir[] = { "Data\\Tex\\a.paa", "data\\tex\\B.PAA", "data\\tex\\sub\\", NULL };
+    static const char *root[] = { "readme.txt", "data\\", "scripts\\", NULL };
+    static const char *scripts[] = { "Scripts\\init.sqf", "scripts\\fn\\", NULL };
+    CHECK(!pbo_query_dir(d, "data/tex", &q) && yields(&q, tex_dir));
+    CHECK(!pbo_query_dir(d, "Data\\Tex\\", &q) && yields(&q, tex_dir));
+    CHECK(!pbo_query_dir(d, "", &q) && yields(&q, root));
+    CHECK(!pbo_query_dir(d, "/SCRIPTS/", &q) && yields(&q, scripts));
+    CHECK(!pbo_query_dir(d, "data/te", &q) && yields(&q, none));
+
+    //Globs by head or by tail, * crossing separators, ? one character
+    static const char *paa[] = { "Data\\Tex\\a.paa", "data\\tex\\B.PAA", "data\\tex\\sub\\c.paa", NULL };
+    static const char *sqf[] = { "scripts\\fn\\x.sqf", NULL };
+    CHECK(!pbo_query_glob(d, "*.PAA", &q) && yields(&q, paa));
+    CHECK(!pbo_query_glob(d, "data/*.txt", &q) && yields(&q, (const char *[]){ "data\\texture.txt", NULL }));
+    CHECK(!pbo_query_glob(d, "scripts/*/?.sqf", &q) && yields(&q, sqf));
+    CHECK(!pbo_query_glob(d, "*", &q) && yields(&q, names));
+    CHECK(!pbo_query_glob(d, "data\\tex\\?.paa", &q) && yields(&q, (const char *[]){ "Data\\Tex\\a.paa", "data\\tex\\B.PAA", NULL }));
+    CHECK(!pbo_query_glob(d, "*.sqs", &q) && yields(&q, none));
+
+    pbo_dispose(d);
+    remove(path);
+    return check_failed;
+}
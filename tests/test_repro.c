@@ -0,0 +1,81 @@
+/* test_repro.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "check.h"
+
+#define EPOCH 1234567890u
+
+static const char *names[] = { "b\\two.txt", "A\\one.txt", "c.txt", "a\\z.bin" };
+#define FILES (sizeof names / sizeof *names)
+
+static unsigned char data[FILES][2000];
+
+//Packs the files in the given order into path, returns its bytes
+static unsigned char *pack(const char *path, const int *order, pbo_timestamp mode, int canonical, size_t *n)
+{
+    pbo_t d = pbo_init(path);
+    CHECK(pbo_set_timestamps(d, mode, EPOCH) == PBO_SUCCESS);
+    CHECK(pbo_set_canonical_order(d, canonical) == PBO_SUCCESS);
+    CHECK(pbo_init_new(d) == PBO_SUCCESS);
+    CHECK(pbo_set_extension(d, "prefix", "repro") == PBO_SUCCESS);
+    for(size_t i = 0; i < FILES; i++)
+        CHECK(pbo_add_file_borrow(d, names[order[i]], data[order[i]], 500 * (order[i] + 1)) == PBO_SUCCESS);
+    CHECK(pbo_write(d) == PBO_SUCCESS);
+    pbo_dispose(d);
+    unsigned char *buf = check_slurp(path, n);
+    remove(path);
+    return buf;
+}
+
+static int same(const unsigned char *a, size_t an, const unsigned char *b, size_t bn)
+{
+    return a && b && an == bn && !memcmp(a, b, an);
+}
+
+int main(void)
+{
+    static const int forward[] = { 0, 1, 2, 3 }, backward[] = { 3, 2, 1, 0 };
+    const char *path = "test_repro.pbo";
+    for(size_t i = 0; i < FILES; i++)
+        check_fill(data[i], sizeof data[i], i, i % 2);
+
+    //Any order, fixed or source time (the epoch for memory): the same bytes
+    size_t n1, n2, n3, n4;
+    unsigned char *a = pack(path, forward, PBO_TIMESTAMP_EPOCH, 1, &n1);
+    unsigned char *b = pack(path, backward, PBO_TIMESTAMP_EPOCH, 1, &n2);
+    unsigned char *c = pack(path, backward, PBO_TIMESTAMP_SOURCE, 1, &n3);
+    CHECK(same(a, n1, b, n2));
+    CHECK(same(a, n1, c, n3));
+
+    //Without canonical order the order added shows
+    unsigned char *e = pack(path, backward, PBO_TIMESTAMP_EPOCH, 0, &n4);
+    CHECK(e && !same(a, n1, e, n4));
+
+    //Sorted as lookups compare names, every timestamp the epoch
+    pbo_io io;
+    pbo_t d = pbo_init(NULL);
+    CHECK(a && d && !pbo_io_memory(&io, a, n1) && !pbo_set_io(d, &io) && !pbo_read_header(d));
+    static const char *sorted[] = { "A\\one.txt", "a\\z.bin", "b\\two.txt", "c.txt" };
+    pbo_iterator it;
+    const pbo_file_info *fi;
+    size_t i = 0;
+    CHECK(pbo_iter_begin(d, &it) == PBO_SUCCESS);
+    while((fi = pbo_iter_next(&it)) && i < FILES) {
+        CHECK(!strcmp(fi->name, sorted[i]) && fi->timestamp == EPOCH);
+        i++;
+    }
+    CHECK(i == FILES && !fi);
+    pbo_dispose(d);
+    pbo_io_close(&io);
+
+    free(a);
+    free(b);
+    free(c);
+    free(e);
+    return check_failed;
+}
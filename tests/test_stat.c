@@ -0,0 +1,100 @@
+/* test_stat.c - (C) 2015, Emir Marincic
+ * libpbo - A library to work with Arma PBO files
+ * See README for contact-, COPYING for license information. */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "check.h"
+
+static const char *names[] = { "cfg\\config.cpp", "data\\big.txt", "data\\noise.bin", "empty.txt" };
+static const size_t sizes[] = { 3000, 2 << 20, 70000, 0 };
+#define FILES (sizeof names / sizeof *names)
+
+static void build(const char *path, unsigned char *data[FILES])
+{
+    pbo_block_options bo = { 1 << 20, 65536, 1 };
+    pbo_t d = pbo_init(path);
+    CHECK(pbo_init_new(d) == PBO_SUCCESS);
+    CHECK(pbo_set_extension(d, "prefix", "x\\stat") == PBO_SUCCESS);
+    CHECK(pbo_set_block_packing(d, &bo) == PBO_SUCCESS);
+    for(size_t i = 0; i < FILES; i++)
+        CHECK(pbo_add_file_borrow(d, names[i], data[i], sizes[i]) == PBO_SUCCESS);
+    CHECK(pbo_write(d) == PBO_SUCCESS);
+    pbo_dispose(d);
+}
+
+int main(void)
+{
+    const char *path = "test_stat.pbo", *old = "test_stat_old.pbo", *cut = "test_stat_cut.pbo";
+    unsigned char *data[FILES];
+    uint64_t original = 0;
+    for(size_t i = 0; i < FILES; i++) {
+        data[i] = malloc(sizes[i] + 1);
+        check_fill(data[i], sizes[i], i, i != 2);
+        original += sizes[i];
+    }
+    build(path, data);
+
+    //What the full reader makes of it
+    size_t n = 0;
+    unsigned char *file = check_slurp(path, &n);
+    pbo_t d = check_open(path);
+    CHECK(file && d);
+    uint64_t stored = 0, first = n;
+    int packed = 0;
+    pbo_iterator it;
+    const pbo_file_info *fi;
+    CHECK(pbo_iter_begin(d, &it) == PBO_SUCCESS);
+    while((fi = pbo_iter_next(&it))) {
+        stored += fi->size;
+        if(fi->offset < first)
+            first = fi->offset;
+        packed += fi->packing_method == PBO_PACKING_BLOCKS;
+    }
+    pbo_dispose(d);
+    CHECK(packed == 1);
+
+    pbo_stat st;
+    CHECK(pbo_stat_file(path, &st) == PBO_SUCCESS && st.error == PBO_SUCCESS);
+    CHECK(st.entries == FILES);
+    CHECK(st.data_size == stored && st.data_size < original);
+    CHECK(st.original_size == original);
+    CHECK(st.header_size == first);
+    CHECK(st.file_size == n && n == first + stored + 21);
+    CHECK(!strcmp(st.prefix, "x\\stat"));
+    CHECK(st.has_sha1 && file && !file[n - 21] && !memcmp(st.sha1, file + n - 20, 20));
+
+    //Without the hash as old archives are, cut into the data, missing
+    FILE *f = fopen(old, "wb");
+    CHECK(f && file && fwrite(file, 1, n - 21, f) == n - 21);
+    if(f)
+        fclose(f);
+    CHECK(pbo_stat_file(old, &st) == PBO_SUCCESS && !st.has_sha1 && st.file_size == n - 21);
+    CHECK(st.entries == FILES && st.original_size == original);
+    f = fopen(cut, "wb");
+    CHECK(f && file && fwrite(file, 1, n - 100, f) == n - 100);
+    if(f)
+        fclose(f);
+    CHECK(pbo_stat_file(cut, &st) == PBO_ERROR_BROKEN);
+    CHECK(pbo_stat_file("test_stat_missing.pbo", &st) == PBO_ERROR_IO && st.error == PBO_ERROR_IO);
+
+    //Each gets its own result, the call fails if any did
+    const char *paths[] = { path, "test_stat_missing.pbo", old, cut };
+    pbo_stat many[4];
+    CHECK(pbo_stat_many(paths, 4, many, 2) == PBO_ERROR_BROKEN);
+    CHECK(many[0].error == PBO_SUCCESS && many[0].has_sha1 && many[0].data_size == stored);
+    CHECK(many[1].error == PBO_ERROR_IO);
+    CHECK(many[2].error == PBO_SUCCESS && !many[2].has_sha1);
+    CHECK(many[3].error == PBO_ERROR_BROKEN);
+    CHECK(pbo_stat_many(paths, 1, many, 0) == PBO_SUCCESS);
+
+    remove(path);
+    remove(old);
+    remove(cut);
+    free(file);
+    for(size_t i = 0; i < FILES; i++)
+        free(data[i]);
+    return check_failed;
+}